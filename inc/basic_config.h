@@ -0,0 +1,115 @@
+/*
+ * basic_config.h
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* Compile-time configuration of the interpreter.
+ * Each option can be overridden with a -D compiler option */
+
+#pragma once
+
+/* Compile programs into bytecode at RUN, if the application provides
+ * a buffer for it with basic_main_set_vm_buffer(). Set to 0 to save code space */
+#ifndef BASIC_CONFIG_VM
+#define BASIC_CONFIG_VM 1
+#endif
+
+/* Dispatch statements with computed gotos (a GCC extension), so that each statement
+ * jumps directly to the next one. Set to 0 for the standard C handler table */
+#ifndef BASIC_CONFIG_THREADED_DISPATCH
+#ifdef __GNUC__
+#define BASIC_CONFIG_THREADED_DISPATCH 1
+#else
+#define BASIC_CONFIG_THREADED_DISPATCH 0
+#endif
+#endif
+
+/* Keep a table of scalar variable positions, indexed by the variable name, so that
+ * variables are found without scanning. The table takes 2288 bytes in each
+ * BASIC_MEM_MGR, outside the user-provided memory. Set to 0 on the smallest targets:
+ * the variables are then scanned, and take no RAM beyond their 6-byte entries */
+#ifndef BASIC_CONFIG_VAR_SLOTS
+#define BASIC_CONFIG_VAR_SLOTS 0
+#endif
+
+/* Mark variable names in stored lines with reference tokens, which remember where
+ * the variable was last found, so that it is not looked up again. Each variable
+ * occurrence in the program then takes 3 more bytes. Set to 0 when the program
+ * memory is scarce: lines are stored as typed, and variables are looked up by name.
+ * Lines marked by another configuration, such as in an image, still run */
+#ifndef BASIC_CONFIG_VARREFS
+#define BASIC_CONFIG_VARREFS 1
+#endif
+
+/* The number of array descriptors in each BASIC_MEM_MGR, a power of 2. The descriptors
+ * locate arrays by name without scanning. They take 4 bytes each, and arrays beyond
+ * their number are found by scanning. Set to 0 to always scan */
+#ifndef BASIC_CONFIG_ARRAY_DESCRIPTORS
+#define BASIC_CONFIG_ARRAY_DESCRIPTORS 8
+#endif
+
+/* The width of array sizes and subscripts, 16 or 32 bits. With 16 bits, an array
+ * holds up to about 16K elements and subscripts go up to 32767. Set to 32 on targets
+ * with more RAM: arrays may then fill the memory, and subscripts go up to 2^24-1,
+ * the largest integer that a float holds exactly. Array headers grow by 4 bytes */
+#ifndef BASIC_CONFIG_ARRAY_INDEX_BITS
+#define BASIC_CONFIG_ARRAY_INDEX_BITS 16
+#endif
+
+/* The type of all numbers. BASIC_NUMBER_FLOAT is the single-precision float of the
+ * original BASIC. BASIC_NUMBER_DOUBLE gives more precision on hosts, and doubles
+ * the size of every value. BASIC_NUMBER_FIXED is a Q16.16 fixed-point number in the
+ * range -32768 to 32767.99998, with all arithmetic done on integers, for cores
+ * without an FPU */
+#define BASIC_NUMBER_FLOAT 0
+#define BASIC_NUMBER_DOUBLE 1
+#define BASIC_NUMBER_FIXED 2
+#ifndef BASIC_CONFIG_NUMBER
+#define BASIC_CONFIG_NUMBER BASIC_NUMBER_FLOAT
+#endif
+
+/* Store variable values aligned, so that they are read and written with whole-word
+ * accesses. By default, values are packed and may be unaligned: cores without unaligned
+ * access (such as Cortex-M0) then access them byte by byte. With 1, each scalar variable
+ * takes 8 bytes instead of 6 (12 instead of 10 with doubles, which are 4-byte aligned
+ * as well), and up to 3 bytes are left unused below the scalar
+ * variables and at the top of the memory. Arrays cost nothing extra */
+#ifndef BASIC_CONFIG_ALIGNED_VALUES
+#define BASIC_CONFIG_ALIGNED_VALUES 0
+#endif
+
+/* Support the MAT statements and the array reduction functions SUM, MIN, MAX, MEAN
+ * and DOT, which run whole-array operations in native code.
+ * The kernels use SSE or AVX on x86, and NEON or Helium on ARM when the values
+ * are aligned. Set to 0 to save code space */
+#ifndef BASIC_CONFIG_MAT
+#define BASIC_CONFIG_MAT 1
+#endif
@@ -48,6 +48,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
     X(DIVISION_BY_ZERO,      "Division by 0") \
     X(IN_PROGRAM_ONLY,       "In program only") \
     X(STOP,                  "STOP") \
+    X(IO,                    "I/O") \
+    X(BAD_IMAGE,             "Bad image") \
+    X(DIRECT_ONLY,           "Direct only") \
     X(INTERNAL,              "Internal")
 
 #define DEFINE_ERROR_ID(ID, TEXT) BASIC_ERROR_##ID,
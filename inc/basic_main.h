@@ -36,6 +36,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "program_storage.h"
 #include "variable_storage.h"
 #include "for_gosub_stack.h"
+#include "basic_vm.h"
 
 typedef struct BASIC_MAIN_STATE_
 {
@@ -44,17 +45,56 @@ typedef struct BASIC_MAIN_STATE_
     BASIC_MEM_MGR prog;
     unsigned current_line;
     unsigned data_line;
+    unsigned data_entry; /* The next DATA statement in the DATA index */
     bool error_in_data;
     char input_buf[80];
+#if BASIC_CONFIG_VM
+    BASIC_VM vm;
+#endif
 } BASIC_MAIN_STATE;
 
 /* Initialization of the interpreter state */
 void basic_main_initialize(BASIC_MAIN_STATE* bs, void* prog_base, unsigned prog_size);
 
+/* Provide a buffer for compiling the program into bytecode at RUN, which runs
+ * several times faster than interpreting it. Statements that are not compiled,
+ * such as PRINT or INPUT, are interpreted. Programs whose code does not fit are
+ * interpreted as a whole. The buffer is not needed when BASIC_CONFIG_VM is 0 */
+void basic_main_set_vm_buffer(BASIC_MAIN_STATE* bs, void* buf, unsigned size);
+
+/* Provide a buffer for caching the compiled expressions of the statements that are
+ * interpreted, such as PRINT, or of the whole program when it is not compiled.
+ * Expressions are compiled when they are first evaluated, and those that do not fit
+ * are evaluated by the expression engine. The cache is emptied when program lines change.
+ * The buffer is not needed when BASIC_CONFIG_VM is 0 */
+void basic_main_set_expr_cache(BASIC_MAIN_STATE* bs, void* buf, unsigned size);
+
 /* Process a line as if typed in the interactive prompt
  * (executes a command, stores or modifies a program line) */
 bool basic_main_process_line(BASIC_MAIN_STATE* bs, char* str);
 
+/* Load a program from a text buffer of the given length, one program line per
+ * text line. The lines are merged into the current program as if typed in the
+ * interactive prompt, but variables, the FOR/GOSUB stack, and the DATA pointer
+ * are reset only once. Each text line is tokenized in the free memory, so
+ * there must be room for the longest text line in addition to the program.
+ * Returns BASIC_ERROR_OK, or the error that stopped loading */
+enum BASIC_ERROR_ID basic_main_load_program(BASIC_MAIN_STATE* bs, const char* text, unsigned len);
+
+/* Replace the program with a program image made by SAVE. The image is validated
+ * and copied into the program storage, so it may reside in read-only memory.
+ * Variables, the FOR/GOSUB stack, and the DATA pointer are reset.
+ * Returns BASIC_ERROR_OK, or BASIC_ERROR_BAD_IMAGE or BASIC_ERROR_OUT_OF_MEMORY
+ * (in which case the old program is kept) */
+enum BASIC_ERROR_ID basic_main_load_image(BASIC_MAIN_STATE* bs, const void* image, unsigned size);
+
+/* Run the program of an image made by SAVE in place from read-only memory, such as flash.
+ * Only the variables and the FOR/GOSUB stack use the RAM, together with a RAM overlay
+ * that holds the lines edited later. The image must stay valid until it is replaced
+ * by NEW or LOAD, or until SAVE copies the program into RAM.
+ * Returns BASIC_ERROR_OK, or BASIC_ERROR_BAD_IMAGE (in which case the old program is kept) */
+enum BASIC_ERROR_ID basic_main_attach_image(BASIC_MAIN_STATE* bs, const void* image, unsigned size);
+
 /* Run an interactive command prompt loop
  * (the user may type program lines or commands for immediate execution) */
 void basic_main_interactive_prompt(BASIC_MAIN_STATE* bs);
@@ -62,3 +102,10 @@ void basic_main_interactive_prompt(BASIC_MAIN_STATE* bs);
 /*-------- Callbacks ---------*/
 
 bool basic_callback_check_break_key(void);
+/* Store a program image for SAVE. The image is the concatenation of
+ * the header and the program data. Returns false on a write error */
+bool basic_callback_save_image(const void* header, unsigned header_size, const void* data, unsigned data_size);
+/* Locate a program image for LOAD. Returns a pointer to the image and stores its size,
+ * or returns NULL if there is no image. The image is only read, so it may reside
+ * in memory-mapped storage */
+const void* basic_callback_load_image(unsigned* size);
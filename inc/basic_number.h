@@ -0,0 +1,537 @@
+/*
+ * basic_number.h
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* The numeric type selected by BASIC_CONFIG_NUMBER, and the arithmetic on it.
+ * All modules compute through these primitives, so that they do not depend on the type.
+ * Arithmetic errors are sticky, as the floating-point exceptions are: they are cleared
+ * with basic_number_clear_errors() and tested after a sequence of operations */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "basic_config.h"
+#include "basic_errors.h"
+
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+
+typedef int32_t basic_number_t;
+typedef uint32_t basic_number_bits_t;
+
+#define BASIC_NUMBER_FRAC_BITS 16
+#define BASIC_NUMBER_ONE ((basic_number_t)1 << BASIC_NUMBER_FRAC_BITS)
+
+/* Error flags, in the order of their priority */
+#define BASIC_NUMBER_DIVBYZERO 1
+#define BASIC_NUMBER_INVALID 2
+#define BASIC_NUMBER_OVERFLOW 4
+
+/* Errors raised since the last basic_number_clear_errors(). Each interpreter instance
+ * keeps its own flags in its memory manager, and passes them to the arithmetic */
+typedef uint_fast8_t basic_number_flags_t;
+
+static inline void basic_number_clear_errors(basic_number_flags_t* flags)
+{
+    *flags = 0;
+}
+
+static inline bool basic_number_failed(const basic_number_flags_t* flags)
+{
+    return *flags != 0;
+}
+
+/* Saturate a wide result, and flag it if it does not fit */
+static inline basic_number_t basic_number_narrow(basic_number_flags_t* flags, int64_t v)
+{
+    if(v > INT32_MAX)
+    {
+        *flags |= BASIC_NUMBER_OVERFLOW;
+        return INT32_MAX;
+    }
+    if(v < INT32_MIN)
+    {
+        *flags |= BASIC_NUMBER_OVERFLOW;
+        return INT32_MIN;
+    }
+    return (basic_number_t)v;
+}
+
+static inline basic_number_t basic_number_from_int(basic_number_flags_t* flags, int32_t i)
+{
+    return basic_number_narrow(flags, (int64_t)i * BASIC_NUMBER_ONE);
+}
+
+/* Convert an integer without raising an error. Returns false if it is out of range */
+static inline bool basic_number_from_int_checked(int32_t i, basic_number_t* out)
+{
+    if(i < INT32_MIN / BASIC_NUMBER_ONE || i > INT32_MAX / BASIC_NUMBER_ONE)
+    {
+        return false;
+    }
+    *out = (basic_number_t)(i * BASIC_NUMBER_ONE);
+    return true;
+}
+
+static inline basic_number_t basic_number_add(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    return basic_number_narrow(flags, (int64_t)a + b);
+}
+
+static inline basic_number_t basic_number_sub(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    return basic_number_narrow(flags, (int64_t)a - b);
+}
+
+static inline basic_number_t basic_number_neg(basic_number_flags_t* flags, basic_number_t a)
+{
+    return basic_number_narrow(flags, -(int64_t)a);
+}
+
+/* The product is rounded toward zero */
+static inline basic_number_t basic_number_mul(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    return basic_number_narrow(flags, (int64_t)a * b / BASIC_NUMBER_ONE);
+}
+
+/* The quotient is rounded toward zero */
+static inline basic_number_t basic_number_div(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    if(!b)
+    {
+        *flags |= BASIC_NUMBER_DIVBYZERO;
+        return 0;
+    }
+    return basic_number_narrow(flags, (int64_t)a * BASIC_NUMBER_ONE / b);
+}
+
+static inline basic_number_t basic_number_div_uint(basic_number_flags_t* flags, basic_number_t a, unsigned n)
+{
+    return n ? a / (int32_t)n : basic_number_div(flags, a, 0);
+}
+
+static inline basic_number_t basic_number_floor(basic_number_t a)
+{
+    return a - (a & (BASIC_NUMBER_ONE - 1));
+}
+
+static inline basic_number_t basic_number_abs(basic_number_flags_t* flags, basic_number_t a)
+{
+    return a < 0 ? basic_number_neg(flags, a) : a;
+}
+
+/* Get the value as an integer, if it is integral */
+static inline bool basic_number_to_int(basic_number_t a, int32_t* out)
+{
+    if(a & (BASIC_NUMBER_ONE - 1))
+    {
+        return false;
+    }
+    *out = a / BASIC_NUMBER_ONE;
+    return true;
+}
+
+/* Round a value in the range of 0 to max down to an index */
+static inline bool basic_number_to_index(basic_number_t a, unsigned max, unsigned* out)
+{
+    if(a < 0 || (unsigned)(a >> BASIC_NUMBER_FRAC_BITS) > max)
+    {
+        return false;
+    }
+    *out = a >> BASIC_NUMBER_FRAC_BITS;
+    return true;
+}
+
+/* Round a value down to an integer. Every Q16.16 value has one */
+static inline bool basic_number_floor_int(basic_number_t a, int32_t* out)
+{
+    *out = a >> BASIC_NUMBER_FRAC_BITS;
+    return true;
+}
+
+/* Convert a wide integer, raising an overflow if it does not fit */
+static inline basic_number_t basic_number_from_int64(basic_number_flags_t* flags, int64_t i)
+{
+    return basic_number_from_int(flags, i > INT32_MAX ? INT32_MAX : i < INT32_MIN ? INT32_MIN : (int32_t)i);
+}
+
+basic_number_t basic_number_sqrt(basic_number_flags_t* flags, basic_number_t a);
+basic_number_t basic_number_sin(basic_number_t a);
+
+#else /* Floating-point types */
+
+#include <math.h>
+#include <fenv.h>
+
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+typedef double basic_number_t;
+typedef uint64_t basic_number_bits_t;
+#define BASIC_NUMBER_MATH(F) F
+#else
+typedef float basic_number_t;
+typedef uint32_t basic_number_bits_t;
+#define BASIC_NUMBER_MATH(F) F##f
+#endif
+
+#define BASIC_NUMBER_ERRORS (FE_DIVBYZERO | FE_INVALID | FE_OVERFLOW)
+
+/* The errors are raised in the floating-point status of the thread, so the flags
+ * of the interpreter instance are not used */
+typedef uint_fast8_t basic_number_flags_t;
+
+static inline void basic_number_clear_errors(basic_number_flags_t* flags)
+{
+    (void)flags;
+    feclearexcept(FE_ALL_EXCEPT);
+}
+
+static inline bool basic_number_failed(const basic_number_flags_t* flags)
+{
+    (void)flags;
+    return fetestexcept(BASIC_NUMBER_ERRORS) != 0;
+}
+
+static inline basic_number_t basic_number_from_int(basic_number_flags_t* flags, int32_t i)
+{
+    (void)flags;
+    return (basic_number_t)i;
+}
+
+static inline bool basic_number_from_int_checked(int32_t i, basic_number_t* out)
+{
+    *out = (basic_number_t)i;
+    return true;
+}
+
+static inline basic_number_t basic_number_add(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    (void)flags;
+    return a + b;
+}
+
+static inline basic_number_t basic_number_sub(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    (void)flags;
+    return a - b;
+}
+
+static inline basic_number_t basic_number_neg(basic_number_flags_t* flags, basic_number_t a)
+{
+    (void)flags;
+    return -a;
+}
+
+static inline basic_number_t basic_number_mul(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    (void)flags;
+    return a * b;
+}
+
+static inline basic_number_t basic_number_div(basic_number_flags_t* flags, basic_number_t a, basic_number_t b)
+{
+    (void)flags;
+    return a / b;
+}
+
+static inline basic_number_t basic_number_div_uint(basic_number_flags_t* flags, basic_number_t a, unsigned n)
+{
+    (void)flags;
+    return a / (basic_number_t)n;
+}
+
+static inline basic_number_t basic_number_floor(basic_number_t a)
+{
+    return BASIC_NUMBER_MATH(floor)(a);
+}
+
+static inline basic_number_t basic_number_abs(basic_number_flags_t* flags, basic_number_t a)
+{
+    (void)flags;
+    return BASIC_NUMBER_MATH(fabs)(a);
+}
+
+/* Integers are limited, so that an integer FOR loop counter does not overflow
+ * when it is incremented by the step */
+#define BASIC_NUMBER_INT_LIMIT 1073741824.0f
+
+/* Get the value as an integer, if it is integral */
+static inline bool basic_number_to_int(basic_number_t a, int32_t* out)
+{
+    if(!(a > -BASIC_NUMBER_INT_LIMIT && a < BASIC_NUMBER_INT_LIMIT))
+    {
+        return false;
+    }
+    int32_t i = (int32_t)a;
+    if((basic_number_t)i != a)
+    {
+        return false;
+    }
+    *out = i;
+    return true;
+}
+
+/* Round a value in the range of 0 to max down to an index */
+static inline bool basic_number_to_index(basic_number_t a, unsigned max, unsigned* out)
+{
+    if(!(a >= 0) || a > (basic_number_t)max)
+    {
+        return false;
+    }
+    *out = (unsigned)a;
+    return true;
+}
+
+/* Round a value down to an integer. Returns false if it does not fit 32 bits */
+static inline bool basic_number_floor_int(basic_number_t a, int32_t* out)
+{
+    basic_number_t f = BASIC_NUMBER_MATH(floor)(a);
+    if(!(f >= (basic_number_t)INT32_MIN && f < -(basic_number_t)INT32_MIN))
+    {
+        return false;
+    }
+    *out = (int32_t)f;
+    return true;
+}
+
+static inline basic_number_t basic_number_from_int64(basic_number_flags_t* flags, int64_t i)
+{
+    (void)flags;
+    return (basic_number_t)i;
+}
+
+static inline basic_number_t basic_number_sqrt(basic_number_flags_t* flags, basic_number_t a)
+{
+    (void)flags;
+    return BASIC_NUMBER_MATH(sqrt)(a);
+}
+
+static inline basic_number_t basic_number_sin(basic_number_t a)
+{
+    return BASIC_NUMBER_MATH(sin)(a);
+}
+
+#endif
+
+/* An expression value is a number or an integer. Integer variables are integers, and
+ * arithmetic on two integers gives an integer, unless the result does not fit. Then it is
+ * a number, as it is when either operand is a number. Integral literals are integers only
+ * next to an integer: elsewhere, a literal is the number it converts to, so that programs
+ * without integer variables compute as before, and 2*3 is a number. Integers convert to
+ * numbers with an overflow error when they do not fit the number type */
+typedef struct BASIC_VALUE_
+{
+    union
+    {
+        basic_number_t f;
+        int32_t i;
+    } u;
+    bool integer;
+    /* An integral literal, possibly negated */
+    bool literal;
+} BASIC_VALUE;
+
+static inline BASIC_VALUE basic_value_int(int32_t i)
+{
+    BASIC_VALUE v;
+    v.u.i = i;
+    v.integer = true;
+    v.literal = false;
+    return v;
+}
+
+static inline BASIC_VALUE basic_value_int_literal(int32_t i)
+{
+    BASIC_VALUE v;
+    v.u.i = i;
+    v.integer = true;
+    v.literal = true;
+    return v;
+}
+
+static inline BASIC_VALUE basic_value_number(basic_number_t f)
+{
+    BASIC_VALUE v;
+    v.u.f = f;
+    v.integer = false;
+    v.literal = false;
+    return v;
+}
+
+static inline basic_number_t basic_value_to_number(basic_number_flags_t* flags, BASIC_VALUE v)
+{
+    return v.integer ? basic_number_from_int(flags, v.u.i) : v.u.f;
+}
+
+/* Convert a value to a number without touching the error flags, which are slow to
+ * clear and test on some targets. Returns false if it is out of range */
+static inline bool basic_value_to_number_checked(BASIC_VALUE v, basic_number_t* out)
+{
+    if(v.integer)
+    {
+        return basic_number_from_int_checked(v.u.i, out);
+    }
+    *out = v.u.f;
+    return true;
+}
+
+/* Round a value down to an integer. Returns false if it does not fit 32 bits */
+static inline bool basic_value_to_int(BASIC_VALUE v, int32_t* out)
+{
+    if(v.integer)
+    {
+        *out = v.u.i;
+        return true;
+    }
+    return basic_number_floor_int(v.u.f, out);
+}
+
+/* Round a value in the range of 0 to max down to an index */
+static inline bool basic_value_to_index(BASIC_VALUE v, unsigned max, unsigned* out)
+{
+    if(v.integer)
+    {
+        if(v.u.i < 0 || (unsigned)v.u.i > max)
+        {
+            return false;
+        }
+        *out = (unsigned)v.u.i;
+        return true;
+    }
+    return basic_number_to_index(v.u.f, max, out);
+}
+
+/* The result of integer arithmetic, which becomes a number if it does not fit */
+static inline BASIC_VALUE basic_value_from_int64(basic_number_flags_t* flags, int64_t i)
+{
+    if(i >= INT32_MIN && i <= INT32_MAX)
+    {
+        return basic_value_int((int32_t)i);
+    }
+    return basic_value_number(basic_number_from_int64(flags, i));
+}
+
+/* Whether integer arithmetic applies. Between two literals it does not, so that
+ * literal arithmetic rounds as it does on numbers */
+static inline bool basic_value_integers(BASIC_VALUE a, BASIC_VALUE b)
+{
+    return a.integer && b.integer && !(a.literal && b.literal);
+}
+
+static inline BASIC_VALUE basic_value_add(basic_number_flags_t* flags, BASIC_VALUE a, BASIC_VALUE b)
+{
+    if(basic_value_integers(a, b))
+    {
+        return basic_value_from_int64(flags, (int64_t)a.u.i + b.u.i);
+    }
+    return basic_value_number(basic_number_add(flags, basic_value_to_number(flags, a), basic_value_to_number(flags, b)));
+}
+
+static inline BASIC_VALUE basic_value_sub(basic_number_flags_t* flags, BASIC_VALUE a, BASIC_VALUE b)
+{
+    if(basic_value_integers(a, b))
+    {
+        return basic_value_from_int64(flags, (int64_t)a.u.i - b.u.i);
+    }
+    return basic_value_number(basic_number_sub(flags, basic_value_to_number(flags, a), basic_value_to_number(flags, b)));
+}
+
+static inline BASIC_VALUE basic_value_mul(basic_number_flags_t* flags, BASIC_VALUE a, BASIC_VALUE b)
+{
+    if(basic_value_integers(a, b))
+    {
+        return basic_value_from_int64(flags, (int64_t)a.u.i * b.u.i);
+    }
+    return basic_value_number(basic_number_mul(flags, basic_value_to_number(flags, a), basic_value_to_number(flags, b)));
+}
+
+/* The quotient of integers is an integer only if the division is exact,
+ * so that 7/2 is still 3.5 */
+static inline BASIC_VALUE basic_value_div(basic_number_flags_t* flags, BASIC_VALUE a, BASIC_VALUE b)
+{
+    if(basic_value_integers(a, b) && b.u.i && (int64_t)a.u.i % b.u.i == 0)
+    {
+        return basic_value_from_int64(flags, (int64_t)a.u.i / b.u.i);
+    }
+    return basic_value_number(basic_number_div(flags, basic_value_to_number(flags, a), basic_value_to_number(flags, b)));
+}
+
+static inline BASIC_VALUE basic_value_neg(basic_number_flags_t* flags, BASIC_VALUE a)
+{
+    if(a.integer)
+    {
+        BASIC_VALUE v = basic_value_from_int64(flags, -(int64_t)a.u.i);
+        v.literal = a.literal;
+        return v;
+    }
+    return basic_value_number(basic_number_neg(flags, a.u.f));
+}
+
+/* Relations between two values, as found by basic_value_compare() */
+#define BASIC_VALUE_GREATER 1
+#define BASIC_VALUE_EQUAL 2
+#define BASIC_VALUE_LESS 4
+
+/* Compare an integer with a number exactly, and a literal as the number it rounds to.
+ * Not-a-number values are in no relation */
+static inline unsigned basic_value_compare(BASIC_VALUE a, BASIC_VALUE b)
+{
+    if(basic_value_integers(a, b))
+    {
+        return a.u.i > b.u.i ? BASIC_VALUE_GREATER : a.u.i < b.u.i ? BASIC_VALUE_LESS : BASIC_VALUE_EQUAL;
+    }
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+    /* Literals that fit Q16.16 convert to it exactly */
+    int64_t x = a.integer ? (int64_t)a.u.i * BASIC_NUMBER_ONE : a.u.f;
+    int64_t y = b.integer ? (int64_t)b.u.i * BASIC_NUMBER_ONE : b.u.f;
+#else
+    double x = a.integer ? (a.literal ? (basic_number_t)a.u.i : a.u.i) : a.u.f;
+    double y = b.integer ? (b.literal ? (basic_number_t)b.u.i : b.u.i) : b.u.f;
+#endif
+    return (x > y) * BASIC_VALUE_GREATER | (x == y) * BASIC_VALUE_EQUAL | (x < y) * BASIC_VALUE_LESS;
+}
+
+/* Map the errors raised since the last basic_number_clear_errors() to an error ID */
+enum BASIC_ERROR_ID basic_number_error(const basic_number_flags_t* flags);
+
+/* A random number from 0 up to, but excluding, 1 */
+basic_number_t basic_number_random(void);
+
+/* Convert the decimal mantissa times 10 to the power of exp10, negated if negative,
+ * raising an overflow if the result is too large */
+basic_number_t basic_number_from_decimal(basic_number_flags_t* flags, uint64_t mantissa, int exp10, bool negative);
+
+/* Print the value, followed by a space, as PRINT does */
+void basic_number_print(basic_number_t a);
+
+/* Print a number, or an integer with all its digits. A literal prints as the number
+ * it converts to. Returns false, printing nothing, if it does not fit the number type */
+bool basic_value_print(BASIC_VALUE v);
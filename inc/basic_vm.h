@@ -0,0 +1,114 @@
+/*
+ * basic_vm.h
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/*
+ * Bytecode compiler and virtual machine.
+ *
+ * RUN compiles the program into a separate buffer provided by the application.
+ * Numeric literals are pre-parsed, jump targets are resolved to code offsets,
+ * and variable references carry inline caches of their storage positions.
+ * Statements that the compiler does not handle are handed over to the
+ * interpreter, which runs the rest of the line and re-enters the VM at the next
+ * line. The VM shares the variables and the FOR/GOSUB stack with the interpreter,
+ * so both can take turns within one program run.
+ *
+ * Buffer layout:
+ * - line table: line number and code offset of every program line, in line order
+ * - bytecode
+ * - free space
+ * - continuation table: program index and code offset of the statements that follow
+ *   compiled FOR and GOSUB statements, sorted by the program index, so that NEXT
+ *   and RETURN can translate the program index in a stack entry to a code offset
+ *
+ * The expressions of the statements left to the interpreter can be compiled as well,
+ * into an expression cache in another buffer. The cache maps the program index of an
+ * expression to its code, which ends with a RESULT opcode and runs in the same
+ * virtual machine. Cache layout:
+ * - hash table: program index and code offset of each cached expression, with
+ *   a zero code offset for an expression that is left to the expression engine
+ * - code of the expressions, each preceded by the length of the expression in the program
+ * - free space
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "basic_config.h"
+#include "common_mem.h"
+#include "basic_errors.h"
+#include "basic_number.h"
+
+struct BASIC_MAIN_STATE_;
+
+typedef struct BASIC_VM_
+{
+    unsigned char* base;
+    unsigned size; // Size of the buffer, up to 64K
+    unsigned code_idx; // End of the line table and the beginning of the bytecode
+    unsigned cont_idx; // Beginning of the continuation table, which extends to the end of the buffer
+    unsigned line_count;
+    bool compiled; // The buffer holds the bytecode of the current program
+    bool integer_names; // The bytecode uses integer variables
+} BASIC_VM;
+
+/* The maximum number of values that an expression may keep on the evaluation stack.
+ * Deeper expressions are left to the interpreter */
+#define BASIC_VM_STACK_DEPTH 16
+
+void basic_vm_initialize(BASIC_VM* vm, void* buf, unsigned size);
+
+/* Must be called whenever program lines change or move */
+static inline void basic_vm_invalidate(BASIC_VM* vm)
+{
+    vm->compiled = false;
+}
+
+/* Compile the program unless it is already compiled.
+ * Returns false if there is no buffer or the program does not fit */
+bool basic_vm_compile(BASIC_VM* vm, const BASIC_MEM_MGR* prog);
+
+/* Run compiled code from the beginning of the current program line until
+ * the program ends, stops, or a statement is handed over to the interpreter.
+ * In the latter case, *handoff is set, and the current line and the parse
+ * pointer are set to the statement to interpret */
+enum BASIC_ERROR_ID basic_vm_run(struct BASIC_MAIN_STATE_* bs, bool* handoff);
+
+/* Provide the buffer of the expression cache. A buffer smaller than 64 bytes disables the cache */
+void basic_vm_expr_cache_initialize(BASIC_EXPR_CACHE* c, void* buf, unsigned size);
+
+/* Evaluate an expression of the program with its cached code, compiling it on the first
+ * evaluation. Returns false if the expression is not in the program, is not compiled,
+ * or does not fit into the cache, so that the expression engine has to evaluate it.
+ * Otherwise, *eid receives the result of the evaluation */
+bool basic_vm_cached_expression(BASIC_MEM_MGR* mem, const unsigned char** parse_ptr,
+        BASIC_VALUE* out, enum BASIC_ERROR_ID* eid);
@@ -35,27 +35,103 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  * and the FOR/GOSUB stack.
  *
  * Memory layout:
- * - program storage (when lines are added or removed, variable storage is purged)
- * - variables
- * - input buffer
+ * - program storage (when lines are added or removed, variable storage is purged).
+ *   When a program runs from read-only memory, this is a RAM overlay with edited lines
+ * - line index: a table of 16-bit offsets of all program lines, in the order of
+ *   their line numbers
+ * - scalar variables (grow from bottom to top)
+ * - free space
  * - FOR/GOSUB stack (grows from top to bottom)
+ * - arrays (grow from top to bottom, moving the stack down). Creating a scalar variable
+ *   moves nothing, and creating an array moves only the stack
+ * - DATA index: positions of all DATA statements, built at RUN
  */
 
 #pragma once
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "basic_config.h"
+#include "basic_number.h"
 
 typedef unsigned basic_mem_idx_t;
 
+/* Alignment of the variable values */
+#if BASIC_CONFIG_ALIGNED_VALUES
+#define BASIC_MEM_VALUE_ALIGN 4
+#else
+#define BASIC_MEM_VALUE_ALIGN 1
+#endif
+
+/* Array block sizes and positions */
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+typedef uint32_t basic_array_size_t;
+#define BASIC_ARRAY_SIZE_MAX UINT32_MAX
+#else
+typedef uint16_t basic_array_size_t;
+#define BASIC_ARRAY_SIZE_MAX UINT16_MAX
+#endif
+
+#if BASIC_CONFIG_VAR_SLOTS
+/* Scalar variable names are a letter, upper or lower case, and an optional digit,
+ * and the same names with the integer type */
+#define BASIC_MEM_VAR_SLOTS (52 * 11 * 2)
+#endif
+
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+typedef struct BASIC_MEM_ARRAY_DESC_
+{
+    uint16_t name; // Array variable name, or 0 if the descriptor is free
+    basic_array_size_t offset; // Position of the array header below data_idx
+} BASIC_MEM_ARRAY_DESC;
+#endif
+
+/* Compiled expressions of the program, in a buffer provided by the application */
+typedef struct BASIC_EXPR_CACHE_
+{
+    unsigned char* base; // Buffer, or NULL if there is no cache
+    unsigned size; // Size of the buffer, up to 64K
+    unsigned slots; // Number of entries in the hash table at the beginning of the buffer, a power of 2
+    unsigned count; // Number of occupied entries
+    unsigned code_idx; // End of the compiled code, or 0 if the cache is empty and its table is not cleared yet
+    bool integer_names; // Some compiled expressions use integer variables
+} BASIC_EXPR_CACHE;
+
+/* Drop the compiled expressions when the program lines change or move */
+static inline void basic_expr_cache_invalidate(BASIC_EXPR_CACHE* c)
+{
+    c->code_idx = 0;
+}
+
 typedef struct BASIC_MEM_MGR_
 {
     unsigned char* base;
+    basic_mem_idx_t index_idx; // End of the program lines and the beginning of the line index
     basic_mem_idx_t vars_idx; // Also marks the end of the program storage area
-    basic_mem_idx_t array_idx; // Marks the end of normal variables and the beginning of arrays
-    basic_mem_idx_t free_idx; // End of the input buffer, free space for the stack growth
+    basic_mem_idx_t free_idx; // End of the scalar variables, free space for the stack growth
     basic_mem_idx_t stktop_idx; // Top of the FOR/GOSUB stack
-    basic_mem_idx_t max_idx; // RAMtop
+    basic_mem_idx_t gosub_depth; // Distance of the innermost GOSUB frame from max_idx, or 0 if there is none
+    basic_mem_idx_t max_idx; // Bottom of the FOR/GOSUB stack, and the beginning of the arrays
+    basic_mem_idx_t data_idx; // End of the arrays, and the beginning of the DATA index
+    basic_mem_idx_t ram_top_idx; // RAMtop, the end of the DATA index
+    bool data_index_valid; // The DATA index lists the DATA statements of the current program
+    bool jump_cache_dirty; // Program lines have moved since the jump targets were resolved
+    const unsigned char* rom; // Program area (lines and line index) in read-only memory, or NULL
+    basic_mem_idx_t rom_index_idx; // End of the program lines in ROM and the beginning of their line index
+    basic_mem_idx_t rom_size; // Size of the program area in ROM. Indexes of program lines in RAM are offset by it
+    uint64_t int_letters; // Letters declared by DEFINT, one bit for each of A-Z and a-z
+    bool typed_arrays; // Some arrays have elements other than numbers
+    basic_number_flags_t number_flags; // Arithmetic errors of this instance
+#if BASIC_CONFIG_VM
+    BASIC_EXPR_CACHE expr_cache;
+#endif
+#if BASIC_CONFIG_VAR_SLOTS
+    uint16_t var_slots[BASIC_MEM_VAR_SLOTS]; // End of each scalar variable entry, relative to vars_idx, or 0 if there is none
+#endif
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+    BASIC_MEM_ARRAY_DESC array_desc[BASIC_CONFIG_ARRAY_DESCRIPTORS]; // Hash table of array positions by name
+    bool array_desc_full; // Some arrays have no descriptor, and are found by scanning
+#endif
 } BASIC_MEM_MGR;
 
 static inline bool basic_mem_check_space(BASIC_MEM_MGR* s, unsigned size)
@@ -63,6 +139,15 @@ static inline bool basic_mem_check_space(BASIC_MEM_MGR* s, unsigned size)
     return s->stktop_idx - s->free_idx >= size;
 }
 
+/* The usable size of the memory at base. The arrays are placed below its end,
+ * which is aligned for the variable values. A memory too small for any array
+ * keeps its whole size */
+static inline unsigned basic_mem_top(const void* base, unsigned size)
+{
+    unsigned pad = (uintptr_t)((const unsigned char*)base + size) & (BASIC_MEM_VALUE_ALIGN - 1);
+    return size >= pad + 8 ? size - pad : size;
+}
+
 #if 0
 
 void basic_mem_initialize(BASIC_MEM_MGR* s, void* base, unsigned max_size);
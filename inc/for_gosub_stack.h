@@ -35,34 +35,94 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "common_mem.h"
 #include "variable_storage.h"
 
+/* The FOR/GOSUB stack holds aligned frames, which are accessed in place.
+ * The GOSUB frames are linked, so that RETURN finds the innermost one at once,
+ * and only FOR frames lie above it */
 typedef struct FGS_ENTRY_GOSUB_
 {
     // The line number is only required here to set the current
     // execution line number for possible error message printing.
     uint16_t line;
     uint16_t parse_idx; // Return parse index into the program storage
+    uint16_t link; // Depth of the enclosing GOSUB frame, or 0 if there is none
 } FGS_ENTRY_GOSUB;
 
+/* Frames are 4-byte aligned, also when they hold doubles */
+#pragma pack(push,4)
 typedef struct FGS_ENTRY_FOR_
 {
+    union
+    {
+        struct
+        {
+            basic_number_t to_val;
+            basic_number_t step;
+        } f; // Loops with non-integral values
+        struct
+        {
+            int32_t to_val;
+            int32_t step;
+            int32_t count; // Loop counter, stored into the variable at each iteration
+            basic_number_bits_t var_bits; // Value last stored, to detect the loop body changing the variable
+        } i; // Loops with integral values only, run without number arithmetic
+    } u;
     // The line number is only required here to set the current
     // execution line number for possible error message printing.
     uint16_t line; // Line where the FOR statement is
     uint16_t parse_idx; // Parse index into the program storage on loop continuation
-    float to_val;
-    float step;
     var_name_packed vn;
+    uint16_t var_idx; // Position of the loop variable. Scalar variables do not move while a loop runs
+    int8_t direction; // 1 when counting up, -1 when counting down, 0 if the loop ends at the first NEXT
+    bool integer; // The loop runs on the integer counter
 } FGS_ENTRY_FOR;
+#pragma pack(pop)
 
 void fgstack_initialize(BASIC_MEM_MGR* s, void* base, unsigned size);
 void fgstack_clear(BASIC_MEM_MGR* s);
 bool fgstack_push_gosub(BASIC_MEM_MGR* s, const FGS_ENTRY_GOSUB* in);
 bool fgstack_pop_gosub(BASIC_MEM_MGR* s, FGS_ENTRY_GOSUB* out);
-bool fgstack_lookup_for(BASIC_MEM_MGR* s, FGS_ENTRY_FOR* out, var_name_packed vn);
+/* Find the FOR entry of the given loop variable and pop all entries above it.
+ * Returns the entry, which is left on the top of the stack to be updated in place,
+ * or NULL if there is none above the innermost GOSUB entry */
+FGS_ENTRY_FOR* fgstack_find_for(BASIC_MEM_MGR* s, var_name_packed vn);
+/* Pop the FOR entry on the top of the stack when its loop completes */
+void fgstack_pop_for(BASIC_MEM_MGR* s);
 bool fgstack_push_for(BASIC_MEM_MGR* s, const FGS_ENTRY_FOR* in);
+/* Set up the limit and the step of a FOR entry, whose vn must be set. The loop runs on an integer
+ * counter if the start value of the variable, the limit and the step are all integral.
+ * Loops on an integer variable always do, with the limit and the step rounded down */
+enum BASIC_ERROR_ID fgstack_for_setup(FGS_ENTRY_FOR* fe, const VARIABLE_VALUE* var, BASIC_VALUE to_val, BASIC_VALUE step);
+bool fgstack_for_next_slow(FGS_ENTRY_FOR* fe, VARIABLE_VALUE* var, basic_number_flags_t* flags);
+/* Advance the loop variable on NEXT. Returns true if the loop continues */
+static inline bool fgstack_for_next(FGS_ENTRY_FOR* fe, VARIABLE_VALUE* var, basic_number_flags_t* flags)
+{
+    basic_number_bits_t bits;
+    memcpy(&bits, var, sizeof(bits));
+    if(!fe->integer || bits != fe->u.i.var_bits)
+    {
+        /* A non-integral loop, or the loop body has changed the variable */
+        return fgstack_for_next_slow(fe, var, flags);
+    }
+    if(fe->direction > 0 ? fe->u.i.count < fe->u.i.to_val : fe->direction < 0 && fe->u.i.count > fe->u.i.to_val)
+    {
+        fe->u.i.count += fe->u.i.step;
+        if(var_name_is_integer(fe->vn))
+        {
+            var->i = fe->u.i.count;
+        }
+        else
+        {
+            var->f = basic_number_from_int(flags, fe->u.i.count);
+        }
+        memcpy(&fe->u.i.var_bits, var, sizeof(fe->u.i.var_bits));
+        return true;
+    }
+    return false;
+}
 
 bool fgstack_push_expression(BASIC_MEM_MGR* s, const void* in, unsigned size);
 static inline void fgstack_push_expression_byte_nocheck(BASIC_MEM_MGR* s, uint8_t in)
@@ -75,5 +135,6 @@ static inline bool fgstack_check_space(BASIC_MEM_MGR* s, unsigned size)
 {
     return basic_mem_check_space(s, size);
 }
-static inline basic_mem_idx_t fgstack_get_top(const BASIC_MEM_MGR* s) { return s->stktop_idx; }
-static inline void fgstack_set_top(BASIC_MEM_MGR* s, basic_mem_idx_t top) {s->stktop_idx = top; }
+/* The stack top is saved as the depth of the stack, which stays valid when creating an array moves the stack */
+static inline basic_mem_idx_t fgstack_get_top(const BASIC_MEM_MGR* s) { return s->max_idx - s->stktop_idx; }
+static inline void fgstack_set_top(BASIC_MEM_MGR* s, basic_mem_idx_t top) {s->stktop_idx = s->max_idx - top; }
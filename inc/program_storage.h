@@ -33,7 +33,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include "common_mem.h"
+#include "basic_errors.h"
+#include "basic_number.h"
 
 typedef struct FIND_LINE_RESULT_
 {
@@ -56,7 +60,125 @@ const unsigned char* prog_storage_get_line_parse_ptr(const BASIC_MEM_MGR* prog,
 const unsigned char* prog_storage_advance_line(const BASIC_MEM_MGR* prog, const unsigned char* parse_ptr, unsigned* pline);
 bool prog_storage_store_line(BASIC_MEM_MGR* prog, unsigned line, const char* content);
 
-static inline unsigned prog_storage_ptr_to_idx(BASIC_MEM_MGR* prog, const unsigned char* ptr) {return ptr - prog->base;}
-static inline const unsigned char* prog_storage_idx_to_ptr(BASIC_MEM_MGR* prog, unsigned idx) { return prog->base + idx; }
+/* Program lines in ROM have indexes [0, rom_size), and the indexes
+ * of program lines in RAM follow them */
+static inline bool prog_storage_is_rom_ptr(const BASIC_MEM_MGR* prog, const unsigned char* ptr)
+{
+    return (uintptr_t)ptr - (uintptr_t)prog->rom < prog->rom_size;
+}
+/* The pointer is in the program lines, in ROM or in RAM, and not in a line typed for direct execution */
+static inline bool prog_storage_is_program_ptr(const BASIC_MEM_MGR* prog, const unsigned char* ptr)
+{
+    return prog_storage_is_rom_ptr(prog, ptr) || (uintptr_t)ptr - (uintptr_t)prog->base < prog->index_idx;
+}
+static inline unsigned prog_storage_ptr_to_idx(const BASIC_MEM_MGR* prog, const unsigned char* ptr)
+{
+    return prog_storage_is_rom_ptr(prog, ptr) ? (unsigned)(ptr - prog->rom) : ptr - prog->base + prog->rom_size;
+}
+static inline const unsigned char* prog_storage_idx_to_ptr(const BASIC_MEM_MGR* prog, unsigned idx)
+{
+    return idx < prog->rom_size ? prog->rom + idx : prog->base + idx - prog->rom_size;
+}
+static inline unsigned prog_storage_get_line_number(const BASIC_MEM_MGR* prog, unsigned line_idx)
+{
+    const unsigned char* p = prog_storage_idx_to_ptr(prog, line_idx);
+    return p[2] | p[3] << 8;
+}
+
+/* Jump cache slots are stored in front of the line number arguments
+ * of GOTO, GOSUB, and THEN in program lines. The slot holds the index of
+ * the resolved target line, or 0 if it has not been resolved yet */
+#define PROG_STORAGE_JUMP_CACHE_SIZE 4
+unsigned prog_storage_read_jump_cache(BASIC_MEM_MGR* prog, const unsigned char* slot);
+void prog_storage_write_jump_cache(BASIC_MEM_MGR* prog, const unsigned char* slot, unsigned line_idx);
+
+/* Number literals in expressions are pre-parsed when a line is stored.
+ * The literal token is followed by the binary value, 7 bits per byte with the high bit set,
+ * and the length of the original text in the last byte, which follows them and is kept for LIST.
+ * Literals with a longer text are left for the parser */
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+#define PROG_STORAGE_LITERAL_SIZE 11
+#else
+#define PROG_STORAGE_LITERAL_SIZE 6
+#endif
+#define PROG_STORAGE_LITERAL_MAX_TEXT 7
+/* Decode the literal at p, which points at the literal token.
+ * Returns the distance to the end of its text */
+static inline unsigned prog_storage_read_literal(const unsigned char* p, basic_number_t* out)
+{
+    const unsigned char last = p[PROG_STORAGE_LITERAL_SIZE - 1];
+    basic_number_bits_t bits = last & 0x0f;
+    for(int i = PROG_STORAGE_LITERAL_SIZE - 2; i > 0; i--)
+    {
+        bits = bits << 7 | (p[i] & 0x7f);
+    }
+    memcpy(out, &bits, sizeof(*out));
+    return PROG_STORAGE_LITERAL_SIZE + ((last >> 4) & 0x07);
+}
+/* Literals written with digits only are integers, if they fit 32 bits. Their own token
+ * is followed by the integer in the same way */
+#define PROG_STORAGE_INT_LITERAL_SIZE 6
+static inline unsigned prog_storage_read_int_literal(const unsigned char* p, int32_t* out)
+{
+    const unsigned char last = p[PROG_STORAGE_INT_LITERAL_SIZE - 1];
+    uint32_t bits = last & 0x0f;
+    for(int i = PROG_STORAGE_INT_LITERAL_SIZE - 2; i > 0; i--)
+    {
+        bits = bits << 7 | (p[i] & 0x7f);
+    }
+    *out = (int32_t)bits;
+    return PROG_STORAGE_INT_LITERAL_SIZE + ((last >> 4) & 0x07);
+}
+
+/* Variable names in code are marked when a line is stored. The variable reference token
+ * is followed by 2 bytes holding the position of the scalar variable last found
+ * by this reference, and by the name, one letter and an optional digit */
+#define PROG_STORAGE_VARREF_SIZE 3
+static inline unsigned prog_storage_read_varref(const unsigned char* p)
+{
+    return (p[1] & 0x7f) | (p[2] & 0x7f) << 7;
+}
+void prog_storage_write_varref(BASIC_MEM_MGR* prog, const unsigned char* p, unsigned cache);
+
+/* The DATA index holds the positions and line numbers of all DATA statements,
+ * so that READ does not search for them. It is built at RAMtop, under the FOR/GOSUB
+ * stack and the arrays, which must be empty. Returns false if there is not enough memory for it */
+#define PROG_STORAGE_DATA_ENTRY_SIZE 4
+bool prog_storage_build_data_index(BASIC_MEM_MGR* prog);
+/* Free the DATA index when the program changes */
+void prog_storage_release_data_index(BASIC_MEM_MGR* prog);
+static inline unsigned prog_storage_data_count(const BASIC_MEM_MGR* prog)
+{
+    return (prog->ram_top_idx - prog->data_idx) / PROG_STORAGE_DATA_ENTRY_SIZE;
+}
+/* Get the position after the DATA keyword of an indexed DATA statement, and its line number */
+const unsigned char* prog_storage_get_data(const BASIC_MEM_MGR* prog, unsigned entry, unsigned* pline);
+/* Get the number of the first indexed DATA statement in the given line or after it */
+unsigned prog_storage_find_data(const BASIC_MEM_MGR* prog, unsigned line);
 
 void prog_storage_list(const BASIC_MEM_MGR* prog, unsigned first_line);
+
+/* A program image is a header followed by a verbatim copy of the program area
+ * (program lines and the line index), which can be loaded without tokenizing.
+ * Header layout: "uCB", format version, number of keywords, number type (BASIC_CONFIG_NUMBER),
+ * 16-bit little-endian end of program lines, size of the program area,
+ * and the Fletcher-16 checksum of the program area */
+#define PROG_STORAGE_IMAGE_HEADER_SIZE 12
+#define PROG_STORAGE_IMAGE_VERSION 4
+/* Fill in an image header for the current program, which must not run from ROM.
+ * Returns the size of the program area, which begins at prog->base and follows
+ * the header in the image */
+unsigned prog_storage_image_header(BASIC_MEM_MGR* prog, unsigned char* header);
+/* Replace the program with a validated image. Variables must be cleared by the caller.
+ * The old program is kept if the image is invalid or does not fit */
+enum BASIC_ERROR_ID prog_storage_load_image(BASIC_MEM_MGR* prog, const void* image, unsigned size);
+
+/* Run the program of a validated image in place from read-only memory.
+ * The program storage in RAM becomes an overlay that holds edited lines,
+ * and empty lines that delete the lines in ROM. The image must stay valid
+ * while attached. Variables must be cleared by the caller */
+enum BASIC_ERROR_ID prog_storage_attach_image(BASIC_MEM_MGR* prog, const void* image, unsigned size);
+/* Copy the program from ROM, merged with its RAM overlay, into RAM, so that it does not
+ * depend on the ROM anymore. Variables and the FOR/GOSUB stack must be cleared by the caller.
+ * Returns false if it does not fit, in which case nothing changes */
+bool prog_storage_detach_rom(BASIC_MEM_MGR* prog);
@@ -34,26 +34,159 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 #pragma once
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include "common_mem.h"
 #include "basic_errors.h"
+#include "basic_number.h"
 
 typedef uint16_t var_name_packed;
 
+/* The largest number of array subscripts */
+#define VARIABLE_ARRAY_MAX_DIMS 3
+
+/* The largest array subscript */
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+#define VARIABLE_ARRAY_MAX_SUBSCRIPT 16777215u
+#else
+#define VARIABLE_ARRAY_MAX_SUBSCRIPT 32767u
+#endif
+
+/* Aligned values are aligned to 4 bytes, also when they are doubles */
+#if BASIC_CONFIG_ALIGNED_VALUES
+#pragma pack(push,4)
+#else
 #pragma pack(push,1)
-typedef struct VARIABLE_VALUE_
+#endif
+typedef union VARIABLE_VALUE_
 {
-    float f; // Unaligned
+    basic_number_t f; // Unaligned, unless BASIC_CONFIG_ALIGNED_VALUES is set
+    int32_t i; // Integer scalar variables and LONG array elements
 } VARIABLE_VALUE;
 #pragma pack(pop)
 
+/* Types of the variable values. Scalar variables are numbers or 32-bit integers,
+ * and arrays declared with DIM ... AS may also hold 8-bit and 16-bit integers.
+ * These narrow elements only take the first bytes of a VARIABLE_VALUE, and are copied
+ * byte-wise because they are not aligned like the values */
+enum VARIABLE_TYPE
+{
+    VARIABLE_TYPE_NUMBER = 0,
+    VARIABLE_TYPE_INT8,
+    VARIABLE_TYPE_INT16,
+    VARIABLE_TYPE_INT32
+};
+
+/* Elements and shape of an array */
+typedef struct VARIABLE_ARRAY_
+{
+    VARIABLE_VALUE* data; // Elements in row-major order
+    unsigned char type; // Element type, one of VARIABLE_TYPE
+    unsigned ndims;
+    unsigned extent[VARIABLE_ARRAY_MAX_DIMS]; // Number of elements along each dimension
+} VARIABLE_ARRAY;
+
+static inline unsigned variable_type_size(unsigned char type)
+{
+    return type == VARIABLE_TYPE_NUMBER ? sizeof(VARIABLE_VALUE) : 1u << (type - VARIABLE_TYPE_INT8);
+}
+
+/* The element at index i of a data block of the given type */
+static inline VARIABLE_VALUE* variable_element(VARIABLE_VALUE* data, unsigned char type, unsigned i)
+{
+    return (VARIABLE_VALUE*)((unsigned char*)data + i * variable_type_size(type));
+}
+
 static inline var_name_packed var_name_empty(void) {return 0;}
 static inline var_name_packed var_name_add_char(var_name_packed n, unsigned char c)
 {
     return n << 8 | c;
 }
 
+/* Integer scalar variables have the % suffix, or a first letter declared by DEFINT.
+ * Their names are flagged in the last character */
+#define VAR_NAME_INTEGER 0x80
+static inline bool var_name_is_integer(var_name_packed n)
+{
+    return (n & VAR_NAME_INTEGER) != 0;
+}
+
+static inline unsigned char var_name_type(var_name_packed n)
+{
+    return var_name_is_integer(n) ? VARIABLE_TYPE_INT32 : VARIABLE_TYPE_NUMBER;
+}
+
+/* Position of a letter in the bitmap of the DEFINT letters */
+static inline unsigned var_name_letter_index(unsigned char c)
+{
+    return c <= 'Z' ? c - 'A' : c - 'a' + 26;
+}
+
+/* The name of a scalar variable, flagged if DEFINT has declared its first letter */
+static inline var_name_packed variable_storage_scalar_name(const BASIC_MEM_MGR* s, var_name_packed n)
+{
+    if(!s->int_letters || var_name_is_integer(n))
+    {
+        return n;
+    }
+    unsigned char c = n >> 8 ? n >> 8 : n;
+    return s->int_letters >> var_name_letter_index(c) & 1 ? n | VAR_NAME_INTEGER : n;
+}
+
+/* Read a variable of the given type as an expression value */
+static inline BASIC_VALUE variable_storage_value(const VARIABLE_VALUE* v, unsigned char type)
+{
+    switch(type)
+    {
+    case VARIABLE_TYPE_NUMBER:
+        return basic_value_number(v->f);
+    case VARIABLE_TYPE_INT8:
+        return basic_value_int(*(const int8_t*)v);
+    case VARIABLE_TYPE_INT16:
+    {
+        int16_t i;
+        memcpy(&i, v, sizeof(i));
+        return basic_value_int(i);
+    }
+    default:
+        return basic_value_int(v->i);
+    }
+}
+
+/* Store a value into an integer variable or array element, rounding numbers down */
+enum BASIC_ERROR_ID variable_storage_assign_int(VARIABLE_VALUE* v, unsigned char type, BASIC_VALUE val);
+
+/* Store a value into a variable of the given type. Numbers are rounded down for
+ * integer variables, and values that do not fit the variable are an overflow */
+static inline enum BASIC_ERROR_ID variable_storage_assign(VARIABLE_VALUE* v, unsigned char type, BASIC_VALUE val)
+{
+    if(type != VARIABLE_TYPE_NUMBER)
+    {
+        if(type != VARIABLE_TYPE_INT32 || !val.integer)
+        {
+            return variable_storage_assign_int(v, type, val);
+        }
+        v->i = val.u.i;
+        return BASIC_ERROR_OK;
+    }
+    basic_number_t f;
+    if(!basic_value_to_number_checked(val, &f))
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    v->f = f;
+    return BASIC_ERROR_OK;
+}
+
 void variable_storage_initialize(BASIC_MEM_MGR* s, unsigned char* base, unsigned size);
 VARIABLE_VALUE* variable_storage_create_var(BASIC_MEM_MGR* s, var_name_packed var);
-enum BASIC_ERROR_ID variable_storage_create_array_var(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_VALUE** ppv, unsigned subscript, bool dim);
-float variable_storage_read_var(BASIC_MEM_MGR* s, var_name_packed var);
+/* Locate an array element, creating the array if it does not exist. *type is the element type,
+ * which DIM sets for the new array, and which is returned for the existing arrays otherwise */
+enum BASIC_ERROR_ID variable_storage_create_array_var(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_VALUE** ppv, unsigned char* type, const unsigned* subscripts, unsigned ndims, bool dim);
+/* Look up an existing array. Return false if there is none */
+bool variable_storage_get_array(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_ARRAY* out);
+BASIC_VALUE variable_storage_read_var(BASIC_MEM_MGR* s, var_name_packed var);
+/* Scalar variable lookup and creation that remember the position of the variable
+ * in *cache, which must be initialized to 0. A stale cache is detected and refreshed */
+VARIABLE_VALUE* variable_storage_lookup_var_cached(BASIC_MEM_MGR* s, var_name_packed var, unsigned* cache);
+VARIABLE_VALUE* variable_storage_create_var_cached(BASIC_MEM_MGR* s, var_name_packed var, unsigned* cache);
 void variable_storage_clear(BASIC_MEM_MGR* s);
@@ -50,6 +50,8 @@ PCD_HandleTypeDef hpcd_USB_OTG_FS;
 /* USER CODE BEGIN PV */
 static BASIC_MAIN_STATE basic_state;
 static uint8_t basic_memory[4096];
+static uint8_t vm_memory[8192];
+static uint8_t expr_cache_memory[2048];
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -98,7 +100,18 @@ int main(void)
   MX_USB_OTG_FS_PCD_Init();
   /* USER CODE BEGIN 2 */
   basic_main_initialize(&basic_state, basic_memory, sizeof(basic_memory));
+  basic_main_set_vm_buffer(&basic_state, vm_memory, sizeof(vm_memory));
+  basic_main_set_expr_cache(&basic_state, expr_cache_memory, sizeof(expr_cache_memory));
   basic_printf("BASIC *uC*\n");
+  {
+    /* Run a saved program in place from flash, if there is one */
+    unsigned image_size;
+    const void* image = basic_callback_load_image(&image_size);
+    if(image)
+    {
+      basic_main_attach_image(&basic_state, image, image_size);
+    }
+  }
   basic_main_interactive_prompt(&basic_state);
   /* USER CODE END 2 */
 
@@ -421,6 +434,58 @@ bool basic_callback_check_break_key(void)
 	return HAL_GPIO_ReadPin(USER_Btn_GPIO_Port, USER_Btn_Pin) == GPIO_PIN_SET;
 }
 
+/* SAVE and LOAD use the last 128K flash sector. The image is stored behind
+ * its 32-bit size, which is written last. LOAD reads the image directly
+ * from the memory-mapped flash */
+#define IMAGE_FLASH_SECTOR FLASH_SECTOR_11
+#define IMAGE_FLASH_ADDR 0x080E0000u
+#define IMAGE_FLASH_SIZE 0x20000u
+
+static bool flash_program_bytes(uint32_t addr, const void* data, unsigned size)
+{
+	const uint8_t* p = (const uint8_t*)data;
+	for(unsigned i=0; i<size; i++)
+	{
+		if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr + i, p[i]) != HAL_OK)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool basic_callback_save_image(const void* header, unsigned header_size, const void* data, unsigned data_size)
+{
+	FLASH_EraseInitTypeDef erase =
+	{
+		.TypeErase = FLASH_TYPEERASE_SECTORS,
+		.Sector = IMAGE_FLASH_SECTOR,
+		.NbSectors = 1,
+		.VoltageRange = FLASH_VOLTAGE_RANGE_3
+	};
+	uint32_t sector_error;
+	uint32_t size = header_size + data_size;
+	HAL_FLASH_Unlock();
+	bool ok = HAL_FLASHEx_Erase(&erase, &sector_error) == HAL_OK &&
+			flash_program_bytes(IMAGE_FLASH_ADDR + 4, header, header_size) &&
+			flash_program_bytes(IMAGE_FLASH_ADDR + 4 + header_size, data, data_size) &&
+			HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, IMAGE_FLASH_ADDR, size) == HAL_OK;
+	HAL_FLASH_Lock();
+	return ok;
+}
+
+const void* basic_callback_load_image(unsigned* size)
+{
+	uint32_t stored_size = *(const volatile uint32_t*)IMAGE_FLASH_ADDR;
+	if(stored_size > IMAGE_FLASH_SIZE - 4)
+	{
+		/* Erased or interrupted while saving */
+		return NULL;
+	}
+	*size = stored_size;
+	return (const void*)(IMAGE_FLASH_ADDR + 4);
+}
+
 /* USER CODE END 4 */
 
 /**
@@ -46,6 +46,26 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include "tau/tau.h"
 
+/* A decimal constant in the configured number type, and the value of a number */
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+#define NUM(x) ((basic_number_t)lrint((x) * BASIC_NUMBER_ONE))
+#define NUM_VALUE(n) ((double)(n) / BASIC_NUMBER_ONE)
+#else
+#define NUM(x) ((basic_number_t)(x))
+#define NUM_VALUE(n) ((double)(n))
+#endif
+
+/* A product and a literal that overflow the configured number type */
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+#define OVERFLOW_PRODUCT "1e300*1e300"
+#define OVERFLOW_LITERAL "1E999"
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+#define OVERFLOW_PRODUCT "300*300"
+#define OVERFLOW_LITERAL "1E99"
+#else
+#define OVERFLOW_PRODUCT "1e30*1e30"
+#define OVERFLOW_LITERAL "1E99"
+#endif
 
 static void print_tokenized_line(const char* s)
 {
@@ -124,8 +144,11 @@ struct ExprNoRecurseFixture
     BASIC_MEM_MGR vars;
 };
 
-static unsigned char psbuf[256];
+/* Scaled with the number size, to hold the same programs with wider values */
+static unsigned char psbuf[384 / 4 * sizeof(basic_number_t)];
 static unsigned char vs_buf[256];
+static unsigned char vm_buf[512];
+static unsigned char expr_cache_buf[512];
 static char out_buf[1024];
 static unsigned outbuf_idx;
 static char input_injection_buf[512];
@@ -138,6 +161,48 @@ bool basic_callback_check_break_key(void)
     return outbuf_idx >= break_injection_level;
 }
 
+static unsigned char image_buf[512];
+static unsigned image_size;
+
+bool basic_callback_save_image(const void* header, unsigned header_size, const void* data, unsigned data_size)
+{
+    if(header_size + data_size > sizeof(image_buf))
+    {
+        return false;
+    }
+    memcpy(image_buf, header, header_size);
+    memcpy(image_buf + header_size, data, data_size);
+    image_size = header_size + data_size;
+    return true;
+}
+
+const void* basic_callback_load_image(unsigned* size)
+{
+    if(!image_size)
+    {
+        return NULL;
+    }
+    *size = image_size;
+    return image_buf;
+}
+
+/* Flip bits of a byte in the program area of the saved image, and update
+ * the checksum so that only the structure checks can find the damage */
+static void corrupt_image(unsigned idx, unsigned char bits)
+{
+    unsigned char* area = image_buf + PROG_STORAGE_IMAGE_HEADER_SIZE;
+    unsigned s1 = 0;
+    unsigned s2 = 0;
+    area[idx] ^= bits;
+    for(unsigned i = 0; i < image_size - PROG_STORAGE_IMAGE_HEADER_SIZE; i++)
+    {
+        s1 = (s1 + area[i]) % 255;
+        s2 = (s2 + s1) % 255;
+    }
+    image_buf[10] = s1;
+    image_buf[11] = s2;
+}
+
 static void main_proc_test(BASIC_MAIN_STATE* bs, const char* str)
 {
     outbuf_idx = 0;
@@ -238,6 +303,9 @@ char *basic_fgets_stdin( char *restrict str, int count)
 TEST_F_SETUP(MainProcFixture)
 {
     basic_main_initialize(&tau->bs, psbuf, sizeof(psbuf));
+    /* Programs run compiled, except for the tests that check exact memory limits */
+    basic_main_set_vm_buffer(&tau->bs, vm_buf, sizeof(vm_buf));
+    basic_main_set_expr_cache(&tau->bs, expr_cache_buf, sizeof(expr_cache_buf));
 }
 
 TEST_F_TEARDOWN(MainProcFixture)
@@ -399,6 +467,737 @@ TEST_F(MainProcFixture, goto_test)
             , sizeof(out_buf)));
 }
 
+TEST_F(MainProcFixture, line_index)
+{
+    /* Lines are entered out of order, replaced and deleted, which
+     * exercises all the line index update paths */
+    main_proc_test_progline(&tau->bs, "50 PRINT 5: GOTO 20");
+    main_proc_test_progline(&tau->bs, "10 GOTO 40");
+    main_proc_test_progline(&tau->bs, "30 PRINT 3: GOTO 60");
+    main_proc_test_progline(&tau->bs, "40 PRINT 4");
+    main_proc_test_progline(&tau->bs, "60 END");
+    main_proc_test_progline(&tau->bs, "20 PRINT 2");
+    main_proc_test_progline(&tau->bs, "45 PRINT 45");
+    main_proc_test_progline(&tau->bs, "40 PRINT 44: GOTO 50");
+    main_proc_test_progline(&tau->bs, "45");
+    main_proc_test_progline(&tau->bs, "25 GOTO 30");
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 GOTO 40\n"
+            "20 PRINT 2\n"
+            "25 GOTO 30\n"
+            "30 PRINT 3: GOTO 60\n"
+            "40 PRINT 44: GOTO 50\n"
+            "50 PRINT 5: GOTO 20\n"
+            "60 END\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "44 \n"
+            "5 \n"
+            "2 \n"
+            "3 \n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "GOTO 45");
+    CHECK(!strncmp(out_buf,
+            "No such line error\n"
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "10");
+    main_proc_test_progline(&tau->bs, "60");
+    main_proc_test(&tau->bs, "GOTO 60");
+    CHECK(!strncmp(out_buf,
+            "No such line error\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "LIST 41");
+    CHECK(!strncmp(out_buf,
+            "50 PRINT 5: GOTO 20\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, jump_cache)
+{
+    main_proc_test_progline(&tau->bs, "10 I=0");
+    main_proc_test_progline(&tau->bs, "20 GOSUB 100");
+    main_proc_test_progline(&tau->bs, "30 IF I<3 THEN 20");
+    main_proc_test_progline(&tau->bs, "40 GOTO 200");
+    main_proc_test_progline(&tau->bs, "100 I=I+1: PRINT \"GOTO 5\";I: RETURN");
+    main_proc_test_progline(&tau->bs, "200 END");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "GOTO 51 \n"
+            "GOTO 52 \n"
+            "GOTO 53 \n"
+            , sizeof(out_buf)));
+    /* Move all the resolved targets */
+    main_proc_test_progline(&tau->bs, "5 REM GOTO 10");
+    main_proc_test_progline(&tau->bs, "100 PRINT I: I=I+1: RETURN");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "0 \n"
+            "1 \n"
+            "2 \n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "5 REM GOTO 10\n"
+            "10 I=0\n"
+            "20 GOSUB 100\n"
+            "30 IF I<3 THEN 20\n"
+            "40 GOTO 200\n"
+            "100 PRINT I: I=I+1: RETURN\n"
+            "200 END\n"
+            , sizeof(out_buf)));
+    /* A deleted target line must not be jumped to */
+    main_proc_test_progline(&tau->bs, "200");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "0 \n"
+            "1 \n"
+            "2 \n"
+            "No such line error in line 40\n"
+            , sizeof(out_buf)));
+    /* A jump cache slot cannot be typed */
+    main_proc_test(&tau->bs, "40 GOTO \377\200\200\200" "10");
+    CHECK(!strncmp(out_buf,
+            "Syntax error\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "LIST 40");
+    CHECK(!strncmp(out_buf,
+            "40 GOTO 200\n"
+            "100 PRINT I: I=I+1: RETURN\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, load_program)
+{
+    static const char program[] =
+            "30 PRINT \"A line that is much longer than the 80 characters of the input buffer\";A\r\n"
+            "\n"
+            "10 A=1\n"
+            "   \n"
+            "20 A=A+1\n"
+            "40 END";
+    CHECK(basic_main_load_program(&tau->bs, program, sizeof(program)-1) == BASIC_ERROR_OK);
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 A=1\n"
+            "20 A=A+1\n"
+            "30 PRINT \"A line that is much longer than the 80 characters of the input buffer\";A\n"
+            "40 END\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "A line that is much longer than the 80 characters of the input buffer2 \n"
+            , sizeof(out_buf)));
+
+    /* Loading merges into the current program, exactly like typing the lines */
+    static const char edits[] = "20\n15 A=5\n";
+    CHECK(basic_main_load_program(&tau->bs, edits, sizeof(edits)-1) == BASIC_ERROR_OK);
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "A line that is much longer than the 80 characters of the input buffer5 \n"
+            , sizeof(out_buf)));
+
+    /* Direct statements are not accepted */
+    static const char bad[] = "50 STOP\nPRINT 1\n60 STOP\n";
+    CHECK(basic_main_load_program(&tau->bs, bad, sizeof(bad)-1) == BASIC_ERROR_SYNTAX);
+    main_proc_test(&tau->bs, "LIST 45");
+    CHECK(!strncmp(out_buf,
+            "50 STOP\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, save_load_image)
+{
+    image_size = 0;
+    main_proc_test(&tau->bs, "LOAD");
+    CHECK(!strncmp(out_buf,
+            "I/O error\n"
+            , sizeof(out_buf)));
+
+    main_proc_test_progline(&tau->bs, "10 FOR I=1 TO 2");
+    main_proc_test_progline(&tau->bs, "20 GOSUB 100");
+    main_proc_test_progline(&tau->bs, "30 NEXT I: END");
+    main_proc_test_progline(&tau->bs, "100 PRINT \"SUB\";I: RETURN");
+    main_proc_test(&tau->bs, "RUN");
+    main_proc_test(&tau->bs, "SAVE");
+    CHECK(!strncmp(out_buf,
+            ""
+            , sizeof(out_buf)));
+    /* The image is the program area behind a header */
+    CHECK(image_size == PROG_STORAGE_IMAGE_HEADER_SIZE + tau->bs.prog.vars_idx);
+    CHECK(!memcmp(image_buf + PROG_STORAGE_IMAGE_HEADER_SIZE, psbuf, tau->bs.prog.vars_idx));
+
+    main_proc_test(&tau->bs, "NEW");
+    main_proc_test(&tau->bs, "LOAD");
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 FOR I=1 TO 2\n"
+            "20 GOSUB 100\n"
+            "30 NEXT I: END\n"
+            "100 PRINT \"SUB\";I: RETURN\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "SUB1 \n"
+            "SUB2 \n"
+            , sizeof(out_buf)));
+
+    /* A corrupted image is rejected, and the program is kept */
+    main_proc_test_progline(&tau->bs, "5 PRINT \"NEW\"");
+    image_buf[PROG_STORAGE_IMAGE_HEADER_SIZE + 10] ^= 1;
+    main_proc_test(&tau->bs, "LOAD");
+    CHECK(!strncmp(out_buf,
+            "Bad image error\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "5 PRINT \"NEW\"\n"
+            "10 FOR I=1 TO 2\n"
+            "20 GOSUB 100\n"
+            "30 NEXT I: END\n"
+            "100 PRINT \"SUB\";I: RETURN\n"
+            , sizeof(out_buf)));
+    image_buf[PROG_STORAGE_IMAGE_HEADER_SIZE + 10] ^= 1;
+
+    /* So is an image with a valid checksum, but with a broken line index,
+     * a jump target that is not a line, a null byte within a line,
+     * or a token byte that does not start a well-formed internal token */
+    unsigned index_idx = image_buf[6] | image_buf[7] << 8;
+    const unsigned char* area = image_buf + PROG_STORAGE_IMAGE_HEADER_SIZE;
+    unsigned jump_idx = (const unsigned char*)memchr(area, BASIC_TOKEN_JUMP_CACHE, index_idx) - area;
+    const unsigned corruptions[][2] = {
+        {index_idx, 1}, {jump_idx + 1, 2}, {5, area[5]},
+        {5, area[5] ^ BASIC_TOKEN_LITERAL}, {jump_idx + 1, 0x80}
+    };
+    for(unsigned i = 0; i < sizeof(corruptions) / sizeof(corruptions[0]); i++)
+    {
+        corrupt_image(corruptions[i][0], corruptions[i][1]);
+        main_proc_test(&tau->bs, "LOAD");
+        CHECK(!strncmp(out_buf,
+                "Bad image error\n"
+                , sizeof(out_buf)));
+        corrupt_image(corruptions[i][0], corruptions[i][1]);
+    }
+
+    /* LOAD in a program replaces the program and stops it */
+    main_proc_test(&tau->bs, "6 LOAD: PRINT \"NOT HERE\"");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "NEW\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 FOR I=1 TO 2\n"
+            "20 GOSUB 100\n"
+            "30 NEXT I: END\n"
+            "100 PRINT \"SUB\";I: RETURN\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, rom_overlay)
+{
+    static unsigned char rom[256];
+    static unsigned char rom_copy[256];
+    main_proc_test_progline(&tau->bs, "10 READ A: PRINT \"A\";A");
+    main_proc_test_progline(&tau->bs, "20 GOSUB 100");
+    main_proc_test_progline(&tau->bs, "30 IF A<3 THEN 10");
+    main_proc_test_progline(&tau->bs, "40 END");
+    main_proc_test_progline(&tau->bs, "100 PRINT \"SUB\": RETURN");
+    main_proc_test_progline(&tau->bs, "200 DATA 1,2,3");
+    main_proc_test(&tau->bs, "RUN");
+    main_proc_test(&tau->bs, "SAVE");
+    memcpy(rom, image_buf, image_size);
+    memcpy(rom_copy, image_buf, image_size);
+    unsigned rom_size = image_size;
+
+    main_proc_test(&tau->bs, "NEW");
+    CHECK(basic_main_attach_image(&tau->bs, rom, rom_size) == BASIC_ERROR_OK);
+    /* Only the empty overlay is in RAM */
+    CHECK(tau->bs.prog.vars_idx == 3);
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "A1 \n"
+            "SUB\n"
+            "A2 \n"
+            "SUB\n"
+            "A3 \n"
+            "SUB\n"
+            , sizeof(out_buf)));
+
+    /* Edits go to the overlay, including deletion of lines in ROM */
+    main_proc_test_progline(&tau->bs, "100 PRINT \"NEW SUB\": RETURN");
+    main_proc_test_progline(&tau->bs, "25 PRINT \"ADDED\"");
+    main_proc_test_progline(&tau->bs, "40");
+    main_proc_test_progline(&tau->bs, "50 END");
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 READ A: PRINT \"A\";A\n"
+            "20 GOSUB 100\n"
+            "25 PRINT \"ADDED\"\n"
+            "30 IF A<3 THEN 10\n"
+            "50 END\n"
+            "100 PRINT \"NEW SUB\": RETURN\n"
+            "200 DATA 1,2,3\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "A1 \n"
+            "NEW SUB\n"
+            "ADDED\n"
+            "A2 \n"
+            "NEW SUB\n"
+            "ADDED\n"
+            "A3 \n"
+            "NEW SUB\n"
+            "ADDED\n"
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "25");
+    main_proc_test_progline(&tau->bs, "40 STOP");
+    main_proc_test(&tau->bs, "LIST 20");
+    CHECK(!strncmp(out_buf,
+            "20 GOSUB 100\n"
+            "30 IF A<3 THEN 10\n"
+            "40 STOP\n"
+            "50 END\n"
+            "100 PRINT \"NEW SUB\": RETURN\n"
+            "200 DATA 1,2,3\n"
+            , sizeof(out_buf)));
+    /* The program in ROM is never written */
+    CHECK(!memcmp(rom, rom_copy, rom_size));
+
+    /* SAVE copies the program into RAM, but not from a running program */
+    main_proc_test_progline(&tau->bs, "45 SAVE");
+    main_proc_test(&tau->bs, "RUN 45");
+    CHECK(!strncmp(out_buf,
+            "Direct only error in line 45\n"
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "45");
+    main_proc_test(&tau->bs, "SAVE");
+    CHECK(!tau->bs.prog.rom);
+    memset(rom, 0, sizeof(rom));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "A1 \n"
+            "NEW SUB\n"
+            "A2 \n"
+            "NEW SUB\n"
+            "A3 \n"
+            "NEW SUB\n"
+            "STOP in line 40\n"
+            , sizeof(out_buf)));
+    CHECK(basic_main_attach_image(&tau->bs, image_buf, image_size) == BASIC_ERROR_OK);
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 READ A: PRINT \"A\";A\n"
+            "20 GOSUB 100\n"
+            "30 IF A<3 THEN 10\n"
+            "40 STOP\n"
+            "50 END\n"
+            "100 PRINT \"NEW SUB\": RETURN\n"
+            "200 DATA 1,2,3\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "NEW");
+}
+
+TEST_F(MainProcFixture, compiled_program)
+{
+    /* Compiled statements take turns with interpreted ones (PRINT, and GOSUB followed by garbage) */
+    main_proc_test_progline(&tau->bs, "10 FOR I=1 TO 2: GOSUB 100: NEXT I");
+    main_proc_test_progline(&tau->bs, "20 GOSUB 100 X");
+    main_proc_test_progline(&tau->bs, "100 FOR J=1 TO 2: PRINT I*10+J;: NEXT J");
+    main_proc_test_progline(&tau->bs, "110 IF I<>2 THEN A(I)=-(I+1)*2: RETURN");
+    main_proc_test_progline(&tau->bs, "120 PRINT A(1): RETURN");
+    static const char* const expected =
+            "11 12 21 22 -4 \n"
+            "21 22 -4 \n"
+            "Syntax error in line 20\n";
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf, expected, sizeof(out_buf)));
+    /* A program that does not fit into the buffer is interpreted with the same results */
+    static unsigned char small_vm_buf[16];
+    basic_main_set_vm_buffer(&tau->bs, small_vm_buf, sizeof(small_vm_buf));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf, expected, sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, expression_cache)
+{
+    /* Interpreted expressions run from the cache after their first evaluation,
+     * until program lines change */
+    basic_main_set_vm_buffer(&tau->bs, NULL, 0);
+    main_proc_test_progline(&tau->bs, "10 A=2: B=A*3+1: PRINT B;(A+B)/2;-A");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "7 4.5 -2 \n"));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "7 4.5 -2 \n"));
+    main_proc_test_progline(&tau->bs, "10 A=3: B=A*3+1: PRINT B;(A+B)/2;-A");
+    main_proc_test_progline(&tau->bs, "5 PRINT 1+1");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "2 \n10 6.5 -3 \n"));
+    /* Expressions that do not fit into a small cache are left to the expression engine */
+    static unsigned char small_cache_buf[64];
+    basic_main_set_expr_cache(&tau->bs, small_cache_buf, sizeof(small_cache_buf));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "2 \n10 6.5 -3 \n"));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "2 \n10 6.5 -3 \n"));
+}
+
+TEST_F(MainProcFixture, number_literals)
+{
+    /* Pre-parsed literals keep their text, and line numbers and variable names stay as they are */
+    main_proc_test_progline(&tau->bs, "10 A1=1 2.5E+1:B=-.5+3.14159265:IF A1 > 12 THEN 30");
+    main_proc_test_progline(&tau->bs, "20 PRINT " OVERFLOW_LITERAL);
+    main_proc_test_progline(&tau->bs, "30 READ C,D:PRINT A1;B;C*D;1E4/(2)");
+    main_proc_test_progline(&tau->bs, "40 DATA 6 , -7");
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 A1=1 2.5E+1:B=-.5+3.14159265:IF A1 > 12 THEN 30\n"
+            "20 PRINT " OVERFLOW_LITERAL "\n"
+            "30 READ C,D:PRINT A1;B;C*D;1E4/(2)\n"
+            "40 DATA 6 , -7\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+            "125 2.64159265 -42 5000 \n"
+#else
+            "125 2.64159 -42 5000 \n"
+#endif
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "10 PRINT " OVERFLOW_LITERAL);
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "Overflow error in line 10\n"
+            , sizeof(out_buf)));
+    /* The byte of the literal token is only accepted in strings and remarks */
+    main_proc_test(&tau->bs, "10 PRINT 1\376");
+    CHECK(!strncmp(out_buf,
+            "Syntax error\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "PRINT \376");
+    CHECK(!strncmp(out_buf,
+            "Syntax error\n"
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "NEW");
+    main_proc_test_progline(&tau->bs, "10 PRINT \"\376\";2: REM \376");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "\3762 \n"
+            , sizeof(out_buf)));
+    static const char bad[] = "10 PRINT \3763\n";
+    CHECK(basic_main_load_program(&tau->bs, bad, sizeof(bad)-1) == BASIC_ERROR_SYNTAX);
+}
+
+TEST_F(MainProcFixture, number_type)
+{
+    /* The precision and the range of the numbers depend on BASIC_CONFIG_NUMBER */
+    main_proc_test(&tau->bs, "PRINT 1/3;-7/2;INT(-2.5);SQR(2): PRINT 20000+20000");
+    CHECK(!strcmp(out_buf,
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+            "0.333333333333333 -3.5 -3 1.4142135623731 \n"
+            "40000 \n"
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+            "0.33333 -3.5 -3 1.4142 \n"
+            "Overflow error\n"
+#else
+            "0.333333 -3.5 -3 1.41421 \n"
+            "40000 \n"
+#endif
+            ));
+    /* The smallest number is written as a negated literal, and the largest prints rounded down */
+    main_proc_test_progline(&tau->bs, "10 A=-32768.0: PRINT A;-3.2768E4;-32768");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "-32768 -32768 -32768 \n"));
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+    main_proc_test(&tau->bs, "PRINT 32767.99998: PRINT -32768.0;-(32768.0)");
+    CHECK(!strcmp(out_buf, "32767.9 \n-32768 Overflow error\n"));
+#endif
+    /* Negating the smallest number overflows where it does not fit */
+    main_proc_test(&tau->bs, "A=-32767-1: B=-(A): PRINT B");
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+    CHECK(!strcmp(out_buf, "Overflow error\n"));
+#else
+    CHECK(!strcmp(out_buf, "32768 \n"));
+#endif
+    main_proc_test_progline(&tau->bs, "10 A=-32767-1: B=-A: PRINT B");
+    main_proc_test_progline(&tau->bs, "20 I%=0: B=-A: PRINT B");
+    main_proc_test(&tau->bs, "RUN");
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+    CHECK(!strcmp(out_buf, "Overflow error in line 10\n"));
+    main_proc_test(&tau->bs, "GOTO 20");
+    CHECK(!strcmp(out_buf, "Overflow error in line 20\n"));
+#else
+    CHECK(!strcmp(out_buf, "32768 \n32768 \n"));
+#endif
+    /* Program images are only loaded by interpreters with the same number type */
+    unsigned char header[PROG_STORAGE_IMAGE_HEADER_SIZE];
+    main_proc_test_progline(&tau->bs, "10 PRINT 1.5");
+    prog_storage_image_header(&tau->bs.prog, header);
+    CHECK(header[5] == BASIC_CONFIG_NUMBER);
+}
+
+TEST_F(MainProcFixture, integer_variables)
+{
+    /* Integer variables keep integer results, exact division and promote to a number on overflow.
+     * Literals stay numbers */
+    main_proc_test(&tau->bs, "A%=7: B%=2: PRINT A%/B%;A%*B%;-A%;A%/7;A%: PRINT 1000000");
+    CHECK(!strcmp(out_buf,
+            "3.5 14 -7 1 7 \n"
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+            "1000000 \n"
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+            "Overflow error\n"
+#else
+            "1E+06 \n"
+#endif
+            ));
+    main_proc_test(&tau->bs, "A=16777216: PRINT 16777216+1;A+1");
+    CHECK(!strcmp(out_buf,
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+            "16777217 16777217 \n"
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+            "Overflow error\n"
+#else
+            "1.67772E+07 1.67772E+07 \n"
+#endif
+            ));
+    main_proc_test(&tau->bs, "A%=46341: PRINT A%*A%: X%=2.5+A%*A%");
+    CHECK(!strcmp(out_buf,
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+            "2147488281 \n"
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+            "Overflow error\n"
+#else
+            "2.14749E+09 \n"
+#endif
+#if BASIC_CONFIG_NUMBER != BASIC_NUMBER_FIXED
+            "Overflow error\n"
+#endif
+            ));
+    main_proc_test(&tau->bs, "A%(1)=1");
+    CHECK(!strcmp(out_buf, "Syntax error\n"));
+    /* Integral literals are exact next to integers, also beyond the precision of the
+     * number type, while next to a number they are the number they convert to */
+    main_proc_test(&tau->bs, "I%=100000000: I%=I%+3: A%=2147483647: PRINT I%;A%;-3+I%");
+    CHECK(!strcmp(out_buf, "100000003 2147483647 100000000 \n"));
+    main_proc_test_progline(&tau->bs, "10 I%=100000000: I%=I%+3: A%=2147483647: B%=-A%-1");
+    main_proc_test_progline(&tau->bs, "20 PRINT I%;A%;B%: IF I%>100000002 THEN PRINT 7/2;2*3");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "100000003 2147483647 -2147483648 \n3.5 6 \n"));
+    /* DEFINT applies to the letters until the variables are cleared */
+    main_proc_test_progline(&tau->bs, "10 DEFINT I-K,X: FOR I=1 TO 3: K=I+0.7: PRINT K;: NEXT I");
+    main_proc_test_progline(&tau->bs, "20 X=-2.5: Y=-2.5: PRINT I;X;Y");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "1 2 3 3 -3 -2.5 \n"));
+    main_proc_test(&tau->bs, "CLEAR: K=2.5: PRINT K");
+    CHECK(!strcmp(out_buf, "2.5 \n"));
+}
+
+TEST_F(MainProcFixture, restore_line)
+{
+    /* RUN indexes the DATA statements, which READ and RESTORE use until the program is edited */
+    main_proc_test_progline(&tau->bs, "10 DATA 1,2: PRINT \"X\";: DATA 3");
+    main_proc_test_progline(&tau->bs, "20 FOR I=1 TO 3: READ A: PRINT A;: NEXT I: RESTORE 30");
+    main_proc_test_progline(&tau->bs, "30 GOSUB 50: READ A,B: PRINT A;B: RESTORE 35");
+    main_proc_test_progline(&tau->bs, "40 DATA 4: DATA 5");
+    main_proc_test_progline(&tau->bs, "50 DATA 6: RETURN");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "X1 2 3 4 5 \n"
+            "No such line error in line 30\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RESTORE 50: READ A: PRINT A: READ A");
+    CHECK(!strncmp(out_buf,
+            "6 \n"
+            "Out of DATA error\n"
+            , sizeof(out_buf)));
+    main_proc_test_progline(&tau->bs, "45 DATA 7");
+    main_proc_test(&tau->bs, "RESTORE 40: READ A,B,C: PRINT A;B;C");
+    CHECK(!strncmp(out_buf,
+            "4 5 7 \n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, for_frames)
+{
+    /* The loop variable is updated in place, also when the body changes it,
+     * and NEXT of an outer loop drops the inner ones */
+    main_proc_test_progline(&tau->bs, "10 FOR I=1 TO 9: FOR J=3 TO 1 STEP -1: PRINT I*10+J;");
+    main_proc_test_progline(&tau->bs, "20 IF J=2 THEN I=I+3: NEXT I: GOTO 40");
+    main_proc_test_progline(&tau->bs, "30 NEXT J: NEXT I");
+    main_proc_test_progline(&tau->bs, "40 FOR K=5 TO 1 STEP 0: PRINT K: NEXT K: NEXT J");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "13 12 53 52 93 92 5 \n"
+            "NEXT without FOR error in line 40\n"
+            , sizeof(out_buf)));
+}
+
+#if BASIC_CONFIG_NUMBER != BASIC_NUMBER_FIXED
+TEST_F(MainProcFixture, for_integer)
+{
+    /* Integer loops count exactly beyond the float precision, and continue
+     * from the value the loop body assigns to the variable */
+    main_proc_test_progline(&tau->bs, "10 FOR I=16777216 TO 16777220: C=C+1: NEXT I: PRINT C");
+    main_proc_test_progline(&tau->bs, "20 FOR I=0 TO 5: IF I=2 THEN I=3.25");
+    main_proc_test_progline(&tau->bs, "30 PRINT I;: NEXT I");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "5 \n"
+            "0 1 3.25 4.25 5.25 "
+            , sizeof(out_buf)));
+}
+#endif
+
+TEST_F(MainProcFixture, gosub_frames)
+{
+    /* RETURN drops the loops abandoned by the subroutines,
+     * and NEXT does not see the loops of the caller */
+    main_proc_test_progline(&tau->bs, "10 FOR I=1 TO 2: GOSUB 100: PRINT I;: NEXT I");
+    main_proc_test_progline(&tau->bs, "20 FOR J=I TO 3: GOSUB 30");
+    main_proc_test_progline(&tau->bs, "30 NEXT J");
+    main_proc_test_progline(&tau->bs, "100 FOR A=I TO 2: FOR B=A TO 2: GOSUB 150: RETURN");
+    main_proc_test_progline(&tau->bs, "150 FOR C=A TO B: RETURN");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "1 2 NEXT without FOR error in line 30\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, variable_names)
+{
+    /* Each letter, upper or lower case, with or without a digit, names its own variable */
+    main_proc_test(&tau->bs, "A=1: A0=2: A9=3: Z=4: Z9=5: a=6: z0=7: z9=8");
+    main_proc_test(&tau->bs, "PRINT A;A0;A9;Z;Z9;a;z0;z9;B;z");
+    CHECK(!strncmp(out_buf,
+            "1 2 3 4 5 6 7 8 0 0 \n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, array_layout)
+{
+    /* Arrays created inside loops, subroutines and expressions move the stack,
+     * and scalars created after them do not move the arrays */
+    main_proc_test_progline(&tau->bs, "10 DIM A(2): FOR I=1 TO 2: GOSUB 30: NEXT I: Z=A(2): PRINT A(1);Z;B(1): END");
+    main_proc_test_progline(&tau->bs, "30 A(I)=A(I)+I*(1+B(I)): RETURN");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "1 2 0 \n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, array_dims)
+{
+    /* Elements of multi-dimensional arrays are stored row-major, and each subscript
+     * is checked against its own dimension */
+    main_proc_test_progline(&tau->bs, "10 DIM A(1,2),B(1,1,1): A(1,2)=5: B(1,0,1)=A(1, 2)+1");
+    main_proc_test_progline(&tau->bs, "20 PRINT A(1,1);B(1,0,1);B(0,1,1): PRINT A(0,3)");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "0 6 0 \n"
+            "Subscript error in line 20\n"
+            , sizeof(out_buf)));
+}
+
+TEST_F(MainProcFixture, array_size_limit)
+{
+    /* Array sizes that do not fit the memory or overflow the size arithmetic are rejected */
+    main_proc_test(&tau->bs, "DIM A(20000)");
+    CHECK(!strcmp(out_buf, "Out of memory error\n"));
+    main_proc_test(&tau->bs, "DIM B(4000,4000,4000)");
+    CHECK(!strcmp(out_buf, "Out of memory error\n"));
+#if BASIC_CONFIG_NUMBER != BASIC_NUMBER_FIXED
+    main_proc_test(&tau->bs, "DIM C(16777216)");
+    CHECK(!strcmp(out_buf, "Parameter error\n"));
+#endif
+    main_proc_test(&tau->bs, "DIM D(3): D(3)=2: PRINT D(3)");
+    CHECK(!strcmp(out_buf, "2 \n"));
+}
+
+TEST_F(MainProcFixture, typed_arrays)
+{
+    /* Arrays declared AS BYTE, SHORT or LONG store the floor of the assigned values,
+     * reject values out of their range, and take less memory than number arrays */
+    main_proc_test_progline(&tau->bs, "10 DIM A(4) AS BYTE, B(1,1) AS SHORT, C(1) AS LONG");
+    main_proc_test_progline(&tau->bs, "20 A(4)=127.9: B(1,1)=-32767.5: C(1)=-7.5: PRINT A(4);B(1,1);C(1): A(0)=128");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "127 -32768 -8 \nOverflow error in line 20\n"));
+    main_proc_test(&tau->bs, "LIST 10");
+    CHECK(!strcmp(out_buf,
+            "10 DIM A(4) AS BYTE, B(1,1) AS SHORT, C(1) AS LONG\n"
+            "20 A(4)=127.9: B(1,1)=-32767.5: C(1)=-7.5: PRINT A(4);B(1,1);C(1): A(0)=128\n"));
+    main_proc_test(&tau->bs, "PRINT A(5)");
+    CHECK(!strcmp(out_buf, "Subscript error\n"));
+    main_proc_test(&tau->bs, "DIM E(1) AS WORD");
+    CHECK(!strcmp(out_buf, "Syntax error\n"));
+#if BASIC_CONFIG_MAT
+    /* Whole-array operations convert between the element types */
+    main_proc_test(&tau->bs, "MAT B=IDN: MAT T=(2.5)*B: PRINT SUM(B);MIN(B);T(1,1);DOT(B,T): MAT B=(20000)*T");
+    CHECK(!strcmp(out_buf, "2 0 2.5 5 \nOverflow error\n"));
+#endif
+    main_proc_test(&tau->bs, "NEW");
+    main_proc_test(&tau->bs, "DIM D(99)");
+    CHECK(!strcmp(out_buf, "Out of memory error\n"));
+    main_proc_test(&tau->bs, "DIM D(99) AS BYTE: D(99)=-1: PRINT D(99)");
+    CHECK(!strcmp(out_buf, "-1 \n"));
+}
+
+#if BASIC_CONFIG_MAT
+TEST_F(MainProcFixture, mat_statements)
+{
+    /* Whole-array operations, with a missing target dimensioned by the result */
+    main_proc_test_progline(&tau->bs, "10 DIM A(1,2): A(0,1)=1: A(1,2)=2: MAT B=TRN(A): MAT C=A*B");
+    main_proc_test_progline(&tau->bs, "20 PRINT C(0,0);C(1,1);B(2,1): MAT C=IDN: MAT C=(3)*C: MAT A=A*A");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "1 4 2 \nSubscript error in line 20\n"));
+    main_proc_test(&tau->bs, "PRINT C(0,0);C(0,1)");
+    CHECK(!strcmp(out_buf, "3 0 \n"));
+}
+
+TEST_F(MainProcFixture, array_reductions)
+{
+    /* Reductions run over the elements in storage order, optionally from a start element
+     * and for a count of elements */
+    main_proc_test_progline(&tau->bs, "10 DIM A(3,1): A(1,0)=3: A(2,1)=-1: A(3,1)=2");
+    main_proc_test_progline(&tau->bs, "20 PRINT SUM(A);MIN(A);MAX(A,1,3);MEAN(A,2,4);-DOT(A,A): PRINT SUM(A,9)");
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strcmp(out_buf, "4 -1 3 0.5 -14 \nSubscript error in line 20\n"));
+    main_proc_test(&tau->bs, "PRINT MIN(A,8)");
+    CHECK(!strcmp(out_buf, "Parameter error\n"));
+}
+#endif
+
+TEST_F(MainProcFixture, variable_refs)
+{
+    /* Marked variable names list as typed, and keep working when the variables
+     * are created in a different order */
+    main_proc_test_progline(&tau->bs, "10 IF X>0 THEN Y1=Y1*2: GOTO 30");
+    main_proc_test_progline(&tau->bs, "20 Y1=3: A 1=1: X=A1+1: PRINT X;Y1: CLEAR: X=1: GOTO 10");
+    main_proc_test_progline(&tau->bs, "30 PRINT X;Y1;A1");
+    main_proc_test(&tau->bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 IF X>0 THEN Y1=Y1*2: GOTO 30\n"
+            "20 Y1=3: A 1=1: X=A1+1: PRINT X;Y1: CLEAR: X=1: GOTO 10\n"
+            "30 PRINT X;Y1;A1\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "2 3 \n"
+            "1 0 0 \n"
+            , sizeof(out_buf)));
+    /* The token byte cannot be typed in place of a variable */
+    main_proc_test(&tau->bs, "PRINT 2+\375");
+    CHECK(!strncmp(out_buf,
+            "Syntax error\n"
+            , sizeof(out_buf)));
+    main_proc_test(&tau->bs, "40 \375\200\200A=1");
+    CHECK(!strncmp(out_buf,
+            "Syntax error\n"
+            , sizeof(out_buf)));
+}
+
 TEST_F(MainProcFixture, rem)
 {
     main_proc_test_progline(&tau->bs, "10 REM Some text GOTO");
@@ -535,6 +1334,8 @@ TEST_F(MainProcFixture, print)
     CHECK(!strncmp(out_buf,
             "19 \n"
             , sizeof(out_buf)));
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FLOAT
+    /* The digits printed depend on the number type */
     main_proc_test(&tau->bs, "PRINT SIN (3.14159265358/4)");
     CHECK(!strncmp(out_buf,
             "0.707107 \n"
@@ -549,6 +1350,7 @@ TEST_F(MainProcFixture, print)
     CHECK(!strncmp(out_buf,
             "1.23457 0 7 \n"
             , sizeof(out_buf)));
+#endif
     main_proc_test(&tau->bs, "PRINT TAB(5)\"HI\"");
     CHECK(!strncmp(out_buf,
             "\033[6GHI\n"
@@ -686,6 +1488,13 @@ TEST_F(MainProcFixture, input)
     CHECK(!strncmp(out_buf,
             "? ?? 3 \t4 \n"
             , sizeof(out_buf)));
+
+    strcpy(input_injection_buf, "2,\376"); // The byte of a literal token is not a value
+    input_inj_buf_idx = 0;
+    main_proc_test(&bs, "RUN");
+    CHECK(!strncmp(out_buf,
+            "? Syntax error in line 10\n"
+            , sizeof(out_buf)));
 }
 
 TEST_F(MainProcFixture, read)
@@ -757,7 +1566,7 @@ TEST_F(MainProcFixture, read)
     CHECK(!strncmp(out_buf,
             "Parameter error in line 10\n"
             , sizeof(out_buf)));
-    main_proc_test_progline(&tau->bs, "10 DATA 1e30*1e30");
+    main_proc_test_progline(&tau->bs, "10 DATA " OVERFLOW_PRODUCT);
     main_proc_test(&tau->bs, "READ A: PRINT A");
     CHECK(!strncmp(out_buf,
             "Overflow error in line 10\n"
@@ -1249,11 +2058,11 @@ TEST_F(MainProcFixture, expression_errors)
     CHECK(!strncmp(out_buf,
             "Division by 0 error\n"
             , sizeof(out_buf)));
-    main_proc_test(&tau->bs, "PRINT 1e30*1e30"); // Should fail with an overflow
+    main_proc_test(&tau->bs, "PRINT " OVERFLOW_PRODUCT); // Should fail with an overflow
     CHECK(!strncmp(out_buf,
             "Overflow error\n"
             , sizeof(out_buf)));
-    main_proc_test(&tau->bs, "PRINT 1e39"); // Should fail with an overflow
+    main_proc_test(&tau->bs, "PRINT " OVERFLOW_LITERAL); // Should fail with an overflow
     CHECK(!strncmp(out_buf,
             "Overflow error\n"
             , sizeof(out_buf)));
@@ -1273,6 +2082,48 @@ TEST_F(MainProcFixture, break_key)
             , sizeof(out_buf)));
 }
 
+TEST(Variables, value_alignment)
+{
+    BASIC_MAIN_STATE bs;
+
+    /* Values are aligned as configured, even in a memory with an odd start and end */
+    basic_main_initialize(&bs, psbuf + 1, sizeof(psbuf) - 2);
+    main_proc_test_progline(&bs, "10 A=2");
+    main_proc_test(&bs, "DIM C(2,3): B=1: A=3: C(2,3)=B+A: PRINT C(2,3)");
+    CHECK(!strncmp(out_buf,
+            "4 \n"
+            , sizeof(out_buf)));
+    VARIABLE_VALUE* pval = variable_storage_create_var(&bs.prog, 'B');
+    REQUIRE(pval);
+    CHECK((uintptr_t)pval % BASIC_MEM_VALUE_ALIGN == 0);
+    const unsigned subscripts[2] = {2, 3};
+    unsigned char type;
+    REQUIRE(variable_storage_create_array_var(&bs.prog, 'C', &pval, &type, subscripts, 2, false) == BASIC_ERROR_OK);
+    CHECK(type == VARIABLE_TYPE_NUMBER);
+    CHECK((uintptr_t)pval % BASIC_MEM_VALUE_ALIGN == 0);
+    CHECK(pval->f == NUM(4));
+}
+
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+TEST(Variables, large_array)
+{
+    BASIC_MAIN_STATE bs;
+    static unsigned char large_buf[20000 * sizeof(VARIABLE_VALUE) + 256];
+
+    /* With 32-bit sizes, an array may have more elements than 16-bit sizes allow */
+    basic_main_initialize(&bs, large_buf, sizeof(large_buf));
+    main_proc_test_progline(&bs, "10 DIM A(19999): A(19999)=7: A(0)=A(19999)+1: PRINT A(19999);A(0);A(19998)");
+    main_proc_test(&bs, "RUN");
+    CHECK(!strcmp(out_buf, "7 8 0 \n"));
+    main_proc_test(&bs, "PRINT A(20000)");
+    CHECK(!strcmp(out_buf, "Subscript error\n"));
+    /* The same in compiled code */
+    basic_main_set_vm_buffer(&bs, vm_buf, sizeof(vm_buf));
+    main_proc_test(&bs, "RUN");
+    CHECK(!strcmp(out_buf, "7 8 0 \n"));
+}
+#endif
+
 TEST(ProgramOomem, prog_oomem_min)
 {
     BASIC_MAIN_STATE bs;
@@ -1287,12 +2138,16 @@ TEST(ProgramOomem, prog_oomem_min)
             , sizeof(out_buf)));
 }
 
+/* The exact memory sizes in these tests assume packed 4-byte values. With aligned values,
+ * the variable entries are longer and the memory end is rounded down */
+#if !BASIC_CONFIG_ALIGNED_VALUES && BASIC_CONFIG_NUMBER != BASIC_NUMBER_DOUBLE
 TEST(ProgramOomem, prog_oomem_some)
 {
     BASIC_MAIN_STATE bs;
 
-    /* Initialize program storage to a bare one-line capacity */
-    basic_main_initialize(&bs, psbuf, 9);
+    /* Initialize program storage to a bare one-line capacity
+     * (3 bytes of sentinels, 6 bytes of line, and 2 bytes of line index) */
+    basic_main_initialize(&bs, psbuf, 11);
 
     main_proc_test_progline(&bs, "10"); // Should always succeed, line deletion
     main_proc_test_progline(&bs, "10 STOP"); // Should just fit
@@ -1307,7 +2162,7 @@ TEST(ProgramOomem, prog_line_replacement)
     BASIC_MAIN_STATE bs;
 
     /* Initialize program storage to a bare one-line capacity */
-    basic_main_initialize(&bs, psbuf, 9);
+    basic_main_initialize(&bs, psbuf, 11);
 
     main_proc_test_progline(&bs, "10 STOP"); // Should just fit
     main_proc_test_progline(&bs, "10 PRINT"); // Line replacement, should succeed
@@ -1323,7 +2178,7 @@ TEST(VarOomem, no_var_mem)
 
     /* Initialize memory size to just enough for one program line and
      * 2 bytes expression evaluation stack */
-    basic_main_initialize(&bs, psbuf, 11);
+    basic_main_initialize(&bs, psbuf, 13);
 
     main_proc_test_progline(&bs, "10 STOP"); // Should succeed
     main_proc_test(&bs, "PRINT A"); // Variables are not allocated when reading
@@ -1340,18 +2195,29 @@ TEST(VarOomem, one_var_mem)
 {
     BASIC_MAIN_STATE bs;
 
-    /* Initialize memory just enough for two program lines, one variable and 2 bytes
-     * for the expression stack */
-    basic_main_initialize(&bs, psbuf, 27);
+    /* Initialize memory just enough for two program lines, the first one
+     * with a pre-parsed literal, one variable and 2 bytes for the expression stack */
+#if BASIC_CONFIG_VARREFS
+    /* The 3 variable references take 9 more bytes. Until the second line is stored,
+     * 6 of them hold one more variable */
+    basic_main_initialize(&bs, psbuf, 46);
+#else
+    basic_main_initialize(&bs, psbuf, 37);
+#endif
 
     main_proc_test_progline(&bs, "10 A=2");
     main_proc_test_progline(&bs, "A=2"); // Should succeed
     main_proc_test_progline(&bs, "B=3"); // Should succeed
+#if BASIC_CONFIG_VARREFS
+    main_proc_test_progline(&bs, "C=4"); // Should succeed
+    main_proc_test(&bs, "D=5"); // Should fail with oomem
+#else
     main_proc_test(&bs, "C=4"); // Should fail with oomem
+#endif
     CHECK(!strncmp(out_buf,
             "Out of memory error\n"
             , sizeof(out_buf)));
-    main_proc_test_progline(&bs, "20 B=3");
+    main_proc_test_progline(&bs, "20 B=A"); // A line without a literal
     main_proc_test(&bs, "RUN"); // Should fail with oomem in line 20
     CHECK(!strncmp(out_buf,
             "Out of memory error in line 20\n"
@@ -1371,11 +2237,27 @@ TEST(VarOomem, array_alloc_in_expression)
             , sizeof(out_buf)));
 }
 
-static void expr_test(const char* str, BASIC_MEM_MGR* mem, BASIC_PARSING_RESULT expect_pr, float expect_res)
+TEST(ProgramOomem, load_program_oomem)
+{
+    BASIC_MAIN_STATE bs;
+
+    /* Room for a single "10 STOP" line, and the 8 bytes of its source text */
+    basic_main_initialize(&bs, psbuf, 19);
+
+    static const char program[] = "10 STOP\n20 STOP\n";
+    CHECK(basic_main_load_program(&bs, program, sizeof(program)-1) == BASIC_ERROR_OUT_OF_MEMORY);
+    main_proc_test(&bs, "LIST");
+    CHECK(!strncmp(out_buf,
+            "10 STOP\n"
+            , sizeof(out_buf)));
+}
+#endif
+
+static void expr_test(const char* str, BASIC_MEM_MGR* mem, BASIC_PARSING_RESULT expect_pr, basic_number_t expect_res)
 {
     printf("Expression: %s\n", str);
     const unsigned char* p = (const unsigned char*)str;
-    float result = 0.0f;
+    basic_number_t result = 0;
     BASIC_PARSING_RESULT oc = basic_parsing_expression(&p, &result, mem);
     switch(oc)
     {
@@ -1383,7 +2265,7 @@ static void expr_test(const char* str, BASIC_MEM_MGR* mem, BASIC_PARSING_RESULT
         printf("Expression not found\n");
         break;
     case BASIC_ERROR_OK:
-        printf("Result: %f\n", result);
+        printf("Result: %.10g\n", NUM_VALUE(result));
         break;
     default:
         basic_error_print(oc, UINT_MAX);
@@ -1403,40 +2285,40 @@ TEST(Expressions, expressions)
     // Add some variables
     VARIABLE_VALUE* pf = variable_storage_create_var(&vs,
             var_name_add_char(var_name_empty(), 'A'));
-    pf->f = 2.0f;
+    pf->f = NUM(2);
 
     pf = variable_storage_create_var(&vs,
             var_name_add_char(var_name_empty(), 'B'));
-    pf->f = 3.0f;
+    pf->f = NUM(3);
 
     pf = variable_storage_create_var(&vs,
             var_name_add_char(var_name_empty(), 'C'));
-    pf->f = 4.0f;
+    pf->f = NUM(4);
 
     pf = variable_storage_create_var(&vs,
             var_name_add_char(var_name_empty(), 'D'));
-    pf->f = 5.0f;
+    pf->f = NUM(5);
 
     expr_test("", &vs, BASIC_ERROR_SYNTAX, 0);
     expr_test(" ", &vs, BASIC_ERROR_SYNTAX, 0);
     expr_test("!", &vs, BASIC_ERROR_SYNTAX, 0);
-    expr_test("A", &vs, BASIC_ERROR_OK, 2);
-    expr_test("\231A", &vs, BASIC_ERROR_OK, -2); //-A
-    expr_test("A\230A", &vs, BASIC_ERROR_OK, 4); // A+A
-    expr_test("A\230A\230A", &vs, BASIC_ERROR_OK, 6); // A+A+A
-    expr_test("A\230B\232C\230D", &vs, BASIC_ERROR_OK, 19); // A+B*C+D
-    expr_test("(A\230B)\232C", &vs, BASIC_ERROR_OK, 20); // (A+B)*C
-    expr_test("\237(A)", &vs, BASIC_ERROR_OK, 1); // SGN(A)
-    expr_test("\237(\231A)", &vs, BASIC_ERROR_OK, -1); // SGN(-A)
+    expr_test("A", &vs, BASIC_ERROR_OK, NUM(2));
+    expr_test("\231A", &vs, BASIC_ERROR_OK, NUM(-2)); //-A
+    expr_test("A\230A", &vs, BASIC_ERROR_OK, NUM(4)); // A+A
+    expr_test("A\230A\230A", &vs, BASIC_ERROR_OK, NUM(6)); // A+A+A
+    expr_test("A\230B\232C\230D", &vs, BASIC_ERROR_OK, NUM(19)); // A+B*C+D
+    expr_test("(A\230B)\232C", &vs, BASIC_ERROR_OK, NUM(20)); // (A+B)*C
+    expr_test("\237(A)", &vs, BASIC_ERROR_OK, NUM(1)); // SGN(A)
+    expr_test("\237(\231A)", &vs, BASIC_ERROR_OK, NUM(-1)); // SGN(-A)
     expr_test("\237(A\232E)", &vs, BASIC_ERROR_OK, 0); // SGN(A*E)
-    expr_test("B\233A", &vs, BASIC_ERROR_OK, 1.5f); // B/A
-    expr_test("\240(B\233A)", &vs, BASIC_ERROR_OK, 1.0f); // INT(B/A)
-    expr_test("\241(A)", &vs, BASIC_ERROR_OK, 2); // ABS(A)
-    expr_test("\241(\231A)", &vs, BASIC_ERROR_OK, 2); // ABS(-A)
+    expr_test("B\233A", &vs, BASIC_ERROR_OK, NUM(1.5)); // B/A
+    expr_test("\240(B\233A)", &vs, BASIC_ERROR_OK, NUM(1.0)); // INT(B/A)
+    expr_test("\241(A)", &vs, BASIC_ERROR_OK, NUM(2)); // ABS(A)
+    expr_test("\241(\231A)", &vs, BASIC_ERROR_OK, NUM(2)); // ABS(-A)
     expr_test("\242(A)", &vs, BASIC_ERROR_OK, 0); // USR(A)
-    expr_test("\243(A)", &vs, BASIC_ERROR_OK, sqrtf(2.0f)); // SQR(A)
+    expr_test("\243(A)", &vs, BASIC_ERROR_OK, basic_number_sqrt(&vs.number_flags, NUM(2))); // SQR(A)
     // TODO: add a test for RND expr_test("\244(A)", &vs); // RND(A)
-    expr_test("\245(A)", &vs, BASIC_ERROR_OK, sinf(2.0f)); // SIN(A)
+    expr_test("\245(A)", &vs, BASIC_ERROR_OK, basic_number_sin(NUM(2))); // SIN(A)
 }
 
 TEST_F_SETUP(ExprNoRecurseFixture)
@@ -1449,7 +2331,7 @@ TEST_F_TEARDOWN(ExprNoRecurseFixture)
 
 }
 
-static void test_expr_nr(struct ExprNoRecurseFixture* tau, const char* expr, BASIC_PARSING_RESULT expect_pr, float expect_val)
+static void test_expr_nr(struct ExprNoRecurseFixture* tau, const char* expr, BASIC_PARSING_RESULT expect_pr, basic_number_t expect_val)
 {
     char buf[256];
     REQUIRE(strlen(expr) < sizeof(buf));
@@ -1457,12 +2339,12 @@ static void test_expr_nr(struct ExprNoRecurseFixture* tau, const char* expr, BAS
     printf("Expression: %s\n", buf);
     keywords_tokenize_line(buf); /* To convert operators into tokens */
     const unsigned char* p = (const unsigned char*)buf;
-    float val = 0.0f;
+    basic_number_t val = 0;
     BASIC_PARSING_RESULT pr = basic_parsing_expression(&p, &val, &tau->vars);
     CHECK(pr == expect_pr);
     if(pr == BASIC_ERROR_OK)
     {
-        printf("Result: %f\n", val);
+        printf("Result: %.10g\n", NUM_VALUE(val));
         CHECK(val == expect_val);
     }
     else
@@ -1473,71 +2355,72 @@ static void test_expr_nr(struct ExprNoRecurseFixture* tau, const char* expr, BAS
 
 TEST_F(ExprNoRecurseFixture, NumberLiteral)
 {
-    test_expr_nr(tau, "1.25", BASIC_ERROR_OK, 1.25f);
-    test_expr_nr(tau, "-1.25", BASIC_ERROR_OK, -1.25f);
+    test_expr_nr(tau, "1.25", BASIC_ERROR_OK, NUM(1.25));
+    test_expr_nr(tau, "-1.25", BASIC_ERROR_OK, NUM(-1.25));
 }
 
 TEST_F(ExprNoRecurseFixture, addition)
 {
-    test_expr_nr(tau, "1+2", BASIC_ERROR_OK, 3.0f);
+    test_expr_nr(tau, "1+2", BASIC_ERROR_OK, NUM(3.0));
 }
 
 TEST_F(ExprNoRecurseFixture, multiple_addition)
 {
-    test_expr_nr(tau, "1+2+3", BASIC_ERROR_OK, 6.0f);
+    test_expr_nr(tau, "1+2+3", BASIC_ERROR_OK, NUM(6.0));
 }
 
 TEST_F(ExprNoRecurseFixture, add_and_multiply)
 {
-    test_expr_nr(tau, "1+2*3", BASIC_ERROR_OK, 7.0f);
-    test_expr_nr(tau, "2*3+4", BASIC_ERROR_OK, 10.0f);
-    test_expr_nr(tau, "1+2*3*4+5", BASIC_ERROR_OK, 30.0f);
+    test_expr_nr(tau, "1+2*3", BASIC_ERROR_OK, NUM(7.0));
+    test_expr_nr(tau, "2*3+4", BASIC_ERROR_OK, NUM(10.0));
+    test_expr_nr(tau, "1+2*3*4+5", BASIC_ERROR_OK, NUM(30.0));
 }
 
 TEST_F(ExprNoRecurseFixture, unary_minus)
 {
-    test_expr_nr(tau, "-1+2*-3--4", BASIC_ERROR_OK, -3.0f);
-    test_expr_nr(tau, "-1+2*-3---4", BASIC_ERROR_OK, -11.0f);
+    test_expr_nr(tau, "-1+2*-3--4", BASIC_ERROR_OK, NUM(-3.0));
+    test_expr_nr(tau, "-1+2*-3---4", BASIC_ERROR_OK, NUM(-11.0));
 }
 
 TEST_F(ExprNoRecurseFixture, parentheses)
 {
-    test_expr_nr(tau, "(1+2)*3", BASIC_ERROR_OK, 9.0f);
-    test_expr_nr(tau, "(1+2)+(3+4)*3", BASIC_ERROR_OK, 24.0f);
-    test_expr_nr(tau, "-(3+4*2)", BASIC_ERROR_OK, -11.0f);
-    test_expr_nr(tau, "--(-3+4*2)", BASIC_ERROR_OK, 5.0f);
+    test_expr_nr(tau, "(1+2)*3", BASIC_ERROR_OK, NUM(9.0));
+    test_expr_nr(tau, "(1+2)+(3+4)*3", BASIC_ERROR_OK, NUM(24.0));
+    test_expr_nr(tau, "-(3+4*2)", BASIC_ERROR_OK, NUM(-11.0));
+    test_expr_nr(tau, "--(-3+4*2)", BASIC_ERROR_OK, NUM(5.0));
 }
 
 TEST_F(ExprNoRecurseFixture, functions)
 {
-    test_expr_nr(tau, "5-SQR(1+2*(3+4)+1)", BASIC_ERROR_OK, 1.0f);
-    test_expr_nr(tau, "-SQR(1+2*(3+4)+1)", BASIC_ERROR_OK, -4.0f);
-    test_expr_nr(tau, "5-SQR(1+2*(3+4)+1)*2+1", BASIC_ERROR_OK, -2.0f);
+    test_expr_nr(tau, "5-SQR(1+2*(3+4)+1)", BASIC_ERROR_OK, NUM(1.0));
+    test_expr_nr(tau, "-SQR(1+2*(3+4)+1)", BASIC_ERROR_OK, NUM(-4.0));
+    test_expr_nr(tau, "5-SQR(1+2*(3+4)+1)*2+1", BASIC_ERROR_OK, NUM(-2.0));
 }
 
 TEST_F(ExprNoRecurseFixture, array_subscript)
 {
-    test_expr_nr(tau, "A(1)", BASIC_ERROR_OK, 0.0f);
+    test_expr_nr(tau, "A(1)", BASIC_ERROR_OK, 0);
 }
 
 TEST_F(ExprNoRecurseFixture, errors_in_expressions)
 {
-    test_expr_nr(tau, "", BASIC_ERROR_SYNTAX, 0.0f);
-    test_expr_nr(tau, "(", BASIC_ERROR_SYNTAX, 0.0f);
-    test_expr_nr(tau, "+", BASIC_ERROR_SYNTAX, 0.0f);
-    test_expr_nr(tau, "()", BASIC_ERROR_SYNTAX, 0.0f);
-    test_expr_nr(tau, "A()", BASIC_ERROR_SYNTAX, 0.0f);
+    test_expr_nr(tau, "", BASIC_ERROR_SYNTAX, 0);
+    test_expr_nr(tau, "(", BASIC_ERROR_SYNTAX, 0);
+    test_expr_nr(tau, "+", BASIC_ERROR_SYNTAX, 0);
+    test_expr_nr(tau, "()", BASIC_ERROR_SYNTAX, 0);
+    test_expr_nr(tau, "A()", BASIC_ERROR_SYNTAX, 0);
 
-    test_expr_nr(tau, "-3*(1/0)", BASIC_ERROR_DIVISION_BY_ZERO, 0.0f);
-    test_expr_nr(tau, "1+", BASIC_ERROR_SYNTAX, 0.0f);
-    test_expr_nr(tau, "1+A(-1)", BASIC_ERROR_PARAMETER, 0.0f);
-    test_expr_nr(tau, "-A(-1)", BASIC_ERROR_PARAMETER, 0.0f);
-    test_expr_nr(tau, "1+3*A(-1)", BASIC_ERROR_PARAMETER, 0.0f);
-    test_expr_nr(tau, "SQR(-1)", BASIC_ERROR_PARAMETER, 0.0f);
-    test_expr_nr(tau, "1e30*1e30", BASIC_ERROR_OVERFLOW, 0.0f);
-    test_expr_nr(tau, "A(B(C(1))+11)", BASIC_ERROR_SUBSCRIPT, 0.0f);
+    test_expr_nr(tau, "-3*(1/0)", BASIC_ERROR_DIVISION_BY_ZERO, 0);
+    test_expr_nr(tau, "1+", BASIC_ERROR_SYNTAX, 0);
+    test_expr_nr(tau, "1+A(-1)", BASIC_ERROR_PARAMETER, 0);
+    test_expr_nr(tau, "-A(-1)", BASIC_ERROR_PARAMETER, 0);
+    test_expr_nr(tau, "1+3*A(-1)", BASIC_ERROR_PARAMETER, 0);
+    test_expr_nr(tau, "SQR(-1)", BASIC_ERROR_PARAMETER, 0);
+    test_expr_nr(tau, OVERFLOW_PRODUCT, BASIC_ERROR_OVERFLOW, 0);
+    test_expr_nr(tau, "A(B(C(1))+11)", BASIC_ERROR_SUBSCRIPT, 0);
 }
 
+#if !BASIC_CONFIG_ALIGNED_VALUES && BASIC_CONFIG_NUMBER != BASIC_NUMBER_DOUBLE
 TEST(ExprNoRecurseOomem, oomem_in_expressions)
 {
     struct ExprNoRecurseFixture tau;
@@ -1546,61 +2429,66 @@ TEST(ExprNoRecurseOomem, oomem_in_expressions)
     prog_storage_initialize(&tau.vars, vs_buf, 3);
 
     /* Try to compute a simple expression */
-    test_expr_nr(&tau, "0", BASIC_ERROR_OUT_OF_MEMORY, 0.0f);
+    test_expr_nr(&tau, "0", BASIC_ERROR_OUT_OF_MEMORY, 0);
 
     /* Add a minimal free space */
     prog_storage_initialize(&tau.vars, vs_buf, 4);
 
-    test_expr_nr(&tau, "0", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // This one should fail as well
+    test_expr_nr(&tau, "0", BASIC_ERROR_OUT_OF_MEMORY, 0); // This one should fail as well
 
     /* Add just enough space for a simple expression */
     prog_storage_initialize(&tau.vars, vs_buf, 5);
 
-    test_expr_nr(&tau, "1", BASIC_ERROR_OK, 1.0f);
-    test_expr_nr(&tau, "1+2", BASIC_ERROR_OK, 3.0f);
-    test_expr_nr(&tau, "2*3+4", BASIC_ERROR_OK, 10.0f);
-    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // This one needs more space and should fail
+    test_expr_nr(&tau, "1", BASIC_ERROR_OK, NUM(1.0));
+    test_expr_nr(&tau, "1+2", BASIC_ERROR_OK, NUM(3.0));
+    test_expr_nr(&tau, "2*3+4", BASIC_ERROR_OK, NUM(10.0));
+    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0); // This one needs more space and should fail
 
     /* Add almost enough space for the last case */
     prog_storage_initialize(&tau.vars, vs_buf, 7+3);
-    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Should still fail
+    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0); // Should still fail
 
     /* Another "almost" - still a byte is missing */
     prog_storage_initialize(&tau.vars, vs_buf, 8+3);
-    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Should still fail
+    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OUT_OF_MEMORY, 0); // Should still fail
 
     /* This should be just enough */
     prog_storage_initialize(&tau.vars, vs_buf, 9+3);
-    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OK, 14.0f);
-    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // But not enough for parentheses
+    test_expr_nr(&tau, "2+3*4", BASIC_ERROR_OK, NUM(14.0));
+    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OUT_OF_MEMORY, 0); // But not enough for parentheses
 
     /* Add a little more space */
     prog_storage_initialize(&tau.vars, vs_buf, 10+3);
-    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Still not enough
-    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // For a function call either
+    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OUT_OF_MEMORY, 0); // Still not enough
+    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OUT_OF_MEMORY, 0); // For a function call either
 
     /* This should be just enough */
     prog_storage_initialize(&tau.vars, vs_buf, 11+3);
-    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OK, 8.0f);
-    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // But not enough for a function call
-    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Or for an array reference
+    test_expr_nr(&tau, "2*(1+3)", BASIC_ERROR_OK, NUM(8.0));
+    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OUT_OF_MEMORY, 0); // But not enough for a function call
+    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0); // Or for an array reference
 
 
     /* Add enough space to almost be able to parse the array index */
     prog_storage_initialize(&tau.vars, vs_buf, 12+3);
-    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OK, 5.0f);
-    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Should still fail
+    test_expr_nr(&tau, "3+SQR(4)", BASIC_ERROR_OK, NUM(5.0));
+    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0); // Should still fail
 
     /* Add enough space to parse the array index but not for allocating the array */
     prog_storage_initialize(&tau.vars, vs_buf, 13+3);
-    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0.0f); // Should still fail
+    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OUT_OF_MEMORY, 0); // Should still fail
 
-    /* This should be just enough for everything */
+    /* This should be just enough for everything. The array header is 4 bytes longer with 32-bit sizes */
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+    prog_storage_initialize(&tau.vars, vs_buf, 5+52);
+#else
     prog_storage_initialize(&tau.vars, vs_buf, 5+48);
-    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OK, 3.0f); // Now, finally, should succeed
+#endif
+    test_expr_nr(&tau, "3+A(1)", BASIC_ERROR_OK, NUM(3.0)); // Now, finally, should succeed
 }
+#endif
 
-static void test_float_parser_exact(const char* s, BASIC_PARSING_RESULT expect_pr, float expect_val)
+static void test_float_parser_exact(const char* s, BASIC_PARSING_RESULT expect_pr, basic_number_t expect_val)
 {
     char buf[256];
     REQUIRE(strlen(s) < sizeof(buf));
@@ -1608,11 +2496,11 @@ static void test_float_parser_exact(const char* s, BASIC_PARSING_RESULT expect_p
     printf("Number: %s\n", buf);
     keywords_tokenize_line(buf); /* To convert operators into tokens */
     const unsigned char* p = (const unsigned char*)buf;
-    float val;
-    BASIC_PARSING_RESULT pr = basic_parsing_float(&p, &val);
+    basic_number_t val;
+    BASIC_PARSING_RESULT pr = basic_parsing_number(&p, &val);
     if(pr == BASIC_ERROR_OK)
     {
-        printf("Parsed: %.10e (%A)", val, val);
+        printf("Parsed: %.10e", NUM_VALUE(val));
     }
     else
     {
@@ -1620,7 +2508,7 @@ static void test_float_parser_exact(const char* s, BASIC_PARSING_RESULT expect_p
     }
     if(expect_pr == BASIC_ERROR_OK)
     {
-        printf(" Expected: %.10e (%A)", expect_val, expect_val);
+        printf(" Expected: %.10e", NUM_VALUE(expect_val));
     }
     printf("\n");
     CHECK(pr == expect_pr);
@@ -1633,65 +2521,74 @@ static void test_float_parser_exact(const char* s, BASIC_PARSING_RESULT expect_p
 
 TEST(CustomFloatParser, empty)
 {
-    test_float_parser_exact("", BASIC_ERROR_OK, 0.0f);
+    test_float_parser_exact("", BASIC_ERROR_OK, 0);
 }
 
 TEST(CustomFloatParser, just_dot)
 {
-    test_float_parser_exact(".", BASIC_ERROR_OK, 0.0f);
+    test_float_parser_exact(".", BASIC_ERROR_OK, 0);
 }
 
 TEST(CustomFloatParser, zero)
 {
-    test_float_parser_exact("0", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("00", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("0.", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("00.", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact(".0", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact(".00", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("0.0", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("00.00", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("0E", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("00E", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("0E0", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact("0E00", BASIC_ERROR_OK, 0.0f);
-    test_float_parser_exact(".0E0", BASIC_ERROR_OK, 0.0f);
+    test_float_parser_exact("0", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("00", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("0.", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("00.", BASIC_ERROR_OK, 0);
+    test_float_parser_exact(".0", BASIC_ERROR_OK, 0);
+    test_float_parser_exact(".00", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("0.0", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("00.00", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("0E", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("00E", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("0E0", BASIC_ERROR_OK, 0);
+    test_float_parser_exact("0E00", BASIC_ERROR_OK, 0);
+    test_float_parser_exact(".0E0", BASIC_ERROR_OK, 0);
 }
 
 TEST(CustomFloatParser, one)
 {
-    test_float_parser_exact("1", BASIC_ERROR_OK, 1.0f);
-    test_float_parser_exact("1.", BASIC_ERROR_OK, 1.0f);
-    test_float_parser_exact("1.0", BASIC_ERROR_OK, 1.0f);
-    test_float_parser_exact("1.e", BASIC_ERROR_OK, 1.0f);
-    test_float_parser_exact("1.E0", BASIC_ERROR_OK, 1.0f);
-    test_float_parser_exact("1.0E0", BASIC_ERROR_OK, 1.0f);
+    test_float_parser_exact("1", BASIC_ERROR_OK, NUM(1.0));
+    test_float_parser_exact("1.", BASIC_ERROR_OK, NUM(1.0));
+    test_float_parser_exact("1.0", BASIC_ERROR_OK, NUM(1.0));
+    test_float_parser_exact("1.e", BASIC_ERROR_OK, NUM(1.0));
+    test_float_parser_exact("1.E0", BASIC_ERROR_OK, NUM(1.0));
+    test_float_parser_exact("1.0E0", BASIC_ERROR_OK, NUM(1.0));
 }
 
 TEST(CustomFloatParser, integer)
 {
-    test_float_parser_exact("123", BASIC_ERROR_OK, 123.0f);
-    test_float_parser_exact("123e1", BASIC_ERROR_OK, 1230.0f);
-    test_float_parser_exact("123e+1", BASIC_ERROR_OK, 1230.0f);
+    test_float_parser_exact("123", BASIC_ERROR_OK, NUM(123.0));
+    test_float_parser_exact("123e1", BASIC_ERROR_OK, NUM(1230.0));
+    test_float_parser_exact("123e+1", BASIC_ERROR_OK, NUM(1230.0));
 }
 
 TEST(CustomFloatParser, fractions)
 {
-    test_float_parser_exact("12.5", BASIC_ERROR_OK, 12.5f);
-    test_float_parser_exact("125e-1", BASIC_ERROR_OK, 12.5f);
-    test_float_parser_exact("0.0625", BASIC_ERROR_OK, 0.0625f);
+    test_float_parser_exact("12.5", BASIC_ERROR_OK, NUM(12.5));
+    test_float_parser_exact("125e-1", BASIC_ERROR_OK, NUM(12.5));
+    test_float_parser_exact("0.0625", BASIC_ERROR_OK, NUM(0.0625));
 }
 
+#if BASIC_CONFIG_NUMBER != BASIC_NUMBER_FIXED
 TEST(CustomFloatParser, exponents)
 {
-    test_float_parser_exact("10.5e+14", BASIC_ERROR_OK, 10.5e14f);
-    test_float_parser_exact("123.25e+20", BASIC_ERROR_OK, 123.25e+20f);
-    test_float_parser_exact("123.25e-4", BASIC_ERROR_OK, 123.25e-4f);
+    test_float_parser_exact("10.5e+14", BASIC_ERROR_OK, NUM(10.5e14));
+    test_float_parser_exact("123.25e+20", BASIC_ERROR_OK, NUM(123.25e+20));
+    test_float_parser_exact("123.25e-4", BASIC_ERROR_OK, NUM(123.25e-4));
 }
 
+#endif
+
 TEST(CustomFloatParser, overflow)
 {
-    test_float_parser_exact("12345e38", BASIC_ERROR_OVERFLOW, 0.0f);
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+    test_float_parser_exact("12345e305", BASIC_ERROR_OVERFLOW, 0);
+#elif BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+    test_float_parser_exact("32768", BASIC_ERROR_OVERFLOW, 0);
+#else
+    test_float_parser_exact("12345e38", BASIC_ERROR_OVERFLOW, 0);
+#endif
 }
 
 TEST(Keywords, print_table)
@@ -33,10 +33,14 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <limits.h>
+#include <string.h>
 #include "basic_main.h"
 #include "basic_stdio.h"
 
 static unsigned char basic_mem[4096];
+static unsigned char vm_buf[8192];
+static unsigned char expr_cache_buf[4096];
 
 int basic_printf(const char *restrict format, ... )
 {
@@ -65,9 +69,62 @@ bool basic_callback_check_break_key(void)
     return false;
 }
 
+/* SAVE and LOAD use a file in the current directory */
+#define IMAGE_FILE_NAME "ucbasic.img"
+
+static char program_text[16384];
+static char image_buf[16384];
+
+bool basic_callback_save_image(const void* header, unsigned header_size, const void* data, unsigned data_size)
+{
+    FILE* f = fopen(IMAGE_FILE_NAME, "wb");
+    if(!f)
+    {
+        return false;
+    }
+    bool ok = fwrite(header, 1, header_size, f) == header_size &&
+            fwrite(data, 1, data_size, f) == data_size;
+    return fclose(f) == 0 && ok;
+}
+
+const void* basic_callback_load_image(unsigned* size)
+{
+    FILE* f = fopen(IMAGE_FILE_NAME, "rb");
+    if(!f)
+    {
+        return NULL;
+    }
+    *size = fread(image_buf, 1, sizeof(image_buf), f);
+    fclose(f);
+    return image_buf;
+}
+
 int main(int argc, char* argv[])
 {
     BASIC_MAIN_STATE bs;
     basic_main_initialize(&bs, basic_mem, sizeof(basic_mem));
+    basic_main_set_vm_buffer(&bs, vm_buf, sizeof(vm_buf));
+    basic_main_set_expr_cache(&bs, expr_cache_buf, sizeof(expr_cache_buf));
+    if(argc > 1)
+    {
+        /* Load a program file given on the command line, either a text file,
+         * or an image made by SAVE, which runs in place */
+        FILE* f = fopen(argv[1], "rb");
+        if(!f)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        size_t len = fread(program_text, 1, sizeof(program_text), f);
+        fclose(f);
+        if(len >= 3 && !memcmp(program_text, "uCB", 3))
+        {
+            basic_error_print(basic_main_attach_image(&bs, program_text, len), UINT_MAX);
+        }
+        else
+        {
+            basic_error_print(basic_main_load_program(&bs, program_text, len), UINT_MAX);
+        }
+    }
     basic_main_interactive_prompt(&bs);
 }
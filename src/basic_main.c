@@ -36,6 +36,7 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 #include "basic_errors.h"
 #include "keywords.h"
 #include "program_storage.h"
+#include "basic_matrix.h"
 #include <limits.h>
 #include <string.h>
 #include "basic_stdio.h"
@@ -65,9 +66,30 @@ static enum BASIC_ERROR_ID input_line(BASIC_MAIN_STATE* bs)
     return BASIC_ERROR_OK;
 }
 
+/* Read a line of values for the INPUT statement */
+static enum BASIC_ERROR_ID input_values_line(BASIC_MAIN_STATE* bs)
+{
+    enum BASIC_ERROR_ID status = input_line(bs);
+    if(status != BASIC_ERROR_OK)
+    {
+        return status;
+    }
+    /* The values are parsed as expressions, which would take the bytes
+     * of the internal tokens for pre-parsed values */
+    for(const char* s = bs->input_buf; *s; s++)
+    {
+        if((unsigned char)*s >= BASIC_TOKEN_RANGE_BEGIN)
+        {
+            return BASIC_ERROR_SYNTAX;
+        }
+    }
+    return BASIC_ERROR_OK;
+}
+
 static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
 {
     const unsigned char* input_ptr;
+    unsigned data_entry = bs->data_entry;
     if(read)
     {
         input_ptr = bs->data_ptr;
@@ -83,7 +105,17 @@ static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
         /* If the input line is empty, ask for another one */
         while(!*input_ptr || (read && *input_ptr == ':'))
         {
-            if(read)
+            if(read && bs->prog.data_index_valid)
+            {
+                /* Go straight to the next DATA statement */
+                if(data_entry == prog_storage_data_count(&bs->prog))
+                {
+                    return BASIC_ERROR_OUT_OF_DATA;
+                }
+                input_ptr = prog_storage_get_data(&bs->prog, data_entry++, &bs->data_line);
+                first_data = true;
+            }
+            else if(read)
             {
                 /* Look up for the next DATA statement */
                 if(!*input_ptr)
@@ -117,7 +149,7 @@ static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
             else
             {
                 basic_printf("?? ");
-                enum BASIC_ERROR_ID status = input_line(bs);
+                enum BASIC_ERROR_ID status = input_values_line(bs);
                 if(status != BASIC_ERROR_OK)
                 {
                     return status;
@@ -158,8 +190,8 @@ static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
             input_ptr++;
         }
         /* Parse the expression */
-        float val = 0.0f;
-        BASIC_PARSING_RESULT pr = basic_parsing_expression(&input_ptr, &val, &bs->prog);
+        BASIC_VALUE val;
+        BASIC_PARSING_RESULT pr = basic_parsing_value(&input_ptr, &val, &bs->prog);
         if(pr == BASIC_PARSING_NOT_FOUND)
         {
             bs->error_in_data |= read;
@@ -174,7 +206,8 @@ static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
         input_ptr = basic_parsing_skipws(input_ptr);
         var_name_packed vn;
         VARIABLE_VALUE* pv;
-        pr = basic_parsing_variable_ref(&bs->parse_ptr, &vn, &pv, &bs->prog);
+        unsigned char type;
+        pr = basic_parsing_variable_ref(&bs->parse_ptr, &vn, &pv, &type, &bs->prog);
         if(pr == BASIC_PARSING_NOT_FOUND)
         {
             return BASIC_ERROR_SYNTAX;
@@ -183,13 +216,20 @@ static enum BASIC_ERROR_ID read_input_common(BASIC_MAIN_STATE* bs, bool read)
         {
             return pr;
         }
-        pv->f = val;
+        pr = variable_storage_assign(pv, type, val);
+        if(pr != BASIC_ERROR_OK)
+        {
+            /* The value does not fit the variable */
+            bs->error_in_data |= read;
+            return pr;
+        }
         /* Check if there is anything more to input */
     } while(*bs->parse_ptr && *bs->parse_ptr != ':');
 
     if(read)
     {
         bs->data_ptr = input_ptr;
+        bs->data_entry = data_entry;
     }
 
     return BASIC_ERROR_OK;
@@ -204,7 +244,7 @@ static enum BASIC_ERROR_ID handler_input(BASIC_MAIN_STATE* bs)
 
     basic_printf("? ");
     {
-        enum BASIC_ERROR_ID status = input_line(bs);
+        enum BASIC_ERROR_ID status = input_values_line(bs);
         if(status != BASIC_ERROR_OK)
         {
             return status;
@@ -253,7 +293,8 @@ static enum BASIC_ERROR_ID let_for_common(BASIC_MAIN_STATE* bs, var_name_packed*
 {
     /* Parse the variable name and allocate a scalar/array variable if needed */
     VARIABLE_VALUE* pvar;
-    BASIC_PARSING_RESULT pr = basic_parsing_variable_ref(&bs->parse_ptr, pvn, &pvar, &bs->prog);
+    unsigned char type;
+    BASIC_PARSING_RESULT pr = basic_parsing_variable_ref(&bs->parse_ptr, pvn, &pvar, &type, &bs->prog);
     if(pr != BASIC_ERROR_OK)
     {
         return pr;
@@ -269,8 +310,8 @@ static enum BASIC_ERROR_ID let_for_common(BASIC_MAIN_STATE* bs, var_name_packed*
     }
     bs->parse_ptr++;
     /* Parse the expression */
-    float val = 0.0f;
-    pr = basic_parsing_expression(&bs->parse_ptr, &val, &bs->prog);
+    BASIC_VALUE val;
+    pr = basic_parsing_value(&bs->parse_ptr, &val, &bs->prog);
     if(pr == BASIC_PARSING_NOT_FOUND)
     {
         return BASIC_ERROR_SYNTAX;
@@ -280,9 +321,7 @@ static enum BASIC_ERROR_ID let_for_common(BASIC_MAIN_STATE* bs, var_name_packed*
         return pr;
     }
     /* Set the variable's value */
-    pvar->f = val;
-
-    return BASIC_ERROR_OK;
+    return variable_storage_assign(pvar, type, val);
 }
 
 static enum BASIC_ERROR_ID handler_let(BASIC_MAIN_STATE* bs)
@@ -308,9 +347,14 @@ static enum BASIC_ERROR_ID handler_for(BASIC_MAIN_STATE* bs)
     {
         return status;
     }
+    /* The loop variable is scalar, also when the loop starts with an array element */
+    fe.vn = variable_storage_scalar_name(&bs->prog, fe.vn);
     /* Check if we already have a FOR loop for the given variable on the stack.
      * If yes, discard the entry and all FOR entries created after it. */
-    fgstack_lookup_for(&bs->prog, &fe, fe.vn);
+    if(fgstack_find_for(&bs->prog, fe.vn))
+    {
+        fgstack_pop_for(&bs->prog);
+    }
 
     const unsigned char* p = bs->parse_ptr;
     /* Parse the TO part of the FOR statement */
@@ -321,7 +365,8 @@ static enum BASIC_ERROR_ID handler_for(BASIC_MAIN_STATE* bs)
     }
     p++;
     p = basic_parsing_skipws(p);
-    BASIC_PARSING_RESULT pr = basic_parsing_expression(&p, &fe.to_val, &bs->prog);
+    BASIC_VALUE to_val;
+    BASIC_PARSING_RESULT pr = basic_parsing_value(&p, &to_val, &bs->prog);
     if(pr == BASIC_PARSING_NOT_FOUND)
     {
         return BASIC_ERROR_SYNTAX;
@@ -332,12 +377,12 @@ static enum BASIC_ERROR_ID handler_for(BASIC_MAIN_STATE* bs)
     }
 
     /* Parse the optional STEP part. Initialize the default step to 1 */
-    fe.step = 1.0f;
+    BASIC_VALUE step = basic_value_int(1);
     if(*p == BASIC_KEYWORD_STEP)
     {
         p++;
         p = basic_parsing_skipws(p);
-        pr = basic_parsing_expression(&p, &fe.step, &bs->prog);
+        pr = basic_parsing_value(&p, &step, &bs->prog);
         if(pr == BASIC_PARSING_NOT_FOUND)
         {
             return BASIC_ERROR_SYNTAX;
@@ -347,7 +392,19 @@ static enum BASIC_ERROR_ID handler_for(BASIC_MAIN_STATE* bs)
             return pr;
         }
     }
-    /* Complete the FOR entry and push it up the stack */
+    /* Complete the FOR entry and push it up the stack. NEXT increments the scalar
+     * variable of the loop's name, even if the loop runs over an array element */
+    vval = variable_storage_create_var(&bs->prog, fe.vn);
+    if(!vval)
+    {
+        return BASIC_ERROR_OUT_OF_MEMORY;
+    }
+    fe.var_idx = (const unsigned char*)vval - bs->prog.base;
+    status = fgstack_for_setup(&fe, vval, to_val, step);
+    if(status != BASIC_ERROR_OK)
+    {
+        return status;
+    }
     bs->parse_ptr = p;
     fe.parse_idx = prog_storage_ptr_to_idx(&bs->prog, p);
     fe.line = bs->current_line;
@@ -366,42 +423,26 @@ static enum BASIC_ERROR_ID handler_next(BASIC_MAIN_STATE* bs)
     {
         return BASIC_ERROR_SYNTAX;
     }
+    vn = variable_storage_scalar_name(&bs->prog, vn);
     /* Look up for the corresponding FOR stack entry, breaking inner loops that
      * may have started but not completed in between */
-    FGS_ENTRY_FOR fe;
-    if(!fgstack_lookup_for(&bs->prog, &fe, vn))
+    FGS_ENTRY_FOR* fe = fgstack_find_for(&bs->prog, vn);
+    if(!fe)
     {
         return BASIC_ERROR_NEXT_WITHOUT_FOR;
     }
-    /* Look up the loop variable to increment it */
-    VARIABLE_VALUE* pval = variable_storage_create_var(&bs->prog, fe.vn);
-    if(!pval)
+    VARIABLE_VALUE* pval = (VARIABLE_VALUE*)(bs->prog.base + fe->var_idx);
+    if(fgstack_for_next(fe, pval, &bs->prog.number_flags))
     {
-        /* OOMEM shouldn't really happen here because the variable must be already
-         * allocated before it can appear on the FOR stack.
-         * Still check and report, there's nothing better we can do here */
-        return BASIC_ERROR_OUT_OF_MEMORY;
-    }
-    if((fe.step > 0 && pval->f < fe.to_val) ||
-            (fe.step < 0 && pval->f > fe.to_val))
-    {
-        /* The loop has not yet completed - push the FOR entry back to the stack */
-        if(!fgstack_push_for(&bs->prog, &fe))
-        {
-            /* Shouldn't normally OOMEM here because we just freed a stack entry.
-             * But just in case */
-            return BASIC_ERROR_OUT_OF_MEMORY;
-        }
-        /* Increment the loop variable */
-        pval->f += fe.step;
-        /* And jump to the point behind FOR */
-        bs->current_line = fe.line;
-        bs->parse_ptr = prog_storage_idx_to_ptr(&bs->prog, fe.parse_idx);
+        /* The loop has not yet completed, and the loop variable is incremented.
+         * Jump to the point behind FOR */
+        bs->current_line = fe->line;
+        bs->parse_ptr = prog_storage_idx_to_ptr(&bs->prog, fe->parse_idx);
     }
     else
     {
-        /* The FOR loop has completed - no need to do anything else here.
-         * The stack entry has already been popped */
+        /* The FOR loop has completed */
+        fgstack_pop_for(&bs->prog);
     }
     return BASIC_ERROR_OK;
 }
@@ -422,17 +463,81 @@ static enum BASIC_ERROR_ID goto_run_common(BASIC_MAIN_STATE* bs, unsigned line,
     return BASIC_ERROR_OK;
 }
 
-static enum BASIC_ERROR_ID handler_goto(BASIC_MAIN_STATE* bs)
+static void goto_line_idx(BASIC_MAIN_STATE* bs, unsigned line_idx)
 {
-    /* A line number argument is required */
+    bs->current_line = prog_storage_get_line_number(&bs->prog, line_idx);
+    bs->parse_ptr = prog_storage_get_line_parse_ptr(&bs->prog, line_idx);
+}
+
+/* Parse the line number argument of GOTO, GOSUB, or THEN and find the target line.
+ * In program lines, the argument is preceded by a jump cache slot, which remembers
+ * the target line after the first execution. The line number itself is then
+ * only skipped over if skip_line_number is set. */
+static BASIC_PARSING_RESULT parse_jump_target(BASIC_MAIN_STATE* bs, bool skip_line_number, unsigned* pline_idx)
+{
+    const unsigned char* slot = 0;
+    if(bs->current_line != UINT_MAX && *bs->parse_ptr == BASIC_TOKEN_JUMP_CACHE)
+    {
+        slot = bs->parse_ptr;
+        bs->parse_ptr += PROG_STORAGE_JUMP_CACHE_SIZE;
+        unsigned line_idx = prog_storage_read_jump_cache(&bs->prog, slot);
+        if(line_idx)
+        {
+            /* The target has already been resolved */
+            if(skip_line_number)
+            {
+                unsigned line;
+                basic_parsing_uint16(&bs->parse_ptr, &line);
+            }
+            *pline_idx = line_idx;
+            return BASIC_ERROR_OK;
+        }
+    }
     unsigned line = 0;
     BASIC_PARSING_RESULT pr = basic_parsing_uint16(&bs->parse_ptr, &line);
     if(pr != BASIC_ERROR_OK)
+    {
+        return pr;
+    }
+    FIND_LINE_RESULT fr = prog_storage_find_line(&bs->prog, line);
+    if(!fr.found)
+    {
+        return BASIC_ERROR_NO_SUCH_LINE;
+    }
+    if(slot)
+    {
+        prog_storage_write_jump_cache(&bs->prog, slot, fr.idx);
+    }
+    *pline_idx = fr.idx;
+    return BASIC_ERROR_OK;
+}
+
+static enum BASIC_ERROR_ID handler_goto(BASIC_MAIN_STATE* bs)
+{
+    /* A line number argument is required */
+    unsigned line_idx;
+    BASIC_PARSING_RESULT pr = parse_jump_target(bs, false, &line_idx);
+    if(pr == BASIC_PARSING_NOT_FOUND)
     {
         /* Turn a possible BASIC_PARSING_NOT_FOUND into a syntax error */
         return BASIC_ERROR_SYNTAX;
     }
-    return goto_run_common(bs, line, true);
+    else if(pr != BASIC_ERROR_OK)
+    {
+        return pr;
+    }
+    /* This can trigger program execution from interactive mode! */
+    goto_line_idx(bs, line_idx);
+    return BASIC_ERROR_OK;
+}
+
+/* Drop the compiled code and the DATA index after program lines have changed or moved */
+static void invalidate_code(BASIC_MAIN_STATE* bs)
+{
+#if BASIC_CONFIG_VM
+    basic_vm_invalidate(&bs->vm);
+#endif
+    prog_storage_release_data_index(&bs->prog);
 }
 
 static void restore0(BASIC_MAIN_STATE* bs)
@@ -441,6 +546,7 @@ static void restore0(BASIC_MAIN_STATE* bs)
     FIND_LINE_RESULT fr = prog_storage_find_line(&bs->prog, 0);
     bs->data_ptr = prog_storage_get_line_parse_ptr(&bs->prog, fr.idx);
     bs->data_line = 0;
+    bs->data_entry = 0;
 }
 
 static enum BASIC_ERROR_ID handler_run(BASIC_MAIN_STATE* bs)
@@ -458,6 +564,12 @@ static enum BASIC_ERROR_ID handler_run(BASIC_MAIN_STATE* bs)
     fgstack_clear(&bs->prog);
     /* Reset the DATA pointer */
     restore0(bs);
+    /* Index the DATA statements if the program has changed. Without the index, READ searches for them */
+    prog_storage_build_data_index(&bs->prog);
+#if BASIC_CONFIG_VM
+    /* Compile the program if it has changed. If it does not fit, it is interpreted */
+    basic_vm_compile(&bs->vm, &bs->prog);
+#endif
 
     return goto_run_common(bs, line, pr == BASIC_ERROR_OK);
 }
@@ -473,6 +585,7 @@ static enum BASIC_ERROR_ID handler_new(BASIC_MAIN_STATE* bs)
 
     /* Erase the program */
     prog_storage_clear(&bs->prog);
+    invalidate_code(bs);
     /* Clear all variables */
     variable_storage_clear(&bs->prog);
     /* Reset the FOR/GOSUB stack */
@@ -495,8 +608,8 @@ static enum BASIC_ERROR_ID handler_if(BASIC_MAIN_STATE* bs)
     const unsigned char* p = bs->parse_ptr;
 
     /* Parse the left hand side expression */
-    float lhs = 0.0f;
-    BASIC_PARSING_RESULT pr = basic_parsing_expression(&p, &lhs, &bs->prog);
+    BASIC_VALUE lhs;
+    BASIC_PARSING_RESULT pr = basic_parsing_value(&p, &lhs, &bs->prog);
     if(pr == BASIC_PARSING_NOT_FOUND)
     {
         return BASIC_ERROR_SYNTAX;
@@ -521,8 +634,8 @@ static enum BASIC_ERROR_ID handler_if(BASIC_MAIN_STATE* bs)
         return BASIC_ERROR_SYNTAX;
     }
     /* Parse the right hand side expression */
-    float rhs = 0.0f;
-    pr = basic_parsing_expression(&p, &rhs, &bs->prog);
+    BASIC_VALUE rhs;
+    pr = basic_parsing_value(&p, &rhs, &bs->prog);
     if(pr == BASIC_PARSING_NOT_FOUND)
     {
         return BASIC_ERROR_SYNTAX;
@@ -544,10 +657,11 @@ static enum BASIC_ERROR_ID handler_if(BASIC_MAIN_STATE* bs)
     bs->parse_ptr = p;
 
     /* Do the actual comparison and put its results into a bitmap */
+    unsigned relation = basic_value_compare(lhs, rhs);
     unsigned char cmp_bitmap =
-            (lhs >  rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, GREATER) |
-            (lhs == rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, EQUALS) |
-            (lhs <  rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, LESS);
+            ((relation & BASIC_VALUE_GREATER) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, GREATER) |
+            ((relation & BASIC_VALUE_EQUAL) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, EQUALS) |
+            ((relation & BASIC_VALUE_LESS) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, LESS);
 
     /* The comparison result if true if at least one of the given relations holds */
     bool cmp_result = (op_bitmap & cmp_bitmap) != 0;
@@ -556,11 +670,16 @@ static enum BASIC_ERROR_ID handler_if(BASIC_MAIN_STATE* bs)
     {
         /* The condition is evaluated to true. Check if THEN is followed
          * by a line number, in which case a GOTO to that line is performed */
-        unsigned line = 0;
-        pr = basic_parsing_uint16(&bs->parse_ptr, &line);
+        unsigned line_idx;
+        pr = parse_jump_target(bs, false, &line_idx);
         if(pr == BASIC_ERROR_OK)
         {
-            return goto_run_common(bs, line, true);
+            goto_line_idx(bs, line_idx);
+            return BASIC_ERROR_OK;
+        }
+        else if(pr == BASIC_ERROR_NO_SUCH_LINE)
+        {
+            return pr;
         }
         else
         {
@@ -577,8 +696,27 @@ static enum BASIC_ERROR_ID handler_if(BASIC_MAIN_STATE* bs)
 
 static enum BASIC_ERROR_ID handler_restore(BASIC_MAIN_STATE* bs)
 {
-    /* TODO: allow RESTORE to have a line number parameter */
-    restore0(bs);
+    /* A line number may be provided (in which case the line must exist) */
+    unsigned line;
+    BASIC_PARSING_RESULT pr = basic_parsing_uint16(&bs->parse_ptr, &line);
+    if(pr == BASIC_ERROR_SYNTAX)
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    if(pr == BASIC_PARSING_NOT_FOUND)
+    {
+        restore0(bs);
+        return BASIC_ERROR_OK;
+    }
+    FIND_LINE_RESULT fr = prog_storage_find_line(&bs->prog, line);
+    if(!fr.found)
+    {
+        return BASIC_ERROR_NO_SUCH_LINE;
+    }
+    /* Continue reading from the first DATA statement in this line or after it */
+    bs->data_ptr = prog_storage_get_line_parse_ptr(&bs->prog, fr.idx);
+    bs->data_line = line;
+    bs->data_entry = prog_storage_find_data(&bs->prog, line);
     return BASIC_ERROR_OK;
 }
 
@@ -591,12 +729,16 @@ static enum BASIC_ERROR_ID handler_gosub(BASIC_MAIN_STATE* bs)
         return BASIC_ERROR_IN_PROGRAM_ONLY;
     }
     /* A line number argument is required */
-    unsigned line = 0;
-    BASIC_PARSING_RESULT pr = basic_parsing_uint16(&bs->parse_ptr, &line);
-    if(pr != BASIC_ERROR_OK)
+    unsigned line_idx;
+    BASIC_PARSING_RESULT pr = parse_jump_target(bs, true, &line_idx);
+    if(pr == BASIC_PARSING_NOT_FOUND)
     {
         return BASIC_ERROR_SYNTAX;
     }
+    else if(pr != BASIC_ERROR_OK)
+    {
+        return pr;
+    }
     /* Push the current line number and parse pointer onto the GOSUB stack,
      * so that we can return to it later */
     FGS_ENTRY_GOSUB eg =
@@ -608,7 +750,8 @@ static enum BASIC_ERROR_ID handler_gosub(BASIC_MAIN_STATE* bs)
     {
         return BASIC_ERROR_OUT_OF_MEMORY;
     }
-    return goto_run_common(bs, line, true);
+    goto_line_idx(bs, line_idx);
+    return BASIC_ERROR_OK;
 }
 
 static enum BASIC_ERROR_ID handler_return(BASIC_MAIN_STATE* bs)
@@ -681,7 +824,8 @@ static enum BASIC_ERROR_ID handler_print(BASIC_MAIN_STATE* bs)
         {
             /* An expression is allowed as a TAB argument */
             unsigned tab = 0;
-            BASIC_PARSING_RESULT pr = basic_parsing_arrayindex(&bs->parse_ptr, &tab, &bs->prog);
+            unsigned count = 1;
+            BASIC_PARSING_RESULT pr = basic_parsing_arrayindex(&bs->parse_ptr, &tab, &count, &bs->prog);
             if(pr == BASIC_PARSING_NOT_FOUND)
             {
                 return BASIC_ERROR_SYNTAX;
@@ -716,8 +860,8 @@ static enum BASIC_ERROR_ID handler_print(BASIC_MAIN_STATE* bs)
         {
             /* If nothing else, an expression is expected */
             const unsigned char* p = bs->parse_ptr;
-            float val = 0.0f;
-            BASIC_PARSING_RESULT pr = basic_parsing_expression(&p, &val, &bs->prog);
+            BASIC_VALUE val;
+            BASIC_PARSING_RESULT pr = basic_parsing_value(&p, &val, &bs->prog);
             if(pr == BASIC_PARSING_NOT_FOUND)
             {
                 return BASIC_ERROR_SYNTAX;
@@ -727,7 +871,10 @@ static enum BASIC_ERROR_ID handler_print(BASIC_MAIN_STATE* bs)
                 return pr;
             }
             /* Print the value out and a trailing space, as in the base version */
-            basic_printf("%G ", val);
+            if(!basic_value_print(val))
+            {
+                return BASIC_ERROR_OVERFLOW;
+            }
             bs->parse_ptr = p;
         }
 
@@ -768,32 +915,276 @@ static enum BASIC_ERROR_ID handler_clear(BASIC_MAIN_STATE* bs)
     return BASIC_ERROR_OK;
 }
 
+static enum BASIC_ERROR_ID handler_save(BASIC_MAIN_STATE* bs)
+{
+    /* Verify that no parameters follow */
+    unsigned char c = *bs->parse_ptr;
+    if(c && c != ':')
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+
+    if(bs->prog.rom)
+    {
+        /* The image is made of the program in RAM. Copying the program
+         * from ROM moves all lines, so it can't be done in a running program */
+        if(bs->current_line != UINT_MAX)
+        {
+            return BASIC_ERROR_DIRECT_ONLY;
+        }
+        variable_storage_clear(&bs->prog);
+        fgstack_clear(&bs->prog);
+        invalidate_code(bs);
+        if(!prog_storage_detach_rom(&bs->prog))
+        {
+            return BASIC_ERROR_OUT_OF_MEMORY;
+        }
+        restore0(bs);
+    }
+
+    unsigned char header[PROG_STORAGE_IMAGE_HEADER_SIZE];
+    unsigned size = prog_storage_image_header(&bs->prog, header);
+    if(!basic_callback_save_image(header, sizeof(header), bs->prog.base, size))
+    {
+        return BASIC_ERROR_IO;
+    }
+    return BASIC_ERROR_OK;
+}
+
+static enum BASIC_ERROR_ID handler_load(BASIC_MAIN_STATE* bs)
+{
+    /* Verify that no parameters follow */
+    unsigned char c = *bs->parse_ptr;
+    if(c && c != ':')
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+
+    unsigned size;
+    const void* image = basic_callback_load_image(&size);
+    if(!image)
+    {
+        return BASIC_ERROR_IO;
+    }
+    return basic_main_load_image(bs, image, size);
+}
+
+/* Parse a single letter of DEFINT */
+static bool parse_defint_letter(const unsigned char** pp, unsigned* out)
+{
+    var_name_packed vn;
+    if(basic_parsing_varname(pp, &vn) != BASIC_ERROR_OK || vn >= VAR_NAME_INTEGER)
+    {
+        return false;
+    }
+    *out = var_name_letter_index(vn);
+    return true;
+}
+
+/* DEFINT declares the scalar variables that begin with the given letters, or ranges
+ * of letters, integer. Like the variables, the declarations are cleared by RUN, CLEAR, and NEW */
+static enum BASIC_ERROR_ID handler_defint(BASIC_MAIN_STATE* bs)
+{
+    const unsigned char* p = bs->parse_ptr;
+    uint64_t letters = 0;
+    do
+    {
+        unsigned first, last;
+        if(!parse_defint_letter(&p, &first))
+        {
+            return BASIC_ERROR_SYNTAX;
+        }
+        last = first;
+        if(*p == BASIC_KEYWORD_MINUS)
+        {
+            p = basic_parsing_skipws(p + 1);
+            if(!parse_defint_letter(&p, &last) || last < first)
+            {
+                return BASIC_ERROR_SYNTAX;
+            }
+        }
+        for(unsigned i = first; i <= last; i++)
+        {
+            letters |= (uint64_t)1 << i;
+        }
+        if(*p != ',')
+        {
+            break;
+        }
+        /* Another letter follows */
+        p = basic_parsing_skipws(p + 1);
+    } while(true);
+    bs->prog.int_letters |= letters;
+    bs->parse_ptr = p;
+    return BASIC_ERROR_OK;
+}
+
+#if BASIC_CONFIG_MAT
+static enum BASIC_ERROR_ID handler_mat(BASIC_MAIN_STATE* bs)
+{
+    return basic_matrix_statement(&bs->parse_ptr, &bs->prog);
+}
+
+#define STATEMENTS_INSTANTIATE_MAT(X) X(MAT, handler_mat)
+#else
+#define STATEMENTS_INSTANTIATE_MAT(X)
+#endif
+
+#define STATEMENTS_INSTANTIATE(X) \
+    X(END, handler_end) \
+    X(FOR, handler_for) \
+    X(NEXT, handler_next) \
+    X(DATA, handler_data) \
+    X(INPUT, handler_input) \
+    X(DIM, handler_dim) \
+    X(READ, handler_read) \
+    X(LET, handler_let) \
+    X(GOTO, handler_goto) \
+    X(RUN, handler_run) \
+    X(IF, handler_if) \
+    X(RESTORE, handler_restore) \
+    X(GOSUB, handler_gosub) \
+    X(RETURN, handler_return) \
+    X(REM, handler_rem) \
+    X(STOP, handler_stop) \
+    X(PRINT, handler_print) \
+    X(LIST, handler_list) \
+    X(CLEAR, handler_clear) \
+    X(NEW, handler_new) \
+    X(SAVE, handler_save) \
+    X(LOAD, handler_load) \
+    STATEMENTS_INSTANTIATE_MAT(X) \
+    X(DEFINT, handler_defint)
+
+/* These statements cause a silent program termination */
+#define STATEMENT_TERMINATES(ID) \
+    (BASIC_KEYWORD_##ID == BASIC_KEYWORD_END || BASIC_KEYWORD_##ID == BASIC_KEYWORD_NEW || \
+    BASIC_KEYWORD_##ID == BASIC_KEYWORD_LOAD)
+
+#if BASIC_CONFIG_THREADED_DISPATCH
+
+/* Fetch the statement at the parse pointer and jump to it. Every statement
+ * has its own copy, so that the indirect jumps are predicted separately */
+#define DISPATCH_STATEMENT() \
+    do \
+    { \
+        c = *bs->parse_ptr; \
+        if(!c) \
+        { \
+            goto end_of_line; \
+        } \
+        bs->error_in_data = false; /* Error messages are associated with parse line, not DATA line by default */ \
+        if(basic_callback_check_break_key()) \
+        { \
+            /* Stop if the break key is pressed */ \
+            return BASIC_ERROR_STOP; \
+        } \
+        if(c < BASIC_KEYWORD_RANGE_BEGIN || c == BASIC_TOKEN_VARREF) \
+        { \
+            /* Must be a LET statement with the LET keyword omitted */ \
+            goto statement_LET; \
+        } \
+        if(c > BASIC_KEYWORD_RANGE_END || !statement_targets[c - BASIC_KEYWORD_RANGE_BEGIN]) \
+        { \
+            /* Only general keywords are allowed at the first position */ \
+            return BASIC_ERROR_SYNTAX; \
+        } \
+        /* Skip over the keyword and any white space that may precede parameters or end-statement */ \
+        bs->parse_ptr = basic_parsing_skipws(bs->parse_ptr + 1); \
+        /* The computed goto is a GCC extension, which -pedantic would warn about */ \
+        _Pragma("GCC diagnostic push") \
+        _Pragma("GCC diagnostic ignored \"-Wpedantic\"") \
+        goto *statement_targets[c - BASIC_KEYWORD_RANGE_BEGIN]; \
+        _Pragma("GCC diagnostic pop") \
+    } while(0)
+
+#define STATEMENT_TARGET(ID, HANDLER) [BASIC_KEYWORD_##ID - BASIC_KEYWORD_RANGE_BEGIN] = __extension__ &&statement_##ID,
+
+/* Special handling for IF to not require a statement separator
+ * in case that the IF condition is true */
+#define STATEMENT_BODY(ID, HANDLER) \
+    statement_##ID: \
+        eid = HANDLER(bs); \
+        if(eid != BASIC_ERROR_OK || STATEMENT_TERMINATES(ID)) \
+        { \
+            return eid; \
+        } \
+        c = *bs->parse_ptr; \
+        if(c) \
+        { \
+            if(BASIC_KEYWORD_##ID != BASIC_KEYWORD_IF) \
+            { \
+                if(c != ':') \
+                { \
+                    /* Statement separator is expected here */ \
+                    return BASIC_ERROR_SYNTAX; \
+                } \
+                bs->parse_ptr++; /* Skip the ':' separator */ \
+            } \
+            /* Also skip whitespace that may precede the next statement */ \
+            bs->parse_ptr = basic_parsing_skipws(bs->parse_ptr); \
+        } \
+        DISPATCH_STATEMENT();
+
+static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
+{
+    static const void* const statement_targets[BASIC_KEYWORD_RANGE_END - BASIC_KEYWORD_RANGE_BEGIN + 1] =
+    {
+        STATEMENTS_INSTANTIATE(STATEMENT_TARGET)
+    };
+    enum BASIC_ERROR_ID eid;
+    unsigned char c;
+    /* Whitespace must be already skipped in either direct mode or on line entry */
+    DISPATCH_STATEMENT();
+
+    STATEMENTS_INSTANTIATE(STATEMENT_BODY)
+
+end_of_line:
+    if(bs->current_line == UINT_MAX)
+    {
+        /* Reached the end of the line in direct mode */
+        return BASIC_ERROR_OK;
+    }
+    /* If we are running the program, advance to the next program line */
+    bs->parse_ptr = prog_storage_advance_line(&bs->prog, bs->parse_ptr, &bs->current_line);
+#if BASIC_CONFIG_VM
+    if(bs->current_line != UINT_MAX && bs->vm.compiled)
+    {
+        /* Run the compiled code from this line on, until it hands
+         * a statement over to be interpreted */
+        bool handoff;
+        eid = basic_vm_run(bs, &handoff);
+        if(eid != BASIC_ERROR_OK || !handoff)
+        {
+            return eid;
+        }
+    }
+#endif
+    if(bs->current_line == UINT_MAX)
+    {
+        /* Reached the end of the program */
+        return BASIC_ERROR_OK;
+    }
+    DISPATCH_STATEMENT();
+}
+
+#undef STATEMENT_BODY
+#undef STATEMENT_TARGET
+#undef DISPATCH_STATEMENT
+
+#else
+
 typedef enum BASIC_ERROR_ID (*command_handler_fcn_t)(BASIC_MAIN_STATE* bs);
 
-static command_handler_fcn_t cmd_handlers[KEYWORD_RANGE_OFFSET(GENERAL, RANGE_END_GENERAL)+1] =
-{
-    [KEYWORD_RANGE_OFFSET(GENERAL, END)    ] = handler_end,
-    [KEYWORD_RANGE_OFFSET(GENERAL, FOR)    ] = handler_for,
-    [KEYWORD_RANGE_OFFSET(GENERAL, NEXT)   ] = handler_next,
-    [KEYWORD_RANGE_OFFSET(GENERAL, DATA)   ] = handler_data,
-    [KEYWORD_RANGE_OFFSET(GENERAL, INPUT)  ] = handler_input,
-    [KEYWORD_RANGE_OFFSET(GENERAL, DIM)    ] = handler_dim,
-    [KEYWORD_RANGE_OFFSET(GENERAL, READ)   ] = handler_read,
-    [KEYWORD_RANGE_OFFSET(GENERAL, LET)    ] = handler_let,
-    [KEYWORD_RANGE_OFFSET(GENERAL, GOTO)   ] = handler_goto,
-    [KEYWORD_RANGE_OFFSET(GENERAL, RUN)    ] = handler_run,
-    [KEYWORD_RANGE_OFFSET(GENERAL, IF)     ] = handler_if,
-    [KEYWORD_RANGE_OFFSET(GENERAL, RESTORE)] = handler_restore,
-    [KEYWORD_RANGE_OFFSET(GENERAL, GOSUB)  ] = handler_gosub,
-    [KEYWORD_RANGE_OFFSET(GENERAL, RETURN) ] = handler_return,
-    [KEYWORD_RANGE_OFFSET(GENERAL, REM)    ] = handler_rem,
-    [KEYWORD_RANGE_OFFSET(GENERAL, STOP)   ] = handler_stop,
-    [KEYWORD_RANGE_OFFSET(GENERAL, PRINT)  ] = handler_print,
-    [KEYWORD_RANGE_OFFSET(GENERAL, LIST)   ] = handler_list,
-    [KEYWORD_RANGE_OFFSET(GENERAL, CLEAR)  ] = handler_clear,
-    [KEYWORD_RANGE_OFFSET(GENERAL, NEW)    ] = handler_new
+#define STATEMENT_HANDLER(ID, HANDLER) [BASIC_KEYWORD_##ID - BASIC_KEYWORD_RANGE_BEGIN] = HANDLER,
+
+static const command_handler_fcn_t cmd_handlers[BASIC_KEYWORD_RANGE_END - BASIC_KEYWORD_RANGE_BEGIN + 1] =
+{
+    STATEMENTS_INSTANTIATE(STATEMENT_HANDLER)
 };
 
+#undef STATEMENT_HANDLER
+
 static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
 {
     /* Whitespace must be already skipped in either direct mode or on line entry */
@@ -810,12 +1201,18 @@ static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
                 /* Stop if the break key is pressed */
                 return BASIC_ERROR_STOP;
             }
-            if(c > BASIC_KEYWORD_RANGE_END_GENERAL)
+            if(c == BASIC_TOKEN_VARREF)
+            {
+                /* A LET statement starting with a variable reference */
+                c = BASIC_KEYWORD_LET;
+            }
+            else if(c > BASIC_KEYWORD_RANGE_END_GENERAL &&
+                    (c < BASIC_KEYWORD_RANGE_BEGIN_GENERAL_EXT || c > BASIC_KEYWORD_RANGE_END_GENERAL_EXT))
             {
                 /* Only general keywords are allowed at the first position */
                 return BASIC_ERROR_SYNTAX;
             }
-            if(c >= BASIC_KEYWORD_RANGE_BEGIN)
+            else if(c >= BASIC_KEYWORD_RANGE_BEGIN)
             {
                 /* Skip over the keyword and prepare to call its handler */
                 bs->parse_ptr++;
@@ -828,7 +1225,7 @@ static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
 
             /* Skip any white space that may precede parameters or end-statement */
             bs->parse_ptr = basic_parsing_skipws(bs->parse_ptr);
-            command_handler_fcn_t handler = cmd_handlers[c - BASIC_KEYWORD_RANGE_BEGIN_GENERAL];
+            command_handler_fcn_t handler = cmd_handlers[c - BASIC_KEYWORD_RANGE_BEGIN];
             if(handler)
             {
                 enum BASIC_ERROR_ID eid = handler(bs);
@@ -836,15 +1233,16 @@ static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
                 {
                     return eid;
                 }
-                if(c == BASIC_KEYWORD_END || c == BASIC_KEYWORD_NEW)
+                if(c == BASIC_KEYWORD_END || c == BASIC_KEYWORD_NEW || c == BASIC_KEYWORD_LOAD)
                 {
-                    /* These two statements cause a silent program termination */
+                    /* These statements cause a silent program termination */
                     return BASIC_ERROR_OK;
                 }
             }
             else
             {
-                return BASIC_ERROR_INTERNAL;
+                /* A statement that is left out of this build */
+                return BASIC_ERROR_SYNTAX;
             }
             /* Special handling for IF to not require a statement separator
              * in case that the IF condition is true */
@@ -871,11 +1269,26 @@ static enum BASIC_ERROR_ID exec_line(BASIC_MAIN_STATE* bs)
         {
             /* If we are running the program, advance to the next program line */
             bs->parse_ptr = prog_storage_advance_line(&bs->prog, bs->parse_ptr, &bs->current_line);
+#if BASIC_CONFIG_VM
+            if(bs->current_line != UINT_MAX && bs->vm.compiled)
+            {
+                /* Run the compiled code from this line on, until it hands
+                 * a statement over to be interpreted */
+                bool handoff;
+                enum BASIC_ERROR_ID eid = basic_vm_run(bs, &handoff);
+                if(eid != BASIC_ERROR_OK || !handoff)
+                {
+                    return eid;
+                }
+            }
+#endif
         }
     } while(bs->current_line != UINT_MAX);
     return BASIC_ERROR_OK; /* Reached the end of line or program */
 }
 
+#endif /* BASIC_CONFIG_THREADED_DISPATCH */
+
 bool basic_main_process_line(BASIC_MAIN_STATE* bs, char* str)
 {
     bs->error_in_data = false; /* Error messages are associated with parse line, not DATA line by default */
@@ -889,12 +1302,12 @@ bool basic_main_process_line(BASIC_MAIN_STATE* bs, char* str)
         return false;
     }
     /* Tokenize the input */
-    keywords_tokenize_line((char*)bs->parse_ptr);
+    bool valid = keywords_tokenize_line((char*)bs->parse_ptr);
 
     /* See if the input begins with a number */
     unsigned line;
     BASIC_PARSING_RESULT pr = basic_parsing_uint16(&bs->parse_ptr, &line);
-    if(pr == BASIC_ERROR_SYNTAX)
+    if(pr == BASIC_ERROR_SYNTAX || !valid)
     {
         basic_error_print(BASIC_ERROR_SYNTAX, UINT_MAX);
         return true;
@@ -908,6 +1321,7 @@ bool basic_main_process_line(BASIC_MAIN_STATE* bs, char* str)
         fgstack_clear(&bs->prog);
 
         /* Add/update a program line */
+        invalidate_code(bs);
         if(!prog_storage_store_line(&bs->prog, line, (const char*)bs->parse_ptr))
         {
             basic_error_print(BASIC_ERROR_OUT_OF_MEMORY, UINT_MAX);
@@ -929,6 +1343,92 @@ bool basic_main_process_line(BASIC_MAIN_STATE* bs, char* str)
     return true;
 }
 
+enum BASIC_ERROR_ID basic_main_load_program(BASIC_MAIN_STATE* bs, const char* text, unsigned len)
+{
+    /* Drop all variables and reset the FOR/GOSUB stack once for the whole program */
+    variable_storage_clear(&bs->prog);
+    fgstack_clear(&bs->prog);
+    invalidate_code(bs);
+
+    enum BASIC_ERROR_ID eid = BASIC_ERROR_OK;
+    const char* const text_end = text + len;
+    while(text < text_end && eid == BASIC_ERROR_OK)
+    {
+        /* Find the end of the current line */
+        const char* eol = memchr(text, '\n', text_end - text);
+        if(!eol)
+        {
+            eol = text_end;
+        }
+        unsigned line_len = eol - text;
+        if(line_len && text[line_len-1] == '\r')
+        {
+            line_len--;
+        }
+        /* Copy the line to the top of the free memory for in-place tokenization.
+         * The copy is pushed on the (empty) stack, so that storing the line
+         * cannot overwrite it */
+        basic_mem_idx_t save_stack_idx = fgstack_get_top(&bs->prog);
+        if(!fgstack_check_space(&bs->prog, line_len + 1))
+        {
+            eid = BASIC_ERROR_OUT_OF_MEMORY;
+            break;
+        }
+        fgstack_push_expression_byte_nocheck(&bs->prog, '\0');
+        fgstack_push_expression(&bs->prog, text, line_len);
+        const unsigned char* p = bs->prog.base + bs->prog.stktop_idx;
+        p = basic_parsing_skipws(p);
+        if(*p)
+        {
+            bool valid = keywords_tokenize_line((char*)p);
+            unsigned line;
+            if(basic_parsing_uint16(&p, &line) != BASIC_ERROR_OK || !valid)
+            {
+                /* Only numbered program lines are allowed */
+                eid = BASIC_ERROR_SYNTAX;
+            }
+            else if(!prog_storage_store_line(&bs->prog, line, (const char*)p))
+            {
+                eid = BASIC_ERROR_OUT_OF_MEMORY;
+            }
+        }
+        fgstack_set_top(&bs->prog, save_stack_idx);
+        text = eol + 1;
+    }
+
+    /* Reset the DATA pointer */
+    restore0(bs);
+    return eid;
+}
+
+enum BASIC_ERROR_ID basic_main_load_image(BASIC_MAIN_STATE* bs, const void* image, unsigned size)
+{
+    /* Drop all variables and reset the FOR/GOSUB stack */
+    variable_storage_clear(&bs->prog);
+    fgstack_clear(&bs->prog);
+    invalidate_code(bs);
+
+    enum BASIC_ERROR_ID eid = prog_storage_load_image(&bs->prog, image, size);
+
+    /* Reset the DATA pointer */
+    restore0(bs);
+    return eid;
+}
+
+enum BASIC_ERROR_ID basic_main_attach_image(BASIC_MAIN_STATE* bs, const void* image, unsigned size)
+{
+    /* Drop all variables and reset the FOR/GOSUB stack */
+    variable_storage_clear(&bs->prog);
+    fgstack_clear(&bs->prog);
+    invalidate_code(bs);
+
+    enum BASIC_ERROR_ID eid = prog_storage_attach_image(&bs->prog, image, size);
+
+    /* Reset the DATA pointer */
+    restore0(bs);
+    return eid;
+}
+
 void basic_main_interactive_prompt(BASIC_MAIN_STATE* bs)
 {
     bool print_ok = true;
@@ -950,4 +1450,27 @@ void basic_main_initialize(BASIC_MAIN_STATE* bs, void* prog_base, unsigned prog_
 {
     prog_storage_initialize(&bs->prog, prog_base, prog_size);
     restore0(bs);
+    basic_main_set_vm_buffer(bs, NULL, 0);
+}
+
+void basic_main_set_expr_cache(BASIC_MAIN_STATE* bs, void* buf, unsigned size)
+{
+#if BASIC_CONFIG_VM
+    basic_vm_expr_cache_initialize(&bs->prog.expr_cache, buf, size);
+#else
+    (void)bs;
+    (void)buf;
+    (void)size;
+#endif
+}
+
+void basic_main_set_vm_buffer(BASIC_MAIN_STATE* bs, void* buf, unsigned size)
+{
+#if BASIC_CONFIG_VM
+    basic_vm_initialize(&bs->vm, buf, size);
+#else
+    (void)bs;
+    (void)buf;
+    (void)size;
+#endif
 }
@@ -0,0 +1,749 @@
+/*
+ * basic_matrix.c
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "basic_matrix.h"
+
+#if BASIC_CONFIG_MAT
+
+#include "basic_parsing.h"
+#include "keywords.h"
+#include <string.h>
+
+/* Vector operations for the kernels, on single-precision values only. The loads and stores
+ * accept unaligned addresses on x86. ARM vector loads need aligned elements, which only
+ * the aligned value storage guarantees */
+#if BASIC_CONFIG_NUMBER != BASIC_NUMBER_FLOAT
+/* The portable loops do all the work */
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define MAT_VECTOR 8
+typedef __m256 mat_vector_t;
+#define mat_load(p) _mm256_loadu_ps(p)
+#define mat_store(p, v) _mm256_storeu_ps(p, v)
+#define mat_add(a, b) _mm256_add_ps(a, b)
+#define mat_sub(a, b) _mm256_sub_ps(a, b)
+#define mat_mul(a, b) _mm256_mul_ps(a, b)
+#define mat_dup(k) _mm256_set1_ps(k)
+#define mat_min(a, b) _mm256_min_ps(a, b)
+#define mat_max(a, b) _mm256_max_ps(a, b)
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define MAT_VECTOR 4
+typedef __m128 mat_vector_t;
+#define mat_load(p) _mm_loadu_ps(p)
+#define mat_store(p, v) _mm_storeu_ps(p, v)
+#define mat_add(a, b) _mm_add_ps(a, b)
+#define mat_sub(a, b) _mm_sub_ps(a, b)
+#define mat_mul(a, b) _mm_mul_ps(a, b)
+#define mat_dup(k) _mm_set1_ps(k)
+#define mat_min(a, b) _mm_min_ps(a, b)
+#define mat_max(a, b) _mm_max_ps(a, b)
+#elif BASIC_CONFIG_ALIGNED_VALUES && (defined(__ARM_NEON) || (defined(__ARM_FEATURE_MVE) && (__ARM_FEATURE_MVE & 2)))
+/* NEON and Helium share the names of these intrinsics */
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#else
+#include <arm_mve.h>
+#endif
+#define MAT_VECTOR 4
+typedef float32x4_t mat_vector_t;
+#define mat_load(p) vld1q_f32(p)
+#define mat_store(p, v) vst1q_f32(p, v)
+#define mat_add(a, b) vaddq_f32(a, b)
+#define mat_sub(a, b) vsubq_f32(a, b)
+#define mat_mul(a, b) vmulq_f32(a, b)
+#define mat_dup(k) vdupq_n_f32(k)
+#define mat_min(a, b) vminq_f32(a, b)
+#define mat_max(a, b) vmaxq_f32(a, b)
+#endif
+
+/* The vector loops leave the remaining elements to the portable loops that follow them */
+void basic_matrix_add(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n)
+{
+    unsigned i = 0;
+#ifdef MAT_VECTOR
+    for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+    {
+        mat_store((float*)(d + i), mat_add(mat_load((const float*)(a + i)), mat_load((const float*)(b + i))));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        d[i].f = basic_number_add(flags, a[i].f, b[i].f);
+    }
+}
+
+void basic_matrix_subtract(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n)
+{
+    unsigned i = 0;
+#ifdef MAT_VECTOR
+    for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+    {
+        mat_store((float*)(d + i), mat_sub(mat_load((const float*)(a + i)), mat_load((const float*)(b + i))));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        d[i].f = basic_number_sub(flags, a[i].f, b[i].f);
+    }
+}
+
+void basic_matrix_scale(basic_number_flags_t* flags, VARIABLE_VALUE* d, basic_number_t k, const VARIABLE_VALUE* a, unsigned n)
+{
+    unsigned i = 0;
+#ifdef MAT_VECTOR
+    mat_vector_t vk = mat_dup(k);
+    for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+    {
+        mat_store((float*)(d + i), mat_mul(vk, mat_load((const float*)(a + i))));
+    }
+#endif
+    for(; i < n; i++)
+    {
+        d[i].f = basic_number_mul(flags, k, a[i].f);
+    }
+}
+
+void basic_matrix_fill(VARIABLE_VALUE* d, basic_number_t v, unsigned n)
+{
+    unsigned i = 0;
+#ifdef MAT_VECTOR
+    mat_vector_t vv = mat_dup(v);
+    for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+    {
+        mat_store((float*)(d + i), vv);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        d[i].f = v;
+    }
+}
+
+/* Each row of the product accumulates the rows of b scaled by the elements of a row of a,
+ * so that the inner loop runs along contiguous rows */
+void basic_matrix_multiply(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a,
+        const VARIABLE_VALUE* b, unsigned rows, unsigned inner, unsigned cols)
+{
+    for(unsigned r = 0; r < rows; r++)
+    {
+        VARIABLE_VALUE* dr = d + r*cols;
+        basic_matrix_fill(dr, 0, cols);
+        for(unsigned k = 0; k < inner; k++)
+        {
+            basic_number_t s = a[r*inner + k].f;
+            const VARIABLE_VALUE* br = b + k*cols;
+            unsigned i = 0;
+#ifdef MAT_VECTOR
+            mat_vector_t vs = mat_dup(s);
+            for(; i + MAT_VECTOR <= cols; i += MAT_VECTOR)
+            {
+                mat_store((float*)(dr + i), mat_add(mat_load((const float*)(dr + i)), mat_mul(vs, mat_load((const float*)(br + i)))));
+            }
+#endif
+            for(; i < cols; i++)
+            {
+                dr[i].f = basic_number_add(flags, dr[i].f, basic_number_mul(flags, s, br[i].f));
+            }
+        }
+    }
+}
+
+void basic_matrix_transpose(VARIABLE_VALUE* d, const VARIABLE_VALUE* a, unsigned rows, unsigned cols)
+{
+    for(unsigned r = 0; r < rows; r++)
+    {
+        for(unsigned c = 0; c < cols; c++)
+        {
+            d[c*rows + r] = a[r*cols + c];
+        }
+    }
+}
+
+#ifdef MAT_VECTOR
+/* Add up the lanes of a vector */
+static float mat_lanes_sum(mat_vector_t v)
+{
+    float lanes[MAT_VECTOR];
+    mat_store(lanes, v);
+    float s = 0.0f;
+    for(unsigned i = 0; i < MAT_VECTOR; i++)
+    {
+        s += lanes[i];
+    }
+    return s;
+}
+#endif
+
+/* The vector loops add up the elements in a different order than a FOR loop,
+ * so that the last bits of the result may differ from it */
+basic_number_t basic_matrix_sum(basic_number_flags_t* flags, const VARIABLE_VALUE* a, unsigned n)
+{
+    unsigned i = 0;
+    basic_number_t s = 0;
+#ifdef MAT_VECTOR
+    if(n >= MAT_VECTOR)
+    {
+        mat_vector_t vs = mat_dup(0.0f);
+        for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+        {
+            vs = mat_add(vs, mat_load((const float*)(a + i)));
+        }
+        s = mat_lanes_sum(vs);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        s = basic_number_add(flags, s, a[i].f);
+    }
+    return s;
+}
+
+basic_number_t basic_matrix_dot(basic_number_flags_t* flags, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n)
+{
+    unsigned i = 0;
+    basic_number_t s = 0;
+#ifdef MAT_VECTOR
+    if(n >= MAT_VECTOR)
+    {
+        mat_vector_t vs = mat_dup(0.0f);
+        for(; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+        {
+            vs = mat_add(vs, mat_mul(mat_load((const float*)(a + i)), mat_load((const float*)(b + i))));
+        }
+        s = mat_lanes_sum(vs);
+    }
+#endif
+    for(; i < n; i++)
+    {
+        s = basic_number_add(flags, s, basic_number_mul(flags, a[i].f, b[i].f));
+    }
+    return s;
+}
+
+basic_number_t basic_matrix_extreme(const VARIABLE_VALUE* a, unsigned n, bool max)
+{
+    unsigned i = 1;
+    basic_number_t e = a[0].f;
+#ifdef MAT_VECTOR
+    if(n >= MAT_VECTOR)
+    {
+        mat_vector_t ve = mat_load((const float*)a);
+        for(i = MAT_VECTOR; i + MAT_VECTOR <= n; i += MAT_VECTOR)
+        {
+            mat_vector_t v = mat_load((const float*)(a + i));
+            ve = max ? mat_max(ve, v) : mat_min(ve, v);
+        }
+        float lanes[MAT_VECTOR];
+        mat_store(lanes, ve);
+        e = lanes[0];
+        for(unsigned l = 1; l < MAT_VECTOR; l++)
+        {
+            if(max ? lanes[l] > e : lanes[l] < e)
+            {
+                e = lanes[l];
+            }
+        }
+    }
+#endif
+    for(; i < n; i++)
+    {
+        if(max ? a[i].f > e : a[i].f < e)
+        {
+            e = a[i].f;
+        }
+    }
+    return e;
+}
+
+static bool same_shape(const VARIABLE_ARRAY* a, const VARIABLE_ARRAY* b)
+{
+    return a->ndims == b->ndims && !memcmp(a->extent, b->extent, a->ndims * sizeof(a->extent[0]));
+}
+
+/* Parse the name of an existing array operand */
+static enum BASIC_ERROR_ID parse_operand(const unsigned char** pp, var_name_packed* pvn, VARIABLE_ARRAY* pa, BASIC_MEM_MGR* mem)
+{
+    if(basic_parsing_array_name(pp, pvn) != BASIC_ERROR_OK)
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    if(!variable_storage_get_array(mem, *pvn, pa))
+    {
+        /* Operands are never dimensioned by default */
+        return BASIC_ERROR_SUBSCRIPT;
+    }
+    return BASIC_ERROR_OK;
+}
+
+static unsigned element_count(const VARIABLE_ARRAY* a)
+{
+    unsigned n = 1;
+    for(unsigned d = 0; d < a->ndims; d++)
+    {
+        n *= a->extent[d];
+    }
+    return n;
+}
+
+enum BASIC_ERROR_ID basic_matrix_parse_reduction(const unsigned char** parse_ptr, var_name_packed names[2])
+{
+    const unsigned char* p = *parse_ptr;
+    bool dot = *p == BASIC_KEYWORD_DOT;
+    p = basic_parsing_skipws(p + 1);
+    if(*p != '(')
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    p = basic_parsing_skipws(p + 1);
+    names[1] = 0;
+    if(basic_parsing_array_name(&p, &names[0]) != BASIC_ERROR_OK)
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    if(dot)
+    {
+        if(*p != ',')
+        {
+            return BASIC_ERROR_SYNTAX;
+        }
+        p = basic_parsing_skipws(p + 1);
+        if(basic_parsing_array_name(&p, &names[1]) != BASIC_ERROR_OK)
+        {
+            return BASIC_ERROR_SYNTAX;
+        }
+    }
+    *parse_ptr = basic_parsing_skipws(p);
+    return BASIC_ERROR_OK;
+}
+
+/* Arrays declared with DIM ... AS hold integer elements, which are processed one by one
+ * in the arithmetic of BASIC values. The native kernels only handle number arrays */
+static BASIC_VALUE element_value(const VARIABLE_ARRAY* a, unsigned i)
+{
+    return variable_storage_value(variable_element(a->data, a->type, i), a->type);
+}
+
+static enum BASIC_ERROR_ID reduce_typed(basic_number_flags_t* flags, unsigned char fn, const VARIABLE_ARRAY* a, const VARIABLE_ARRAY* b,
+        unsigned start, unsigned n, basic_number_t* out)
+{
+    BASIC_VALUE acc = fn == BASIC_KEYWORD_MIN || fn == BASIC_KEYWORD_MAX ? element_value(a, start) : basic_value_int(0);
+    for(unsigned i = start; i < start + n; i++)
+    {
+        BASIC_VALUE x = element_value(a, i);
+        switch(fn)
+        {
+        case BASIC_KEYWORD_SUM:
+        case BASIC_KEYWORD_MEAN:
+            acc = basic_value_add(flags, acc, x);
+            break;
+        case BASIC_KEYWORD_MIN:
+            if(basic_value_compare(x, acc) & BASIC_VALUE_LESS)
+            {
+                acc = x;
+            }
+            break;
+        case BASIC_KEYWORD_MAX:
+            if(basic_value_compare(x, acc) & BASIC_VALUE_GREATER)
+            {
+                acc = x;
+            }
+            break;
+        case BASIC_KEYWORD_DOT:
+            acc = basic_value_add(flags, acc, basic_value_mul(flags, x, element_value(b, i)));
+            break;
+        }
+    }
+    if(!basic_value_to_number_checked(acc, out))
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    if(fn == BASIC_KEYWORD_MEAN)
+    {
+        *out = basic_number_div_uint(flags, *out, n);
+    }
+    return basic_number_error(flags);
+}
+
+/* The elements are counted in the row-major storage order, from 0 */
+enum BASIC_ERROR_ID basic_matrix_reduce(BASIC_MEM_MGR* mem, unsigned char fn, const var_name_packed names[2],
+        const BASIC_VALUE* args, unsigned nargs, basic_number_t* out)
+{
+    VARIABLE_ARRAY a, b;
+    if(!variable_storage_get_array(mem, names[0], &a))
+    {
+        /* Reductions do not dimension the arrays by default */
+        return BASIC_ERROR_SUBSCRIPT;
+    }
+    unsigned n = element_count(&a);
+    if(fn == BASIC_KEYWORD_DOT)
+    {
+        if(!variable_storage_get_array(mem, names[1], &b))
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        unsigned nb = element_count(&b);
+        if(!nargs && nb != n)
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        if(nb < n)
+        {
+            n = nb;
+        }
+    }
+    unsigned start = 0;
+    for(unsigned i = 0; i < nargs; i++)
+    {
+        unsigned k;
+        if(basic_value_compare(args[i], basic_value_int(0)) & BASIC_VALUE_LESS)
+        {
+            return BASIC_ERROR_PARAMETER;
+        }
+        if(!basic_value_to_index(args[i], n, &k))
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        if(i == 0)
+        {
+            start = k;
+            n -= start;
+        }
+        else
+        {
+            n = k;
+        }
+    }
+    if(!n && (fn == BASIC_KEYWORD_MIN || fn == BASIC_KEYWORD_MAX))
+    {
+        return BASIC_ERROR_PARAMETER;
+    }
+
+    basic_number_flags_t* const flags = &mem->number_flags;
+    basic_number_clear_errors(flags);
+    if(a.type != VARIABLE_TYPE_NUMBER || (fn == BASIC_KEYWORD_DOT && b.type != VARIABLE_TYPE_NUMBER))
+    {
+        return reduce_typed(flags, fn, &a, &b, start, n, out);
+    }
+    switch(fn)
+    {
+    case BASIC_KEYWORD_SUM:
+        *out = basic_matrix_sum(flags, a.data + start, n);
+        break;
+    case BASIC_KEYWORD_MIN:
+    case BASIC_KEYWORD_MAX:
+        *out = basic_matrix_extreme(a.data + start, n, fn == BASIC_KEYWORD_MAX);
+        break;
+    case BASIC_KEYWORD_MEAN:
+        /* The mean of no elements is 0/0, an invalid operation */
+        *out = basic_number_div_uint(flags, basic_matrix_sum(flags, a.data + start, n), n);
+        break;
+    case BASIC_KEYWORD_DOT:
+        *out = basic_matrix_dot(flags, a.data + start, b.data + start, n);
+        break;
+    }
+    return basic_number_error(flags);
+}
+
+/* A MAT statement with integer arrays, computed element by element. The stores are range-checked */
+static enum BASIC_ERROR_ID matrix_typed(basic_number_flags_t* flags, unsigned char op, bool scale, basic_number_t k,
+        const VARIABLE_ARRAY* t, const VARIABLE_ARRAY* a, const VARIABLE_ARRAY* b)
+{
+    unsigned n = element_count(t);
+    for(unsigned i = 0; i < n; i++)
+    {
+        BASIC_VALUE x = basic_value_int(0);
+        unsigned row = t->ndims == 2 ? i / t->extent[1] : 0;
+        unsigned col = t->ndims == 2 ? i % t->extent[1] : 0;
+        switch(op)
+        {
+        case 0:
+            x = element_value(a, i);
+            if(scale)
+            {
+                x = basic_value_mul(flags, basic_value_number(k), x);
+            }
+            break;
+        case BASIC_KEYWORD_PLUS:
+            x = basic_value_add(flags, element_value(a, i), element_value(b, i));
+            break;
+        case BASIC_KEYWORD_MINUS:
+            x = basic_value_sub(flags, element_value(a, i), element_value(b, i));
+            break;
+        case BASIC_KEYWORD_MULTIPLY:
+            for(unsigned j = 0; j < a->extent[1]; j++)
+            {
+                x = basic_value_add(flags, x, basic_value_mul(flags, element_value(a, row * a->extent[1] + j),
+                        element_value(b, j * b->extent[1] + col)));
+            }
+            break;
+        case BASIC_KEYWORD_TRN:
+            x = element_value(a, col * a->extent[1] + row);
+            break;
+        case BASIC_KEYWORD_CON:
+            x = basic_value_int(1);
+            break;
+        case BASIC_KEYWORD_IDN:
+            x = basic_value_int(row == col);
+            break;
+        }
+        enum BASIC_ERROR_ID eid = variable_storage_assign(variable_element(t->data, t->type, i), t->type, x);
+        if(eid != BASIC_ERROR_OK)
+        {
+            return eid;
+        }
+    }
+    return basic_number_error(flags);
+}
+
+/* MAT statements operate on whole arrays, including the elements with a zero subscript:
+ *   MAT A = B, MAT A = B + C, MAT A = B - C, MAT A = B * C (matrix product),
+ *   MAT A = (expression) * B, MAT A = TRN(B),
+ *   MAT A = ZER, CON or IDN, optionally followed by the dimensions in brackets.
+ * The target array is dimensioned to the shape of the result if it does not exist,
+ * and must have that shape otherwise */
+enum BASIC_ERROR_ID basic_matrix_statement(const unsigned char** parse_ptr, BASIC_MEM_MGR* mem)
+{
+    const unsigned char* p = *parse_ptr;
+    var_name_packed tn, an = 0, bn = 0;
+    VARIABLE_ARRAY t, a, b, shape;
+    unsigned char op = 0; /* An operator keyword, a ZER/CON/IDN/TRN keyword, or 0 for a copy */
+    bool scale = false;
+    bool have_shape = false;
+    basic_number_t k = 0;
+    enum BASIC_ERROR_ID eid;
+    if(basic_parsing_array_name(&p, &tn) != BASIC_ERROR_OK || *p != BASIC_KEYWORD_EQUALS)
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    p = basic_parsing_skipws(p + 1);
+    if(*p >= BASIC_KEYWORD_RANGE_BEGIN_MATRIX && *p <= BASIC_KEYWORD_RANGE_END_MATRIX)
+    {
+        op = *p;
+        p = basic_parsing_skipws(p + 1);
+        if(op == BASIC_KEYWORD_TRN)
+        {
+            if(*p != '(')
+            {
+                return BASIC_ERROR_SYNTAX;
+            }
+            p = basic_parsing_skipws(p + 1);
+            if((eid = parse_operand(&p, &an, &a, mem)) != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            if(*p != ')')
+            {
+                return BASIC_ERROR_SYNTAX;
+            }
+            p = basic_parsing_skipws(p + 1);
+            if(a.ndims != 2)
+            {
+                return BASIC_ERROR_SUBSCRIPT;
+            }
+            shape.ndims = 2;
+            shape.extent[0] = a.extent[1];
+            shape.extent[1] = a.extent[0];
+            have_shape = true;
+        }
+        else if(*p == '(')
+        {
+            /* Explicit dimensions, as in DIM */
+            unsigned subscripts[VARIABLE_ARRAY_MAX_DIMS];
+            shape.ndims = VARIABLE_ARRAY_MAX_DIMS;
+            BASIC_PARSING_RESULT pr = basic_parsing_arrayindex(&p, subscripts, &shape.ndims, mem);
+            if(pr != BASIC_ERROR_OK)
+            {
+                return pr == BASIC_PARSING_NOT_FOUND ? BASIC_ERROR_SYNTAX : pr;
+            }
+            p = basic_parsing_skipws(p);
+            for(unsigned d = 0; d < shape.ndims; d++)
+            {
+                shape.extent[d] = subscripts[d] + 1;
+            }
+            have_shape = true;
+        }
+    }
+    else
+    {
+        if(*p == '(')
+        {
+            /* A scalar factor in brackets */
+            p++;
+            BASIC_PARSING_RESULT pr = basic_parsing_expression(&p, &k, mem);
+            if(pr != BASIC_ERROR_OK)
+            {
+                return pr == BASIC_PARSING_NOT_FOUND ? BASIC_ERROR_SYNTAX : pr;
+            }
+            p = basic_parsing_skipws(p);
+            if(*p != ')')
+            {
+                return BASIC_ERROR_SYNTAX;
+            }
+            p = basic_parsing_skipws(p + 1);
+            if(*p != BASIC_KEYWORD_MULTIPLY)
+            {
+                return BASIC_ERROR_SYNTAX;
+            }
+            p = basic_parsing_skipws(p + 1);
+            scale = true;
+        }
+        if((eid = parse_operand(&p, &an, &a, mem)) != BASIC_ERROR_OK)
+        {
+            return eid;
+        }
+        shape = a;
+        have_shape = true;
+        if(!scale && (*p == BASIC_KEYWORD_PLUS || *p == BASIC_KEYWORD_MINUS || *p == BASIC_KEYWORD_MULTIPLY))
+        {
+            op = *p;
+            p = basic_parsing_skipws(p + 1);
+            if((eid = parse_operand(&p, &bn, &b, mem)) != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            if(op != BASIC_KEYWORD_MULTIPLY)
+            {
+                if(!same_shape(&a, &b))
+                {
+                    return BASIC_ERROR_SUBSCRIPT;
+                }
+            }
+            else
+            {
+                if(a.ndims != 2 || b.ndims != 2 || a.extent[1] != b.extent[0])
+                {
+                    return BASIC_ERROR_SUBSCRIPT;
+                }
+                shape.extent[1] = b.extent[1];
+            }
+        }
+    }
+    if(*p && *p != ':')
+    {
+        return BASIC_ERROR_SYNTAX;
+    }
+    if((op == BASIC_KEYWORD_MULTIPLY || op == BASIC_KEYWORD_TRN) && (tn == an || tn == bn))
+    {
+        /* The result would overwrite its operands while they are read */
+        return BASIC_ERROR_PARAMETER;
+    }
+
+    if(op == BASIC_KEYWORD_IDN && have_shape && (shape.ndims != 2 || shape.extent[0] != shape.extent[1]))
+    {
+        /* An identity matrix is square */
+        return BASIC_ERROR_SUBSCRIPT;
+    }
+
+    /* Find or create the target array */
+    if(variable_storage_get_array(mem, tn, &t))
+    {
+        if(have_shape && !same_shape(&t, &shape))
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+    }
+    else
+    {
+        if(!have_shape)
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        unsigned subscripts[VARIABLE_ARRAY_MAX_DIMS];
+        for(unsigned d = 0; d < shape.ndims; d++)
+        {
+            subscripts[d] = shape.extent[d] - 1;
+        }
+        VARIABLE_VALUE* pval;
+        unsigned char type = VARIABLE_TYPE_NUMBER;
+        eid = variable_storage_create_array_var(mem, tn, &pval, &type, subscripts, shape.ndims, true);
+        if(eid != BASIC_ERROR_OK)
+        {
+            return eid;
+        }
+        variable_storage_get_array(mem, tn, &t);
+    }
+    unsigned n = element_count(&t);
+    if(op == BASIC_KEYWORD_IDN && (t.ndims != 2 || t.extent[0] != t.extent[1]))
+    {
+        return BASIC_ERROR_SUBSCRIPT;
+    }
+
+    basic_number_flags_t* const flags = &mem->number_flags;
+    basic_number_clear_errors(flags);
+    if(t.type != VARIABLE_TYPE_NUMBER || (an && a.type != VARIABLE_TYPE_NUMBER) || (bn && b.type != VARIABLE_TYPE_NUMBER))
+    {
+        *parse_ptr = p;
+        return matrix_typed(flags, op, scale, k, &t, &a, &b);
+    }
+    switch(op)
+    {
+    case 0:
+        if(scale)
+        {
+            basic_matrix_scale(flags, t.data, k, a.data, n);
+        }
+        else
+        {
+            memmove(t.data, a.data, n * sizeof(VARIABLE_VALUE));
+        }
+        break;
+    case BASIC_KEYWORD_PLUS:
+        basic_matrix_add(flags, t.data, a.data, b.data, n);
+        break;
+    case BASIC_KEYWORD_MINUS:
+        basic_matrix_subtract(flags, t.data, a.data, b.data, n);
+        break;
+    case BASIC_KEYWORD_MULTIPLY:
+        basic_matrix_multiply(flags, t.data, a.data, b.data, a.extent[0], a.extent[1], b.extent[1]);
+        break;
+    case BASIC_KEYWORD_TRN:
+        basic_matrix_transpose(t.data, a.data, a.extent[0], a.extent[1]);
+        break;
+    case BASIC_KEYWORD_ZER:
+    case BASIC_KEYWORD_CON:
+        basic_matrix_fill(t.data, op == BASIC_KEYWORD_CON ? basic_number_from_int(flags, 1) : 0, n);
+        break;
+    case BASIC_KEYWORD_IDN:
+        basic_matrix_fill(t.data, 0, n);
+        for(unsigned i = 0; i < n; i += t.extent[1] + 1)
+        {
+            t.data[i].f = basic_number_from_int(flags, 1);
+        }
+        break;
+    }
+    *parse_ptr = p;
+    return basic_number_error(flags);
+}
+
+#endif /* BASIC_CONFIG_MAT */
@@ -0,0 +1,73 @@
+/*
+ * basic_matrix.h
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+/* The MAT statements, and the native whole-array kernels behind them */
+
+#pragma once
+
+#include "variable_storage.h"
+
+/* Element-wise kernels over n elements. The destination may be one of the sources.
+ * The kernels that compute raise their errors in the given flags */
+void basic_matrix_add(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n);
+void basic_matrix_subtract(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n);
+void basic_matrix_scale(basic_number_flags_t* flags, VARIABLE_VALUE* d, basic_number_t k, const VARIABLE_VALUE* a, unsigned n);
+void basic_matrix_fill(VARIABLE_VALUE* d, basic_number_t v, unsigned n);
+
+/* Matrix product of a (rows x inner) and b (inner x cols) into d (rows x cols),
+ * which must not overlap the sources */
+void basic_matrix_multiply(basic_number_flags_t* flags, VARIABLE_VALUE* d, const VARIABLE_VALUE* a,
+        const VARIABLE_VALUE* b, unsigned rows, unsigned inner, unsigned cols);
+
+/* Transpose a (rows x cols) into d (cols x rows), which must not overlap a */
+void basic_matrix_transpose(VARIABLE_VALUE* d, const VARIABLE_VALUE* a, unsigned rows, unsigned cols);
+
+/* Reductions over n elements. The extreme of no elements is undefined */
+basic_number_t basic_matrix_sum(basic_number_flags_t* flags, const VARIABLE_VALUE* a, unsigned n);
+basic_number_t basic_matrix_dot(basic_number_flags_t* flags, const VARIABLE_VALUE* a, const VARIABLE_VALUE* b, unsigned n);
+basic_number_t basic_matrix_extreme(const VARIABLE_VALUE* a, unsigned n, bool max);
+
+/* The reduction functions take up to this many start and count arguments after the arrays */
+#define BASIC_MATRIX_REDUCE_MAX_ARGS 2
+
+/* Parse a reduction function keyword, the opening bracket and the array names
+ * (two for DOT, one for the others). The second name is 0 if there is none */
+enum BASIC_ERROR_ID basic_matrix_parse_reduction(const unsigned char** parse_ptr, var_name_packed names[2]);
+
+/* Evaluate a reduction function over the arrays, optionally starting
+ * at the element args[0] and limited to args[1] elements */
+enum BASIC_ERROR_ID basic_matrix_reduce(BASIC_MEM_MGR* mem, unsigned char fn, const var_name_packed names[2],
+        const BASIC_VALUE* args, unsigned nargs, basic_number_t* out);
+
+/* Parse and execute a MAT statement, starting after the MAT keyword */
+enum BASIC_ERROR_ID basic_matrix_statement(const unsigned char** parse_ptr, BASIC_MEM_MGR* mem);
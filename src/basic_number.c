@@ -0,0 +1,269 @@
+/*
+ * basic_number.c
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "basic_number.h"
+#include "basic_stdio.h"
+#include <stdlib.h>
+
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_FIXED
+
+enum BASIC_ERROR_ID basic_number_error(const basic_number_flags_t* flags)
+{
+    if(*flags & BASIC_NUMBER_DIVBYZERO)
+    {
+        return BASIC_ERROR_DIVISION_BY_ZERO;
+    }
+    if(*flags & BASIC_NUMBER_INVALID)
+    {
+        return BASIC_ERROR_PARAMETER;
+    }
+    if(*flags & BASIC_NUMBER_OVERFLOW)
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    return BASIC_ERROR_OK;
+}
+
+basic_number_t basic_number_random(void)
+{
+    return (basic_number_t)((int64_t)rand() * BASIC_NUMBER_ONE / ((int64_t)RAND_MAX + 1));
+}
+
+/* The square root of a Q16.16 number is the integer square root of its value shifted
+ * by another 16 bits, found bit by bit */
+basic_number_t basic_number_sqrt(basic_number_flags_t* flags, basic_number_t a)
+{
+    if(a < 0)
+    {
+        *flags |= BASIC_NUMBER_INVALID;
+        return 0;
+    }
+    uint64_t v = (uint64_t)a << BASIC_NUMBER_FRAC_BITS;
+    uint64_t root = 0;
+    /* Start at the highest power of 4 not above the value, which is below 2^47 */
+    uint64_t bit = (uint64_t)1 << 46;
+    while(bit > v)
+    {
+        bit >>= 2;
+    }
+    for(; bit; bit >>= 2)
+    {
+        if(v >= root + bit)
+        {
+            v -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+    }
+    return (basic_number_t)root;
+}
+
+/* 2*pi and pi with 32 fraction bits, for an exact range reduction */
+#define FIXED_2PI_Q32 INT64_C(26986075409)
+#define FIXED_PI_Q32 INT64_C(13493037705)
+
+/* The argument is reduced to -pi/2..pi/2, where the Taylor series
+ * to the 9th power is accurate to the resolution of the type */
+basic_number_t basic_number_sin(basic_number_t a)
+{
+    int64_t r = (int64_t)a * BASIC_NUMBER_ONE % FIXED_2PI_Q32;
+    if(r > FIXED_PI_Q32)
+    {
+        r -= FIXED_2PI_Q32;
+    }
+    else if(r < -FIXED_PI_Q32)
+    {
+        r += FIXED_2PI_Q32;
+    }
+    if(r > FIXED_PI_Q32 / 2)
+    {
+        r = FIXED_PI_Q32 - r;
+    }
+    else if(r < -FIXED_PI_Q32 / 2)
+    {
+        r = -FIXED_PI_Q32 - r;
+    }
+    int64_t x = r / BASIC_NUMBER_ONE;
+    int64_t x2 = x * x / BASIC_NUMBER_ONE;
+    int64_t t = BASIC_NUMBER_ONE - x2 / 72;
+    t = BASIC_NUMBER_ONE - x2 * t / BASIC_NUMBER_ONE / 42;
+    t = BASIC_NUMBER_ONE - x2 * t / BASIC_NUMBER_ONE / 20;
+    t = BASIC_NUMBER_ONE - x2 * t / BASIC_NUMBER_ONE / 6;
+    return (basic_number_t)(x * t / BASIC_NUMBER_ONE);
+}
+
+basic_number_t basic_number_from_decimal(basic_number_flags_t* flags, uint64_t mantissa, int exp10, bool negative)
+{
+    /* Drop the digits that cannot make a difference, so that the scaling below does not overflow */
+    while(mantissa >= (UINT64_C(1) << 47) || (exp10 < -18 && mantissa))
+    {
+        mantissa /= 10;
+        exp10++;
+    }
+    if(!mantissa)
+    {
+        return 0;
+    }
+    uint64_t scale = 1;
+    for(int e = exp10 < 0 ? -exp10 : exp10; e; e--)
+    {
+        scale *= 10;
+        if(exp10 > 0 && mantissa * scale > INT32_MAX / BASIC_NUMBER_ONE + 1)
+        {
+            *flags |= BASIC_NUMBER_OVERFLOW;
+            return INT32_MAX;
+        }
+    }
+    uint64_t v = exp10 >= 0 ? mantissa * scale * BASIC_NUMBER_ONE :
+            (mantissa * BASIC_NUMBER_ONE + scale / 2) / scale;
+    /* The negation reaches the smallest number, which has no positive counterpart */
+    return basic_number_narrow(flags, negative ? -(int64_t)v : (int64_t)v);
+}
+
+/* Print up to 6 significant digits, as %G does, with trailing zeros removed */
+void basic_number_print(basic_number_t a)
+{
+    char text[16];
+    char* p = text + sizeof(text);
+    *--p = '\0';
+    int64_t v = a;
+    bool negative = v < 0;
+    if(negative)
+    {
+        v = -v;
+    }
+    unsigned decimals = 5;
+    for(int64_t i = v / BASIC_NUMBER_ONE; i >= 10 && decimals; i /= 10)
+    {
+        decimals--;
+    }
+    int64_t pow10 = 1;
+    for(unsigned d = 0; d < decimals; d++)
+    {
+        pow10 *= 10;
+    }
+    int64_t scaled = (v * pow10 + BASIC_NUMBER_ONE / 2) / BASIC_NUMBER_ONE;
+    if(!negative && scaled / pow10 > INT32_MAX / BASIC_NUMBER_ONE)
+    {
+        /* Round down the largest numbers, so that the printed value reads back */
+        scaled = v * pow10 / BASIC_NUMBER_ONE;
+    }
+    int64_t frac = scaled % pow10;
+    while(decimals && !(frac % 10))
+    {
+        frac /= 10;
+        decimals--;
+    }
+    if(decimals)
+    {
+        for(unsigned d = 0; d < decimals; d++)
+        {
+            *--p = '0' + frac % 10;
+            frac /= 10;
+        }
+        *--p = '.';
+    }
+    int64_t i = scaled / pow10;
+    do
+    {
+        *--p = '0' + i % 10;
+        i /= 10;
+    } while(i);
+    if(negative)
+    {
+        *--p = '-';
+    }
+    basic_printf("%s ", p);
+}
+
+#else /* Floating-point types */
+
+enum BASIC_ERROR_ID basic_number_error(const basic_number_flags_t* flags)
+{
+    (void)flags;
+    if(fetestexcept(FE_DIVBYZERO))
+    {
+        return BASIC_ERROR_DIVISION_BY_ZERO;
+    }
+    if(fetestexcept(FE_INVALID))
+    {
+        return BASIC_ERROR_PARAMETER;
+    }
+    if(fetestexcept(FE_OVERFLOW))
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    return BASIC_ERROR_OK;
+}
+
+basic_number_t basic_number_random(void)
+{
+    return rand() / (RAND_MAX + (basic_number_t)1);
+}
+
+basic_number_t basic_number_from_decimal(basic_number_flags_t* flags, uint64_t mantissa, int exp10, bool negative)
+{
+    (void)flags;
+    basic_number_t v = (basic_number_t)mantissa * BASIC_NUMBER_MATH(pow)(10, exp10);
+    return negative ? -v : v;
+}
+
+void basic_number_print(basic_number_t a)
+{
+#if BASIC_CONFIG_NUMBER == BASIC_NUMBER_DOUBLE
+    basic_printf("%.15G ", a);
+#else
+    basic_printf("%G ", a);
+#endif
+}
+
+#endif
+
+bool basic_value_print(BASIC_VALUE v)
+{
+    if(v.integer && !v.literal)
+    {
+        basic_printf("%ld ", (long)v.u.i);
+        return true;
+    }
+    basic_number_t f;
+    if(!basic_value_to_number_checked(v, &f))
+    {
+        return false;
+    }
+    basic_number_print(f);
+    return true;
+}
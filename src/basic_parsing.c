@@ -33,9 +33,9 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include "basic_parsing.h"
 #include "keywords.h"
-#include <math.h>
-#include <stdlib.h>
-#include <fenv.h>
+#include "program_storage.h"
+#include "basic_matrix.h"
+#include "basic_vm.h"
 
 #define IS_DIGIT(c) (c >= '0' && c <= '9')
 #define IS_ALPHA(c) ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
@@ -96,49 +96,38 @@ BASIC_PARSING_RESULT basic_parsing_uint16(const unsigned char** parse_ptr, unsig
     return r;
 }
 
-static enum BASIC_ERROR_ID except_to_basic_error(void)
-{
-    if(fetestexcept(FE_DIVBYZERO))
-    {
-        return BASIC_ERROR_DIVISION_BY_ZERO;
-    }
-    if(fetestexcept(FE_INVALID))
-    {
-        return BASIC_ERROR_PARAMETER;
-    }
-    if(fetestexcept(FE_OVERFLOW))
-    {
-        return BASIC_ERROR_OVERFLOW;
-    }
-    return BASIC_ERROR_OK;
-}
-
-/* We need a custom floating-point parsing routine without relying on the
+/* We need a custom number parsing routine without relying on the
  * standard-library strtof function, for 2 reasons:
  * 1) Whitespace is allowed in numbers
  * 2) The exponent sign (+ or -) is scrambled by the tokenizer
  *
- * The algorithm here is rather inexact, but it is taken from the original BASIC
- * and should therefore at least keep the same performance.
- * An exact algorithm like the one in strtof() would involve
- * multi-precision arithmetic. TODO: do it!
- */
-BASIC_PARSING_RESULT basic_parsing_float(const unsigned char** parse_ptr, float* out)
+ * The digits are collected into an integer mantissa and a decimal exponent,
+ * which the numeric type converts with a single rounding.
+ * Digits beyond the precision of the mantissa are dropped */
+#define PARSING_MANTISSA_LIMIT UINT64_C(100000000000000000)
+
+BASIC_PARSING_RESULT basic_parsing_literal(const unsigned char** parse_ptr, bool negative, BASIC_VALUE* out)
 {
     unsigned char c;
     const unsigned char* p = *parse_ptr;
 
-    /* No need to parse the sign because it is handled in the term-parsing */
-    float val = 0;
+    /* The sign is parsed by the term-parsing, which passes it here so that
+     * the smallest number can be written */
+    uint64_t mantissa = 0;
     int decimal_scaling = 0;
-
-    /* Prepare for detecting overflows */
-    feclearexcept(FE_ALL_EXCEPT);
+    bool integer = true;
 
     /* Parse the integer part */
     while((c=*p), c >= '0' && c <= '9')
     {
-        val = val*10 + (c - '0');
+        if(mantissa < PARSING_MANTISSA_LIMIT)
+        {
+            mantissa = mantissa*10 + (c - '0');
+        }
+        else
+        {
+            decimal_scaling++;
+        }
         p++;
         p = basic_parsing_skipws(p);
     }
@@ -146,13 +135,17 @@ BASIC_PARSING_RESULT basic_parsing_float(const unsigned char** parse_ptr, float*
     /* Parse the fractional part */
     if(c == '.')
     {
+        integer = false;
         p++;
         p = basic_parsing_skipws(p);
 
         while((c=*p), c >= '0' && c <= '9')
         {
-            val = val*10 + (c - '0');
-            decimal_scaling--;
+            if(mantissa < PARSING_MANTISSA_LIMIT)
+            {
+                mantissa = mantissa*10 + (c - '0');
+                decimal_scaling--;
+            }
             p++;
             p = basic_parsing_skipws(p);
         }
@@ -161,6 +154,7 @@ BASIC_PARSING_RESULT basic_parsing_float(const unsigned char** parse_ptr, float*
     /* Parse the exponent part */
     if(c=='e' || c=='E')
     {
+        integer = false;
         p++;
         p = basic_parsing_skipws(p);
         /* Parse the exponent sign */
@@ -186,14 +180,32 @@ BASIC_PARSING_RESULT basic_parsing_float(const unsigned char** parse_ptr, float*
         decimal_scaling += exponent_sign*(int)e;
     }
 
-    val *= powf(10.0f, (float)decimal_scaling);
+    *parse_ptr = p;
+    if(integer && mantissa <= INT32_MAX && !decimal_scaling)
+    {
+        *out = basic_value_int_literal(negative ? -(int32_t)mantissa : (int32_t)mantissa);
+        return BASIC_ERROR_OK;
+    }
+    basic_number_flags_t flags;
+    basic_number_clear_errors(&flags);
+    basic_number_t val = basic_number_from_decimal(&flags, mantissa, decimal_scaling, negative);
 
-    BASIC_PARSING_RESULT r = except_to_basic_error();
+    BASIC_PARSING_RESULT r = basic_number_error(&flags);
     if(r == BASIC_ERROR_OK)
     {
-        *out = val;
+        *out = basic_value_number(val);
+    }
+    return r;
+}
+
+BASIC_PARSING_RESULT basic_parsing_number(const unsigned char** parse_ptr, basic_number_t* out)
+{
+    BASIC_VALUE val;
+    BASIC_PARSING_RESULT r = basic_parsing_literal(parse_ptr, false, &val);
+    if(r == BASIC_ERROR_OK && !basic_value_to_number_checked(val, out))
+    {
+        r = BASIC_ERROR_OVERFLOW;
     }
-    *parse_ptr = p;
     return r;
 }
 
@@ -201,6 +213,25 @@ BASIC_PARSING_RESULT basic_parsing_varname(const unsigned char** parse_ptr, var_
 {
     const unsigned char* p = *parse_ptr;
     unsigned char c = *p;
+    if(c == BASIC_TOKEN_VARREF)
+    {
+        /* A marked name never has blanks inside */
+        p += PROG_STORAGE_VARREF_SIZE;
+        var_name_packed vn = var_name_add_char(var_name_empty(), *p++);
+        if(IS_DIGIT(*p))
+        {
+            vn = var_name_add_char(vn, *p++);
+        }
+        p = basic_parsing_skipws(p);
+        if(*p == '%')
+        {
+            vn |= VAR_NAME_INTEGER;
+            p = basic_parsing_skipws(p + 1);
+        }
+        *parse_ptr = p;
+        *out = vn;
+        return BASIC_ERROR_OK;
+    }
     if(!IS_ALPHA(c))
         return BASIC_ERROR_SYNTAX;
     var_name_packed vn = var_name_add_char(var_name_empty(), c);
@@ -213,14 +244,60 @@ BASIC_PARSING_RESULT basic_parsing_varname(const unsigned char** parse_ptr, var_
         p++;
         p=basic_parsing_skipws(p);
     }
+    if(*p == '%')
+    {
+        vn |= VAR_NAME_INTEGER;
+        p++;
+        p=basic_parsing_skipws(p);
+    }
     *parse_ptr = p;
     *out = vn;
     return BASIC_ERROR_OK;
 }
 
-static BASIC_PARSING_RESULT get_variable(const unsigned char** parse_ptr, var_name_packed* pvn, void* out, BASIC_MEM_MGR* mem, bool create, bool dim)
+BASIC_PARSING_RESULT basic_parsing_array_name(const unsigned char** parse_ptr, var_name_packed* out)
+{
+    BASIC_PARSING_RESULT r = basic_parsing_varname(parse_ptr, out);
+    if(r == BASIC_ERROR_OK && var_name_is_integer(*out))
+    {
+        /* Arrays hold numbers only */
+        return BASIC_ERROR_SYNTAX;
+    }
+    return r;
+}
+
+/* Access a scalar variable through its reference token, which keeps the position of the variable */
+static BASIC_VALUE read_var_ref(BASIC_MEM_MGR* mem, var_name_packed vn, const unsigned char* ref)
+{
+    unsigned cache = prog_storage_read_varref(ref);
+    VARIABLE_VALUE* pval = variable_storage_lookup_var_cached(mem, vn, &cache);
+    if(!pval)
+    {
+        /* All variables read as zero until initialized otherwise */
+        return var_name_is_integer(vn) ? basic_value_int(0) : basic_value_number(0);
+    }
+    if(cache != prog_storage_read_varref(ref))
+    {
+        prog_storage_write_varref(mem, ref, cache);
+    }
+    return variable_storage_value(pval, var_name_type(vn));
+}
+
+static VARIABLE_VALUE* create_var_ref(BASIC_MEM_MGR* mem, var_name_packed vn, const unsigned char* ref)
+{
+    unsigned cache = prog_storage_read_varref(ref);
+    VARIABLE_VALUE* pval = variable_storage_create_var_cached(mem, vn, &cache);
+    if(pval && cache != prog_storage_read_varref(ref))
+    {
+        prog_storage_write_varref(mem, ref, cache);
+    }
+    return pval;
+}
+
+static BASIC_PARSING_RESULT get_variable(const unsigned char** parse_ptr, var_name_packed* pvn, void* out, unsigned char* type, BASIC_MEM_MGR* mem, bool create, bool dim)
 {
     const unsigned char* p = *parse_ptr;
+    const unsigned char* ref = *p == BASIC_TOKEN_VARREF ? p : NULL;
     /* Parse the variable name */
     var_name_packed vn;
     BASIC_PARSING_RESULT pr;
@@ -228,12 +305,17 @@ static BASIC_PARSING_RESULT get_variable(const unsigned char** parse_ptr, var_na
     {
         return pr;
     }
-    *pvn = vn;
     if(*p == '(')
     {
         /* An array element */
-        unsigned subscript = 0;
-        pr = basic_parsing_arrayindex(&p, &subscript, mem);
+        if(var_name_is_integer(vn))
+        {
+            /* Arrays hold numbers only */
+            return BASIC_ERROR_SYNTAX;
+        }
+        unsigned subscripts[VARIABLE_ARRAY_MAX_DIMS];
+        unsigned ndims = VARIABLE_ARRAY_MAX_DIMS;
+        pr = basic_parsing_arrayindex(&p, subscripts, &ndims, mem);
         if(pr == BASIC_PARSING_NOT_FOUND)
         {
             return BASIC_ERROR_SYNTAX;
@@ -242,9 +324,25 @@ static BASIC_PARSING_RESULT get_variable(const unsigned char** parse_ptr, var_na
         {
             return pr;
         }
+        *type = VARIABLE_TYPE_NUMBER;
+        if(dim)
+        {
+            /* An optional element type: AS BYTE, SHORT or LONG */
+            p = basic_parsing_skipws(p);
+            if(*p == BASIC_KEYWORD_AS)
+            {
+                p = basic_parsing_skipws(p + 1);
+                if(*p < BASIC_KEYWORD_RANGE_BEGIN_ARRAY_TYPES || *p > BASIC_KEYWORD_RANGE_END_ARRAY_TYPES)
+                {
+                    return BASIC_ERROR_SYNTAX;
+                }
+                *type = VARIABLE_TYPE_INT8 + (*p - BASIC_KEYWORD_RANGE_BEGIN_ARRAY_TYPES);
+                p++;
+            }
+        }
         /* Get a reference to the array element */
         VARIABLE_VALUE* pval;
-        pr = variable_storage_create_array_var(mem, vn, &pval, subscript, dim);
+        pr = variable_storage_create_array_var(mem, vn, &pval, type, subscripts, ndims, dim);
         if(pr != BASIC_ERROR_OK)
         {
             return pr;
@@ -255,84 +353,110 @@ static BASIC_PARSING_RESULT get_variable(const unsigned char** parse_ptr, var_na
         }
         else
         {
-            *(float*)out = pval->f;
+            *(BASIC_VALUE*)out = variable_storage_value(pval, *type);
         }
     }
     else if(create)
     {
         /* A normal variable, creation mode */
-        VARIABLE_VALUE* pval = variable_storage_create_var(mem, vn);
+        vn = variable_storage_scalar_name(mem, vn);
+        VARIABLE_VALUE* pval = ref ? create_var_ref(mem, vn, ref) : variable_storage_create_var(mem, vn);
         if(!pval)
         {
             return BASIC_ERROR_OUT_OF_MEMORY;
         }
         *(VARIABLE_VALUE**)out = pval;
+        *type = var_name_type(vn);
     }
     else
     {
         /* A normal variable, read mode */
-        float val = variable_storage_read_var(mem, vn);
-        *(float*)out = val;
+        vn = variable_storage_scalar_name(mem, vn);
+        *(BASIC_VALUE*)out = ref ? read_var_ref(mem, vn, ref) : variable_storage_read_var(mem, vn);
     }
+    *pvn = vn;
     p = basic_parsing_skipws(p);
     *parse_ptr = p;
     return BASIC_ERROR_OK;
 }
 
-BASIC_PARSING_RESULT basic_parsing_variable_ref(const unsigned char** parse_ptr, var_name_packed* pvn, VARIABLE_VALUE** out, BASIC_MEM_MGR* mem)
+BASIC_PARSING_RESULT basic_parsing_variable_ref(const unsigned char** parse_ptr, var_name_packed* pvn, VARIABLE_VALUE** out, unsigned char* type, BASIC_MEM_MGR* mem)
 {
-    return get_variable(parse_ptr, pvn, out, mem, true, false);
+    return get_variable(parse_ptr, pvn, out, type, mem, true, false);
 }
 
 BASIC_PARSING_RESULT basic_parsing_variable_dim(const unsigned char** parse_ptr, BASIC_MEM_MGR* mem)
 {
     var_name_packed dummy1;
     VARIABLE_VALUE* dummy2;
+    unsigned char dummy3;
 
-    return get_variable(parse_ptr, &dummy1, &dummy2, mem, true, true);
+    return get_variable(parse_ptr, &dummy1, &dummy2, &dummy3, mem, true, true);
 }
 
 
-BASIC_PARSING_RESULT basic_parsing_variable_val(const unsigned char** parse_ptr, var_name_packed* pvn, float* out, BASIC_MEM_MGR* mem)
+BASIC_PARSING_RESULT basic_parsing_variable_val(const unsigned char** parse_ptr, var_name_packed* pvn, BASIC_VALUE* out, BASIC_MEM_MGR* mem)
 {
-    return get_variable(parse_ptr, pvn, out, mem, false, false);
+    unsigned char dummy;
+    return get_variable(parse_ptr, pvn, out, &dummy, mem, false, false);
 }
 
-static float eval_function(float x, unsigned char fn)
+static basic_number_t number_function(basic_number_flags_t* flags, basic_number_t x, unsigned char fn)
 {
     switch(fn)
     {
     case BASIC_KEYWORD_SGN:
-        if(x > 0.0f)
+        if(x > 0)
         {
-            return 1.0f;
+            return basic_number_from_int(flags, 1);
         }
-        else if(x < 0.0f)
+        else if(x < 0)
         {
-            return -1.0f;
+            return basic_number_from_int(flags, -1);
         }
         else
         {
-            return 0.0f;
+            return 0;
         }
     case BASIC_KEYWORD_INT:
-        return floor(x);
+        return basic_number_floor(x);
     case BASIC_KEYWORD_ABS:
-        return fabsf(x);
+        return basic_number_abs(flags, x);
     case BASIC_KEYWORD_USR:
         /* TODO: implement USR */
-        return 0.0f;
+        return 0;
     case BASIC_KEYWORD_SQR:
-        return sqrtf(x);
+        return basic_number_sqrt(flags, x);
     case BASIC_KEYWORD_RND:
-        return rand() / (RAND_MAX+1.0f);
+        return basic_number_random();
     case BASIC_KEYWORD_SIN:
-        return sinf(x);
+        return basic_number_sin(x);
     default:
         /* Unknown function */
         /* TODO: report error */
-        return 0.0f;
+        return 0;
+    }
+}
+
+BASIC_VALUE basic_parsing_function(basic_number_flags_t* flags, BASIC_VALUE x, unsigned char fn)
+{
+    if(x.integer)
+    {
+        /* These keep integers */
+        switch(fn)
+        {
+        case BASIC_KEYWORD_SGN:
+            x.u.i = (x.u.i > 0) - (x.u.i < 0);
+            return x;
+        case BASIC_KEYWORD_INT:
+            return x;
+        case BASIC_KEYWORD_ABS:
+            return x.u.i < 0 ? basic_value_neg(flags, x) : x;
+        default:
+            break;
+        }
     }
+    return basic_value_number(number_function(flags, basic_value_to_number(flags, x), fn));
 }
 
 static const unsigned operator_precedence_table[KEYWORD_RANGE_OFFSET(OPERATORS, RANGE_END_OPERATORS)+1] =
@@ -349,18 +473,32 @@ static const unsigned operator_precedence_table[KEYWORD_RANGE_OFFSET(OPERATORS,
 #endif
 };
 
-static float apply_operator(float a, float b, unsigned char op)
+unsigned basic_parsing_operator_precedence(unsigned char op)
+{
+    return operator_precedence_table[op - BASIC_KEYWORD_RANGE_BEGIN_OPERATORS];
+}
+
+/* Negate the value of a term. Only the smallest Q16.16 number, or an integer
+ * that does not fit one, overflows */
+static bool negate_term(basic_number_flags_t* flags, BASIC_VALUE* val)
+{
+    basic_number_clear_errors(flags);
+    *val = basic_value_neg(flags, *val);
+    return val->integer || !basic_number_failed(flags);
+}
+
+static BASIC_VALUE apply_operator(basic_number_flags_t* flags, BASIC_VALUE a, BASIC_VALUE b, unsigned char op)
 {
     switch(op)
     {
     case BASIC_KEYWORD_PLUS:
-        return a+b;
+        return basic_value_add(flags, a, b);
     case BASIC_KEYWORD_MINUS:
-        return a-b;
+        return basic_value_sub(flags, a, b);
     case BASIC_KEYWORD_MULTIPLY:
-        return a*b;
+        return basic_value_mul(flags, a, b);
     case BASIC_KEYWORD_DIVIDE:
-        return a/b;
+        return basic_value_div(flags, a, b);
         /* Temporarily disabled relation operators in logic expressions */
 #if 0
     case BASIC_KEYWORD_GREATER:
@@ -373,7 +511,7 @@ static float apply_operator(float a, float b, unsigned char op)
     default:
         /* Unknown operator */
         /* TODO: report error */
-        return 0.0f;
+        return basic_value_number(0);
     }
 }
 
@@ -385,6 +523,7 @@ enum PARSE_EXPR_STATE
     PARSE_EXPR_STATE_SUBEXPR_RET,
     PARSE_EXPR_STATE_FUNCTIONARG_RET,
     PARSE_EXPR_STATE_SUBSCRIPT_RET,
+    PARSE_EXPR_STATE_REDUCTION_RET,
     PARSE_EXPR_STATE_FIRST_OPERATOR,
     PARSE_EXPR_STATE_EXPR_1,
     PARSE_EXPR_STATE_SECOND_OPERATOR,
@@ -393,15 +532,39 @@ enum PARSE_EXPR_STATE
     PARSE_EXPR_STATE_EXITING
 };
 
+/* The type of lhs is saved in the byte of min_precedence, so that
+ * an integer operand takes no more stack space than a number */
+#define PARSE_EXPR_LHS_INTEGER 0x80
+#define PARSE_EXPR_LHS_LITERAL 0x40
+
+static inline void push_lhs(BASIC_MEM_MGR* mem, unsigned char min_precedence, unsigned char op, const BASIC_VALUE* lhs)
+{
+    fgstack_push_expression_byte_nocheck(mem, min_precedence | (lhs->integer ? PARSE_EXPR_LHS_INTEGER : 0) |
+            (lhs->integer && lhs->literal ? PARSE_EXPR_LHS_LITERAL : 0));
+    fgstack_push_expression_byte_nocheck(mem, op);
+    fgstack_push_expression(mem, &lhs->u, sizeof(lhs->u));
+}
+
+static inline void pop_lhs(BASIC_MEM_MGR* mem, unsigned char* min_precedence, unsigned char* op, BASIC_VALUE* lhs)
+{
+    fgstack_pop_expression(mem, &lhs->u, sizeof(lhs->u));
+    fgstack_pop_expression(mem, op, sizeof(*op));
+    fgstack_pop_expression(mem, min_precedence, sizeof(*min_precedence));
+    lhs->integer = (*min_precedence & PARSE_EXPR_LHS_INTEGER) != 0;
+    lhs->literal = (*min_precedence & PARSE_EXPR_LHS_LITERAL) != 0;
+    *min_precedence &= ~(PARSE_EXPR_LHS_INTEGER | PARSE_EXPR_LHS_LITERAL);
+}
+
 /* We implement the Precedence Climbing method
  * https://en.wikipedia.org/wiki/Operator-precedence_parser
  * with an explicit stack to avoid recursive calls
  */
-static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** parse_ptr, float* out, BASIC_MEM_MGR* mem)
+static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** parse_ptr, BASIC_VALUE* out, BASIC_MEM_MGR* mem)
 {
-    float lhs = 0.0f;
-    float rhs = 0.0f;
-    float val = 0.0f;
+    basic_number_flags_t* const flags = &mem->number_flags;
+    BASIC_VALUE lhs = basic_value_number(0);
+    BASIC_VALUE rhs = basic_value_number(0);
+    BASIC_VALUE val = basic_value_number(0);
     unsigned char c;
     const unsigned char* p = *parse_ptr;
     unsigned char lookahead;
@@ -456,9 +619,10 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                 }
                 p++;
             }
-            if(IS_ALPHA(c))
+            if(IS_ALPHA(c) || c == BASIC_TOKEN_VARREF)
             {
                 /* Variable */
+                const unsigned char* ref = p;
                 var_name_packed vn;
                 if((r = basic_parsing_varname(&p, &vn)) != BASIC_ERROR_OK)
                 {
@@ -470,22 +634,26 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                 }
                 if(*p == '(')
                 {
-                    /* An array element, subscript comes as expression in parentheses. */
+                    /* An array element, subscripts come as expressions in parentheses. */
+                    if(var_name_is_integer(vn))
+                    {
+                        /* Arrays hold numbers only */
+                        return BASIC_ERROR_SYNTAX;
+                    }
                     /* Set up a "recursive" call to
                      * the parse_expression routine. We need to save
                      * lhs, op, min_precedence, negation flag,
-                     * and the variable name on the stack */
+                     * the variable name, and the count of subscripts parsed so far on the stack */
                     p++;
                     if(!fgstack_check_space(mem, sizeof(vn)+sizeof(negate)+sizeof(min_precedence)+
-                            sizeof(op)+sizeof(lhs)+sizeof(state)))
+                            sizeof(op)+sizeof(lhs.u)+1+sizeof(state)))
                     {
                         return BASIC_ERROR_OUT_OF_MEMORY;
                     }
                     fgstack_push_expression(mem, &vn, sizeof(vn));
                     fgstack_push_expression_byte_nocheck(mem, negate);
-                    fgstack_push_expression_byte_nocheck(mem, min_precedence);
-                    fgstack_push_expression_byte_nocheck(mem, op);
-                    fgstack_push_expression(mem, &lhs, sizeof(lhs));
+                    push_lhs(mem, min_precedence, op, &lhs);
+                    fgstack_push_expression_byte_nocheck(mem, 0);
                     fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_SUBSCRIPT_RET);
                     r = BASIC_PARSING_NOT_FOUND;
                     state = PARSE_EXPR_STATE_EXPRESSION;
@@ -493,30 +661,112 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                 else
                 {
                     /* A normal variable, read mode */
-                    val = variable_storage_read_var(mem, vn);
+                    vn = variable_storage_scalar_name(mem, vn);
+                    val = c == BASIC_TOKEN_VARREF ? read_var_ref(mem, vn, ref) : variable_storage_read_var(mem, vn);
                     p = basic_parsing_skipws(p);
                     if(negate)
                     {
-                        val = -val;
+                        if(!negate_term(flags, &val))
+                        {
+                            return basic_number_error(flags);
+                        }
                     }
                     fgstack_pop_expression(mem, &state, sizeof(state));
                 }
             }
-            else if(IS_DIGIT(c) || c == '.')
+            else if(c == BASIC_TOKEN_LITERAL || c == BASIC_TOKEN_INT_LITERAL)
             {
-                /* A floating-point number literal */
-                r = basic_parsing_float(&p, &val);
-                if(r != BASIC_ERROR_OK)
+                /* A number literal parsed when the line was stored */
+                if(c == BASIC_TOKEN_INT_LITERAL)
                 {
-                    return r;
+                    val.integer = val.literal = true;
+                    p += prog_storage_read_int_literal(p, &val.u.i);
                 }
+                else
+                {
+                    val.integer = false;
+                    p += prog_storage_read_literal(p, &val.u.f);
+                }
+                r = BASIC_ERROR_OK;
                 if(negate)
                 {
-                    val = -val;
+                    if(!negate_term(flags, &val))
+                    {
+                        return basic_number_error(flags);
+                    }
+                }
+                p = basic_parsing_skipws(p);
+                fgstack_pop_expression(mem, &state, sizeof(state));
+            }
+            else if(IS_DIGIT(c) || c == '.')
+            {
+                /* A number literal */
+                r = basic_parsing_literal(&p, negate, &val);
+                if(r != BASIC_ERROR_OK)
+                {
+                    return r;
                 }
                 p = basic_parsing_skipws(p);
                 fgstack_pop_expression(mem, &state, sizeof(state));
             }
+            else if(c >= BASIC_KEYWORD_RANGE_BEGIN_REDUCTIONS && c <= BASIC_KEYWORD_RANGE_END_REDUCTIONS)
+            {
+#if BASIC_CONFIG_MAT
+                /* An array reduction function. The array names come first */
+                unsigned char fn = c;
+                var_name_packed names[2];
+                if((r = basic_matrix_parse_reduction(&p, names)) != BASIC_ERROR_OK)
+                {
+                    return r;
+                }
+                if(*p == ')')
+                {
+                    p++;
+                    p = basic_parsing_skipws(p);
+                    basic_number_t result;
+                    if((r = basic_matrix_reduce(mem, fn, names, NULL, 0, &result)) != BASIC_ERROR_OK)
+                    {
+                        return r;
+                    }
+                    val = basic_value_number(result);
+                    if(negate)
+                    {
+                        if(!negate_term(flags, &val))
+                        {
+                            return basic_number_error(flags);
+                        }
+                    }
+                    fgstack_pop_expression(mem, &state, sizeof(state));
+                }
+                else if(*p == ',')
+                {
+                    /* The start and count expressions follow. Set up a "recursive" call to
+                     * the parse_expression routine. We need to save lhs, op, min_precedence,
+                     * negation flag, the function, the array names, and the count
+                     * of arguments parsed so far on the stack */
+                    p++;
+                    if(!fgstack_check_space(mem, sizeof(names)+sizeof(fn)+sizeof(negate)+sizeof(min_precedence)+
+                            sizeof(op)+sizeof(lhs.u)+1+sizeof(state)))
+                    {
+                        return BASIC_ERROR_OUT_OF_MEMORY;
+                    }
+                    fgstack_push_expression(mem, names, sizeof(names));
+                    fgstack_push_expression_byte_nocheck(mem, fn);
+                    fgstack_push_expression_byte_nocheck(mem, negate);
+                    push_lhs(mem, min_precedence, op, &lhs);
+                    fgstack_push_expression_byte_nocheck(mem, 0);
+                    fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_REDUCTION_RET);
+                    r = BASIC_PARSING_NOT_FOUND;
+                    state = PARSE_EXPR_STATE_EXPRESSION;
+                }
+                else
+                {
+                    return BASIC_ERROR_SYNTAX;
+                }
+#else
+                return BASIC_ERROR_SYNTAX;
+#endif
+            }
             else if(c >= BASIC_KEYWORD_RANGE_BEGIN_FUNCTIONS && c <= BASIC_KEYWORD_RANGE_END_FUNCTIONS)
             {
                 /* A built-in function */
@@ -534,15 +784,13 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                  * We need to save lhs, op, min_precedence, negation flag,
                  * and the function identifier on the stack */
                 if(!fgstack_check_space(mem, sizeof(fn)+sizeof(negate)+sizeof(min_precedence)+
-                        sizeof(op)+sizeof(lhs)+sizeof(state)))
+                        sizeof(op)+sizeof(lhs.u)+sizeof(state)))
                 {
                     return BASIC_ERROR_OUT_OF_MEMORY;
                 }
                 fgstack_push_expression_byte_nocheck(mem, fn);
                 fgstack_push_expression_byte_nocheck(mem, negate);
-                fgstack_push_expression_byte_nocheck(mem, min_precedence);
-                fgstack_push_expression_byte_nocheck(mem, op);
-                fgstack_push_expression(mem, &lhs, sizeof(lhs));
+                push_lhs(mem, min_precedence, op, &lhs);
                 fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_FUNCTIONARG_RET);
                 r = BASIC_PARSING_NOT_FOUND;
                 state = PARSE_EXPR_STATE_EXPRESSION;
@@ -554,14 +802,12 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                  * lhs, op, min_precedence, and the negation flag on the stack */
                 p++;
                 if(!fgstack_check_space(mem, sizeof(negate)+sizeof(min_precedence)+
-                        sizeof(op)+sizeof(lhs)+sizeof(state)))
+                        sizeof(op)+sizeof(lhs.u)+sizeof(state)))
                 {
                     return BASIC_ERROR_OUT_OF_MEMORY;
                 }
                 fgstack_push_expression_byte_nocheck(mem, negate);
-                fgstack_push_expression_byte_nocheck(mem, min_precedence);
-                fgstack_push_expression_byte_nocheck(mem, op);
-                fgstack_push_expression(mem, &lhs, sizeof(lhs));
+                push_lhs(mem, min_precedence, op, &lhs);
                 fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_SUBEXPR_RET);
                 r = BASIC_PARSING_NOT_FOUND;
                 state = PARSE_EXPR_STATE_EXPRESSION;
@@ -576,13 +822,14 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
             /* This is the return point from parenthesized sub-expression parsing.
              * Pop our states and check balance of parentheses */
             val = lhs; /* Store the return value of the sub-expression as a value of the term */
-            fgstack_pop_expression(mem, &lhs, sizeof(lhs));
-            fgstack_pop_expression(mem, &op, sizeof(op));
-            fgstack_pop_expression(mem, &min_precedence, sizeof(min_precedence));
+            pop_lhs(mem, &min_precedence, &op, &lhs);
             fgstack_pop_expression(mem, &negate, sizeof(negate));
             if(negate)
             {
-                val = -val;
+                if(!negate_term(flags, &val))
+                {
+                    return basic_number_error(flags);
+                }
             }
             if(*p != ')')
             {
@@ -599,9 +846,7 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
             /* This is the return point from parenthesized function argument parsing.
              * Pop our states and check balance of parentheses */
             val = lhs; /* Temporarily store the argument value there */
-            fgstack_pop_expression(mem, &lhs, sizeof(lhs));
-            fgstack_pop_expression(mem, &op, sizeof(op));
-            fgstack_pop_expression(mem, &min_precedence, sizeof(min_precedence));
+            pop_lhs(mem, &min_precedence, &op, &lhs);
             fgstack_pop_expression(mem, &negate, sizeof(negate));
             unsigned char fn;
             fgstack_pop_expression(mem, &fn, sizeof(fn));
@@ -613,16 +858,19 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
             p++;
             p = basic_parsing_skipws(p);
             /* Evaluate the actual function */
-            feclearexcept(FE_ALL_EXCEPT);
-            val = eval_function(val, fn); /* Store the result as the value of the term */
-            r = except_to_basic_error();
+            basic_number_clear_errors(flags);
+            val = basic_parsing_function(flags, val, fn); /* Store the result as the value of the term */
+            r = basic_number_error(flags);
             if(r != BASIC_ERROR_OK)
             {
                 return r;
             }
             if(negate)
             {
-                val = -val;
+                if(!negate_term(flags, &val))
+                {
+                    return basic_number_error(flags);
+                }
             }
             /* Return to our caller */
             fgstack_pop_expression(mem, &state, sizeof(state));
@@ -631,16 +879,45 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
         case PARSE_EXPR_STATE_SUBSCRIPT_RET:
         {
             /* This is the return point from parenthesized array subscript parsing.
-             * Validate and round the floating-point value of the subscript expression down */
-            if(lhs < 0.0f || lhs > 32767.0f)
+             * Validate and round the value of the subscript expression down */
+            unsigned subscripts[VARIABLE_ARRAY_MAX_DIMS];
+            unsigned last;
+            if(!basic_value_to_index(lhs, VARIABLE_ARRAY_MAX_SUBSCRIPT, &last))
             {
                 return BASIC_ERROR_PARAMETER;
             }
-            unsigned subscript = floorf(lhs);
+            uint8_t ndims;
+            fgstack_pop_expression(mem, &ndims, sizeof(ndims));
+            subscripts[ndims++] = last;
+            if(*p == ',')
+            {
+                /* Another subscript follows. Keep this one on the stack, and
+                 * set up a "recursive" call to parse the next one */
+                if(ndims == VARIABLE_ARRAY_MAX_DIMS)
+                {
+                    return BASIC_ERROR_SYNTAX;
+                }
+                p++;
+                basic_array_size_t subscript = subscripts[ndims-1];
+                if(!fgstack_check_space(mem, sizeof(subscript)+sizeof(ndims)+sizeof(state)))
+                {
+                    return BASIC_ERROR_OUT_OF_MEMORY;
+                }
+                fgstack_push_expression(mem, &subscript, sizeof(subscript));
+                fgstack_push_expression_byte_nocheck(mem, ndims);
+                fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_SUBSCRIPT_RET);
+                r = BASIC_PARSING_NOT_FOUND;
+                state = PARSE_EXPR_STATE_EXPRESSION;
+                break;
+            }
+            for(unsigned d = ndims - 1; d > 0; d--)
+            {
+                basic_array_size_t subscript;
+                fgstack_pop_expression(mem, &subscript, sizeof(subscript));
+                subscripts[d-1] = subscript;
+            }
             /* Pop our states and check balance of parentheses */
-            fgstack_pop_expression(mem, &lhs, sizeof(lhs));
-            fgstack_pop_expression(mem, &op, sizeof(op));
-            fgstack_pop_expression(mem, &min_precedence, sizeof(min_precedence));
+            pop_lhs(mem, &min_precedence, &op, &lhs);
             fgstack_pop_expression(mem, &negate, sizeof(negate));
             var_name_packed vn;
             fgstack_pop_expression(mem, &vn, sizeof(vn));
@@ -653,21 +930,86 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
             p = basic_parsing_skipws(p);
             /* Get a reference to the array element */
             VARIABLE_VALUE* pval;
-            r = variable_storage_create_array_var(mem, vn, &pval, subscript, false /* dim */);
+            unsigned char type;
+            r = variable_storage_create_array_var(mem, vn, &pval, &type, subscripts, ndims, false /* dim */);
             if(r != BASIC_ERROR_OK)
             {
                 return r;
             }
             /* Read the value */
-            val = pval->f;
+            val = variable_storage_value(pval, type);
             if(negate)
             {
-                val = -val;
+                if(!negate_term(flags, &val))
+                {
+                    return basic_number_error(flags);
+                }
             }
             /* Return to our caller */
             fgstack_pop_expression(mem, &state, sizeof(state));
             break;
         }
+#if BASIC_CONFIG_MAT
+        case PARSE_EXPR_STATE_REDUCTION_RET:
+        {
+            /* This is the return point from the start and count argument parsing
+             * of a reduction function */
+            BASIC_VALUE args[BASIC_MATRIX_REDUCE_MAX_ARGS];
+            uint8_t nargs;
+            fgstack_pop_expression(mem, &nargs, sizeof(nargs));
+            args[nargs++] = lhs;
+            if(*p == ',' && nargs < BASIC_MATRIX_REDUCE_MAX_ARGS)
+            {
+                /* Another argument follows. Keep this one on the stack, and
+                 * set up a "recursive" call to parse the next one */
+                p++;
+                if(!fgstack_check_space(mem, sizeof(lhs)+sizeof(nargs)+sizeof(state)))
+                {
+                    return BASIC_ERROR_OUT_OF_MEMORY;
+                }
+                fgstack_push_expression(mem, &lhs, sizeof(lhs));
+                fgstack_push_expression_byte_nocheck(mem, nargs);
+                fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_REDUCTION_RET);
+                r = BASIC_PARSING_NOT_FOUND;
+                state = PARSE_EXPR_STATE_EXPRESSION;
+                break;
+            }
+            for(unsigned i = nargs - 1; i > 0; i--)
+            {
+                fgstack_pop_expression(mem, &args[i-1], sizeof(args[i-1]));
+            }
+            /* Pop our states and check balance of parentheses */
+            pop_lhs(mem, &min_precedence, &op, &lhs);
+            fgstack_pop_expression(mem, &negate, sizeof(negate));
+            unsigned char fn;
+            fgstack_pop_expression(mem, &fn, sizeof(fn));
+            var_name_packed names[2];
+            fgstack_pop_expression(mem, names, sizeof(names));
+            if(*p != ')')
+            {
+                /* Imbalanced parentheses */
+                return BASIC_ERROR_SYNTAX;
+            }
+            p++;
+            p = basic_parsing_skipws(p);
+            basic_number_t result;
+            if((r = basic_matrix_reduce(mem, fn, names, args, nargs, &result)) != BASIC_ERROR_OK)
+            {
+                return r;
+            }
+            val = basic_value_number(result);
+            if(negate)
+            {
+                if(!negate_term(flags, &val))
+                {
+                    return basic_number_error(flags);
+                }
+            }
+            /* Return to our caller */
+            fgstack_pop_expression(mem, &state, sizeof(state));
+            break;
+        }
+#endif
         case PARSE_EXPR_STATE_FIRST_OPERATOR:
             /* This is the return point from the first call to parse_primary()
              * with the term value in val. We tail-call parse_expression_1 here,
@@ -715,14 +1057,12 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
                 /* Set up a "recursive" call to parse_expression_1(rhs, precedence(op)+1).
                  * We need to push lhs, op, and min_precedence on the stack here */
                 if(!fgstack_check_space(mem, sizeof(min_precedence)+
-                        sizeof(op)+sizeof(lhs)+sizeof(state)))
+                        sizeof(op)+sizeof(lhs.u)+sizeof(state)))
                 {
                     return BASIC_ERROR_OUT_OF_MEMORY;
                 }
 
-                fgstack_push_expression_byte_nocheck(mem, min_precedence);
-                fgstack_push_expression_byte_nocheck(mem, op);
-                fgstack_push_expression(mem, &lhs, sizeof(lhs));
+                push_lhs(mem, min_precedence, op, &lhs);
                 fgstack_push_expression_byte_nocheck(mem, PARSE_EXPR_STATE_PRECEDENCE_DOWN);
                 lhs = rhs;
                 min_precedence = operator_precedence_table[op - BASIC_KEYWORD_RANGE_BEGIN_OPERATORS]+1;
@@ -739,20 +1079,18 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
              * the result of the call is contained in lhs, need to move it to rhs. */
             rhs = lhs;
             /* Pop our state variables from the stack */
-            fgstack_pop_expression(mem, &lhs, sizeof(lhs));
-            fgstack_pop_expression(mem, &op, sizeof(op));
-            fgstack_pop_expression(mem, &min_precedence, sizeof(min_precedence));
+            pop_lhs(mem, &min_precedence, &op, &lhs);
             /* And jump to applying the operator */
             state = PARSE_EXPR_STATE_APPLY_OPERATOR;
             break;
         case PARSE_EXPR_STATE_APPLY_OPERATOR:
-            /* Apply our currently fetched operator to both operands */
-            feclearexcept(FE_ALL_EXCEPT);
-            lhs = apply_operator(lhs, rhs, op);
-            r = except_to_basic_error();
-            if(r != BASIC_ERROR_OK)
+            /* Apply our currently fetched operator to both operands.
+             * Only a number result can have raised an error */
+            basic_number_clear_errors(flags);
+            lhs = apply_operator(flags, lhs, rhs, op);
+            if(!lhs.integer && basic_number_failed(flags))
             {
-                return r;
+                return basic_number_error(flags);
             }
             /* Loop to the outer loop header */
             state = PARSE_EXPR_STATE_EXPR_1;
@@ -771,36 +1109,65 @@ static BASIC_PARSING_RESULT expression_engine_norecurse(const unsigned char** pa
     return r;
 }
 
-BASIC_PARSING_RESULT basic_parsing_expression(const unsigned char** parse_ptr, float* out, BASIC_MEM_MGR* mem)
+BASIC_PARSING_RESULT basic_parsing_value(const unsigned char** parse_ptr, BASIC_VALUE* out, BASIC_MEM_MGR* mem)
 {
+#if BASIC_CONFIG_VM
+    enum BASIC_ERROR_ID eid;
+    if(basic_vm_cached_expression(mem, parse_ptr, out, &eid))
+    {
+        return eid;
+    }
+#endif
     basic_mem_idx_t save_stack_idx = fgstack_get_top(mem);
     BASIC_PARSING_RESULT r = expression_engine_norecurse(parse_ptr, out, mem);
     fgstack_set_top(mem, save_stack_idx);
     return r;
 }
 
-BASIC_PARSING_RESULT basic_parsing_arrayindex(const unsigned char** parse_ptr, unsigned* out, BASIC_MEM_MGR* mem)
+BASIC_PARSING_RESULT basic_parsing_expression(const unsigned char** parse_ptr, basic_number_t* out, BASIC_MEM_MGR* mem)
 {
-    const unsigned char* p = *parse_ptr;
-    p++; /* Skip over the "TAB(" keyword or array index opening brace */
-    float val = 0.0f;
-    BASIC_PARSING_RESULT r = basic_parsing_expression(&p, &val, mem);
-    if(r != BASIC_ERROR_OK)
+    BASIC_VALUE val;
+    BASIC_PARSING_RESULT r = basic_parsing_value(parse_ptr, &val, mem);
+    if(r == BASIC_ERROR_OK && !basic_value_to_number_checked(val, out))
     {
-        return r;
+        r = BASIC_ERROR_OVERFLOW;
     }
-    if(val < 0.0f || val > 32767.0f)
+    return r;
+}
+
+BASIC_PARSING_RESULT basic_parsing_arrayindex(const unsigned char** parse_ptr, unsigned* out, unsigned* count, BASIC_MEM_MGR* mem)
+{
+    const unsigned char* p = *parse_ptr;
+    unsigned n = 0;
+    do
     {
-        return BASIC_ERROR_PARAMETER;
+        if(n == *count)
+        {
+            /* Too many subscripts */
+            return BASIC_ERROR_SYNTAX;
+        }
+        p++; /* Skip over the "TAB(" keyword, the array index opening brace, or a comma */
+        BASIC_VALUE val;
+        BASIC_PARSING_RESULT r = basic_parsing_value(&p, &val, mem);
+        if(r != BASIC_ERROR_OK)
+        {
+            return r;
+        }
+        if(!basic_value_to_index(val, VARIABLE_ARRAY_MAX_SUBSCRIPT, &out[n]))
+        {
+            return BASIC_ERROR_PARAMETER;
+        }
+        n++;
+        p = basic_parsing_skipws(p);
     }
+    while(*p == ',');
     /* Check for a closing bracket */
-    p = basic_parsing_skipws(p);
     if(*p != ')')
     {
         return BASIC_ERROR_SYNTAX;
     }
     p++;
     *parse_ptr = p;
-    *out = floorf(val);
+    *count = n;
     return BASIC_ERROR_OK;
 }
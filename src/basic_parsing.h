@@ -51,16 +51,37 @@ const unsigned char* basic_parsing_skip_to_end_statement(const unsigned char* pa
 
 BASIC_PARSING_RESULT basic_parsing_uint16(const unsigned char** parse_ptr, unsigned* out);
 
-BASIC_PARSING_RESULT basic_parsing_float(const unsigned char** parse_ptr, float* out);
+/* Parse a number literal, negated if negative. Literals written with digits only are
+ * integer literals, if they fit 32 bits */
+BASIC_PARSING_RESULT basic_parsing_literal(const unsigned char** parse_ptr, bool negative, BASIC_VALUE* out);
 
+BASIC_PARSING_RESULT basic_parsing_number(const unsigned char** parse_ptr, basic_number_t* out);
+
+/* Parse a variable name with an optional % suffix, which flags the name as integer */
 BASIC_PARSING_RESULT basic_parsing_varname(const unsigned char** parse_ptr, var_name_packed* out);
 
-BASIC_PARSING_RESULT basic_parsing_variable_ref(const unsigned char** parse_ptr, var_name_packed* pvn, VARIABLE_VALUE** out, BASIC_MEM_MGR* mem);
+/* Parse the name of an array, which cannot be integer */
+BASIC_PARSING_RESULT basic_parsing_array_name(const unsigned char** parse_ptr, var_name_packed* out);
+
+/* The name returned for a scalar variable is flagged if it is integer, by its suffix or by DEFINT.
+ * *type receives the type of the variable or the array element */
+BASIC_PARSING_RESULT basic_parsing_variable_ref(const unsigned char** parse_ptr, var_name_packed* pvn, VARIABLE_VALUE** out, unsigned char* type, BASIC_MEM_MGR* mem);
 
 BASIC_PARSING_RESULT basic_parsing_variable_dim(const unsigned char** parse_ptr, BASIC_MEM_MGR* mem);
 
-BASIC_PARSING_RESULT basic_parsing_variable_val(const unsigned char** parse_ptr, var_name_packed* pvn, float* out, BASIC_MEM_MGR* mem);
+BASIC_PARSING_RESULT basic_parsing_variable_val(const unsigned char** parse_ptr, var_name_packed* pvn, BASIC_VALUE* out, BASIC_MEM_MGR* mem);
+
+/* Parse up to *count comma-separated subscripts in brackets into out[], and store their number in *count */
+BASIC_PARSING_RESULT basic_parsing_arrayindex(const unsigned char** parse_ptr, unsigned* out, unsigned* count, BASIC_MEM_MGR* mem);
+
+/* Binary operators with a higher precedence are applied first */
+unsigned basic_parsing_operator_precedence(unsigned char op);
+
+/* Evaluate a built-in function given by its keyword. SGN, INT, and ABS of an integer are integers */
+BASIC_VALUE basic_parsing_function(basic_number_flags_t* flags, BASIC_VALUE x, unsigned char fn);
 
-BASIC_PARSING_RESULT basic_parsing_arrayindex(const unsigned char** parse_ptr, unsigned* out, BASIC_MEM_MGR* mem);
+/* Evaluate an expression to a number or an integer */
+BASIC_PARSING_RESULT basic_parsing_value(const unsigned char** parse_ptr, BASIC_VALUE* out, BASIC_MEM_MGR* mem);
 
-BASIC_PARSING_RESULT basic_parsing_expression(const unsigned char** parse_ptr, float* out, BASIC_MEM_MGR* mem);
+/* Evaluate an expression to a number */
+BASIC_PARSING_RESULT basic_parsing_expression(const unsigned char** parse_ptr, basic_number_t* out, BASIC_MEM_MGR* mem);
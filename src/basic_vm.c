@@ -0,0 +1,1565 @@
+/*
+ * basic_vm.c
+ *
+ *  Created on: Oct 16, 2026
+
+Copyright (c) 2024 Michael Borisov <https://github.com/mborisov1>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice,
+   this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS “AS IS”
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "basic_vm.h"
+
+#if BASIC_CONFIG_VM
+
+#include "basic_main.h"
+#include "basic_parsing.h"
+#include "basic_matrix.h"
+#include "keywords.h"
+#include <limits.h>
+#include <string.h>
+
+#define IS_DIGIT(c) (c >= '0' && c <= '9')
+#define IS_ALPHA(c) ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+
+/* Opcodes are followed by their 16-bit little-endian or number operands, if any */
+enum VM_OPCODE
+{
+    VM_OP_LINE = 0,     /* Line number. Begins a program line */
+    VM_OP_STMT,         /* Begins a statement other than the first one of a line */
+    VM_OP_HANDOFF,      /* Program index of a statement for the interpreter */
+    VM_OP_END_PROGRAM,
+    VM_OP_CONST,        /* Number value */
+    VM_OP_INT_CONST,    /* Number value, then the 32-bit integer of an integral literal */
+    VM_OP_VAR,          /* Variable name, cache */
+    VM_OP_ARRAY,        /* Array name, subscript count (a single byte). Replaces the subscripts with the element value */
+    VM_OP_FUNCTION,     /* Function keyword (a single byte) */
+    VM_OP_REDUCE,       /* Reduction keyword (a single byte), 2 array names, argument count (a single byte). Replaces the arguments with the result */
+    VM_OP_NEGATE,
+    VM_OP_ADD,          /* Binary operators follow the order of their keywords */
+    VM_OP_SUBTRACT,
+    VM_OP_MULTIPLY,
+    VM_OP_DIVIDE,
+    VM_OP_REF_VAR,      /* Variable name, cache. Selects the variable to store to */
+    VM_OP_REF_ARRAY,    /* Array name, subscript count (a single byte). Pops the subscripts and selects the element to store to */
+    VM_OP_STORE,
+    VM_OP_IF,           /* Comparison bitmap (a single byte), code offset of the next line */
+    VM_OP_GOTO,         /* Line table position */
+    VM_OP_GOSUB,        /* Line table position, program index to return to */
+    VM_OP_RETURN,
+    VM_OP_FOR_DISCARD,  /* Variable name. Discards a running loop of the variable */
+    VM_OP_FOR,          /* Variable name, program index of the loop body. Pops STEP and TO */
+    VM_OP_NEXT,         /* Variable name */
+    VM_OP_END,
+    VM_OP_STOP,
+    VM_OP_CLEAR,
+    VM_OP_RESULT        /* Ends the code of a cached expression with its value */
+};
+
+#define VM_LINE_ENTRY_SIZE 4
+#define VM_CONT_ENTRY_SIZE 4
+#define VM_NO_CONTINUATION UINT_MAX
+
+static inline unsigned get_u16(const unsigned char* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline void put_u16(unsigned char* p, unsigned v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+void basic_vm_initialize(BASIC_VM* vm, void* buf, unsigned size)
+{
+    vm->base = buf;
+    /* Code offsets are 16-bit */
+    vm->size = size > UINT16_MAX ? UINT16_MAX : size;
+    vm->code_idx = vm->cont_idx = 0;
+    vm->line_count = 0;
+    vm->compiled = false;
+}
+
+/* Binary search of a line number in the line table */
+static bool find_line_pos(const BASIC_VM* vm, unsigned line, unsigned* ppos)
+{
+    unsigned lo = 0;
+    unsigned hi = vm->line_count;
+    while(lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        unsigned mid_line = get_u16(vm->base + mid*VM_LINE_ENTRY_SIZE);
+        if(mid_line == line)
+        {
+            *ppos = mid;
+            return true;
+        }
+        if(mid_line < line)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+/* Binary search of a program index in the continuation table */
+static bool find_continuation(const BASIC_VM* vm, unsigned parse_idx, unsigned* pcode_off)
+{
+    unsigned lo = 0;
+    unsigned hi = (vm->size - vm->cont_idx) / VM_CONT_ENTRY_SIZE;
+    while(lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        const unsigned char* entry = vm->base + vm->cont_idx + mid*VM_CONT_ENTRY_SIZE;
+        unsigned mid_idx = get_u16(entry);
+        if(mid_idx == parse_idx)
+        {
+            *pcode_off = get_u16(entry + 2);
+            return true;
+        }
+        if(mid_idx < parse_idx)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return false;
+}
+
+/*-------- Compiler ---------*/
+
+typedef struct VM_COMPILER_
+{
+    BASIC_VM* vm;
+    const BASIC_MEM_MGR* prog;
+    unsigned pos; // Code emission position
+    unsigned depth; // Evaluation stack depth at the emission position
+    unsigned if_chain; // Last IF to be patched with the code offset of the next line, or 0
+    unsigned cont_idx; // Program index that continues the statement being compiled, or VM_NO_CONTINUATION
+    bool overflow; // The code does not fit
+    bool integer_names; // Integer variables are used by the emitted code
+} VM_COMPILER;
+
+enum VM_STATEMENT_RESULT
+{
+    VM_STATEMENT_FAILED = 0, /* Left to the interpreter */
+    VM_STATEMENT_OK,
+    VM_STATEMENT_IF, /* Not followed by a statement separator */
+    VM_STATEMENT_LINE_END /* The rest of the line is not executed */
+};
+
+static void emit_byte(VM_COMPILER* vc, unsigned char b)
+{
+    if(vc->pos < vc->vm->cont_idx)
+    {
+        vc->vm->base[vc->pos] = b;
+    }
+    else
+    {
+        vc->overflow = true;
+    }
+    vc->pos++;
+}
+
+static void emit_u16(VM_COMPILER* vc, unsigned v)
+{
+    emit_byte(vc, v & 0xff);
+    emit_byte(vc, v >> 8);
+}
+
+static void emit_bytes(VM_COMPILER* vc, const void* p, unsigned size)
+{
+    for(unsigned i = 0; i < size; i++)
+    {
+        emit_byte(vc, ((const unsigned char*)p)[i]);
+    }
+}
+
+static void emit_number(VM_COMPILER* vc, basic_number_t f)
+{
+    emit_bytes(vc, &f, sizeof(f));
+}
+
+/* Integral literals also carry their integer, which only typed code reads. A literal
+ * that does not fit the number type is left to the interpreter */
+static bool emit_literal(VM_COMPILER* vc, BASIC_VALUE val, bool negate)
+{
+    if(negate)
+    {
+        /* Literals are not negative, so their negation does not overflow */
+        basic_number_flags_t flags = 0;
+        val = basic_value_neg(&flags, val);
+    }
+    basic_number_t f;
+    if(!basic_value_to_number_checked(val, &f))
+    {
+        return false;
+    }
+    emit_byte(vc, val.integer ? VM_OP_INT_CONST : VM_OP_CONST);
+    emit_number(vc, f);
+    if(val.integer)
+    {
+        emit_bytes(vc, &val.u.i, sizeof(val.u.i));
+    }
+    return true;
+}
+
+static void emit_name(VM_COMPILER* vc, var_name_packed vn)
+{
+    vc->integer_names |= var_name_is_integer(vn);
+    emit_u16(vc, vn);
+}
+
+static void emit_var(VM_COMPILER* vc, unsigned char op, var_name_packed vn)
+{
+    emit_byte(vc, op);
+    emit_name(vc, vn);
+    emit_u16(vc, 0); /* An empty cache */
+}
+
+#if BASIC_CONFIG_MAT
+static void emit_reduce(VM_COMPILER* vc, unsigned char fn, const var_name_packed names[2], unsigned nargs)
+{
+    emit_byte(vc, VM_OP_REDUCE);
+    emit_byte(vc, fn);
+    emit_u16(vc, names[0]);
+    emit_u16(vc, names[1]);
+    emit_byte(vc, nargs);
+}
+#endif
+
+/* Account for a value pushed onto the evaluation stack */
+static bool push_depth(VM_COMPILER* vc)
+{
+    vc->depth++;
+    return vc->depth <= BASIC_VM_STACK_DEPTH;
+}
+
+static unsigned ptr_to_idx(const VM_COMPILER* vc, const unsigned char* p)
+{
+    return prog_storage_ptr_to_idx(vc->prog, p);
+}
+
+/* Insert an entry into the continuation table, which grows down from the end of the buffer */
+static void add_continuation(VM_COMPILER* vc, unsigned parse_idx)
+{
+    BASIC_VM* const vm = vc->vm;
+    if(vc->overflow || vm->cont_idx - vc->pos < VM_CONT_ENTRY_SIZE)
+    {
+        vc->overflow = true;
+        return;
+    }
+    unsigned char* const base = vm->base;
+    unsigned idx = vm->cont_idx;
+    while(idx < vm->size && get_u16(base + idx) < parse_idx)
+    {
+        idx += VM_CONT_ENTRY_SIZE;
+    }
+    memmove(base + vm->cont_idx - VM_CONT_ENTRY_SIZE, base + vm->cont_idx, idx - vm->cont_idx);
+    vm->cont_idx -= VM_CONT_ENTRY_SIZE;
+    put_u16(base + idx - VM_CONT_ENTRY_SIZE, parse_idx);
+    put_u16(base + idx - VM_CONT_ENTRY_SIZE + 2, vc->pos);
+}
+
+typedef struct VM_PENDING_
+{
+    unsigned char type; // A binary operator keyword, or a bracket type
+    bool negate; // Brackets: the bracketed term is negated
+    var_name_packed arg; // Brackets: the function keyword or the array name
+    unsigned char count; // Subscript and reduction brackets: the number of arguments before the current one
+    var_name_packed arrays[2]; // Reduction brackets: the array names
+} VM_PENDING;
+
+enum VM_BRACKET
+{
+    VM_BRACKET_PAREN = 1,
+    VM_BRACKET_FUNCTION,
+    VM_BRACKET_SUBSCRIPT,
+    VM_BRACKET_REDUCTION
+};
+
+#define VM_PENDING_MAX 16
+
+static inline bool is_operator(unsigned char c)
+{
+    return c >= BASIC_KEYWORD_RANGE_BEGIN_OPERATORS && c <= BASIC_KEYWORD_RANGE_END_OPERATORS;
+}
+
+/* Compile an expression into postfix code. The shunting-yard algorithm with
+ * an explicit stack of pending operators and brackets applies the operators
+ * in the same order as the precedence climbing of the expression engine,
+ * and it accepts the same syntax */
+static bool compile_expression(VM_COMPILER* vc, const unsigned char** pp)
+{
+    VM_PENDING pending[VM_PENDING_MAX];
+    unsigned n = 0;
+    const unsigned char* p = *pp;
+    unsigned char c;
+    while(true)
+    {
+        /* Parse a term, or open a bracket in front of a term */
+        bool negate = false;
+        while((p = basic_parsing_skipws(p)), (c = *p))
+        {
+            if(c == BASIC_KEYWORD_MINUS)
+            {
+                negate = !negate;
+            }
+            else if(c != BASIC_KEYWORD_PLUS)
+            {
+                break;
+            }
+            p++;
+        }
+        if(IS_ALPHA(c) || c == BASIC_TOKEN_VARREF)
+        {
+            var_name_packed vn;
+            basic_parsing_varname(&p, &vn);
+            if(*p == '(')
+            {
+                p++;
+                if(n == VM_PENDING_MAX || var_name_is_integer(vn))
+                {
+                    return false;
+                }
+                pending[n++] = (VM_PENDING){.type = VM_BRACKET_SUBSCRIPT, .negate = negate, .arg = vn};
+                continue;
+            }
+            emit_var(vc, VM_OP_VAR, vn);
+            if(negate)
+            {
+                emit_byte(vc, VM_OP_NEGATE);
+            }
+            p = basic_parsing_skipws(p);
+        }
+        else if(c == BASIC_TOKEN_LITERAL)
+        {
+            basic_number_t val;
+            p += prog_storage_read_literal(p, &val);
+            emit_literal(vc, basic_value_number(val), negate);
+            p = basic_parsing_skipws(p);
+        }
+        else if(c == BASIC_TOKEN_INT_LITERAL)
+        {
+            int32_t i;
+            p += prog_storage_read_int_literal(p, &i);
+            if(!emit_literal(vc, basic_value_int_literal(i), negate))
+            {
+                return false;
+            }
+            p = basic_parsing_skipws(p);
+        }
+        else if(IS_DIGIT(c) || c == '.')
+        {
+            /* Literals are parsed once here */
+            BASIC_VALUE val;
+            if(basic_parsing_literal(&p, negate, &val) != BASIC_ERROR_OK || !emit_literal(vc, val, false))
+            {
+                return false;
+            }
+            p = basic_parsing_skipws(p);
+        }
+        else if(c >= BASIC_KEYWORD_RANGE_BEGIN_REDUCTIONS && c <= BASIC_KEYWORD_RANGE_END_REDUCTIONS)
+        {
+#if BASIC_CONFIG_MAT
+            var_name_packed names[2];
+            if(basic_matrix_parse_reduction(&p, names) != BASIC_ERROR_OK)
+            {
+                return false;
+            }
+            if(*p == ',')
+            {
+                /* The start and count arguments follow */
+                p++;
+                if(n == VM_PENDING_MAX)
+                {
+                    return false;
+                }
+                pending[n++] = (VM_PENDING){.type = VM_BRACKET_REDUCTION, .negate = negate, .arg = c,
+                        .arrays = {names[0], names[1]}};
+                continue;
+            }
+            if(*p != ')')
+            {
+                return false;
+            }
+            p++;
+            p = basic_parsing_skipws(p);
+            emit_reduce(vc, c, names, 0);
+            if(negate)
+            {
+                emit_byte(vc, VM_OP_NEGATE);
+            }
+#else
+            return false;
+#endif
+        }
+        else if(c >= BASIC_KEYWORD_RANGE_BEGIN_FUNCTIONS && c <= BASIC_KEYWORD_RANGE_END_FUNCTIONS)
+        {
+            p++;
+            p = basic_parsing_skipws(p);
+            if(*p != '(' || n == VM_PENDING_MAX)
+            {
+                return false;
+            }
+            p++;
+            pending[n++] = (VM_PENDING){.type = VM_BRACKET_FUNCTION, .negate = negate, .arg = c};
+            continue;
+        }
+        else if(c == '(')
+        {
+            p++;
+            if(n == VM_PENDING_MAX)
+            {
+                return false;
+            }
+            pending[n++] = (VM_PENDING){.type = VM_BRACKET_PAREN, .negate = negate};
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+        if(!push_depth(vc))
+        {
+            return false;
+        }
+
+        /* Apply operators and close brackets that follow the term */
+        while(true)
+        {
+            c = *p;
+            if(is_operator(c))
+            {
+                unsigned precedence = basic_parsing_operator_precedence(c);
+                while(n && is_operator(pending[n-1].type) &&
+                        basic_parsing_operator_precedence(pending[n-1].type) >= precedence)
+                {
+                    n--;
+                    emit_byte(vc, VM_OP_ADD + (pending[n].type - BASIC_KEYWORD_PLUS));
+                    vc->depth--;
+                }
+                if(n == VM_PENDING_MAX)
+                {
+                    return false;
+                }
+                pending[n++] = (VM_PENDING){.type = c};
+                p++;
+                break;
+            }
+            /* The end of an expression or a bracketed subexpression */
+            while(n && is_operator(pending[n-1].type))
+            {
+                n--;
+                emit_byte(vc, VM_OP_ADD + (pending[n].type - BASIC_KEYWORD_PLUS));
+                vc->depth--;
+            }
+            if(!n)
+            {
+                *pp = p;
+                return true;
+            }
+            if(c == ',' && pending[n-1].type == VM_BRACKET_SUBSCRIPT &&
+                    pending[n-1].count + 1 < VARIABLE_ARRAY_MAX_DIMS)
+            {
+                /* The subscript stays on the stack, and the next one follows */
+                pending[n-1].count++;
+                p++;
+                break;
+            }
+            if(c == ',' && pending[n-1].type == VM_BRACKET_REDUCTION &&
+                    pending[n-1].count + 1 < BASIC_MATRIX_REDUCE_MAX_ARGS)
+            {
+                pending[n-1].count++;
+                p++;
+                break;
+            }
+            if(c != ')')
+            {
+                return false;
+            }
+            p++;
+            p = basic_parsing_skipws(p);
+            n--;
+            if(pending[n].type == VM_BRACKET_FUNCTION)
+            {
+                emit_byte(vc, VM_OP_FUNCTION);
+                emit_byte(vc, pending[n].arg);
+            }
+            else if(pending[n].type == VM_BRACKET_SUBSCRIPT)
+            {
+                emit_byte(vc, VM_OP_ARRAY);
+                emit_u16(vc, pending[n].arg);
+                emit_byte(vc, pending[n].count + 1);
+                vc->depth -= pending[n].count;
+            }
+#if BASIC_CONFIG_MAT
+            else if(pending[n].type == VM_BRACKET_REDUCTION)
+            {
+                emit_reduce(vc, pending[n].arg, pending[n].arrays, pending[n].count + 1);
+                vc->depth -= pending[n].count;
+            }
+#endif
+            if(pending[n].negate)
+            {
+                emit_byte(vc, VM_OP_NEGATE);
+            }
+        }
+    }
+}
+
+/* Parse the line number argument of GOTO, GOSUB, or THEN, skipping its jump cache slot,
+ * and find the target in the line table */
+static BASIC_PARSING_RESULT compile_jump_target(VM_COMPILER* vc, const unsigned char** pp, unsigned* ppos)
+{
+    const unsigned char* p = *pp;
+    if(*p == BASIC_TOKEN_JUMP_CACHE)
+    {
+        p += PROG_STORAGE_JUMP_CACHE_SIZE;
+    }
+    unsigned line;
+    BASIC_PARSING_RESULT pr = basic_parsing_uint16(&p, &line);
+    if(pr != BASIC_ERROR_OK)
+    {
+        return pr;
+    }
+    if(!find_line_pos(vc->vm, line, ppos))
+    {
+        return BASIC_ERROR_NO_SUCH_LINE;
+    }
+    *pp = p;
+    return BASIC_ERROR_OK;
+}
+
+/* Assignment part of LET and FOR */
+static bool compile_assignment(VM_COMPILER* vc, const unsigned char** pp, var_name_packed* pvn, bool scalar_only)
+{
+    const unsigned char* p = *pp;
+    if(basic_parsing_varname(&p, pvn) != BASIC_ERROR_OK)
+    {
+        return false;
+    }
+    if(*p == '(')
+    {
+        if(scalar_only || var_name_is_integer(*pvn))
+        {
+            return false;
+        }
+        unsigned ndims = 0;
+        do
+        {
+            if(ndims == VARIABLE_ARRAY_MAX_DIMS)
+            {
+                return false;
+            }
+            p++;
+            if(!compile_expression(vc, &p))
+            {
+                return false;
+            }
+            p = basic_parsing_skipws(p);
+            ndims++;
+        }
+        while(*p == ',');
+        if(*p != ')')
+        {
+            return false;
+        }
+        p++;
+        emit_byte(vc, VM_OP_REF_ARRAY);
+        emit_u16(vc, *pvn);
+        emit_byte(vc, ndims);
+        vc->depth -= ndims;
+    }
+    else
+    {
+        emit_var(vc, VM_OP_REF_VAR, *pvn);
+    }
+    p = basic_parsing_skipws(p);
+    if(*p != BASIC_KEYWORD_EQUALS)
+    {
+        return false;
+    }
+    p++;
+    if(!compile_expression(vc, &p))
+    {
+        return false;
+    }
+    emit_byte(vc, VM_OP_STORE);
+    vc->depth--;
+    *pp = p;
+    return true;
+}
+
+static uint8_t compile_for(VM_COMPILER* vc, const unsigned char** pp)
+{
+    const unsigned char* p = *pp;
+    var_name_packed vn;
+    /* FOR with an array element as the loop variable is left to the interpreter */
+    if(!compile_assignment(vc, &p, &vn, true))
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    emit_byte(vc, VM_OP_FOR_DISCARD);
+    emit_name(vc, vn);
+    p = basic_parsing_skipws(p);
+    if(*p != BASIC_KEYWORD_TO)
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    p++;
+    if(!compile_expression(vc, &p))
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    if(*p == BASIC_KEYWORD_STEP)
+    {
+        p++;
+        if(!compile_expression(vc, &p))
+        {
+            return VM_STATEMENT_FAILED;
+        }
+    }
+    else
+    {
+        emit_literal(vc, basic_value_int_literal(1), false);
+        if(!push_depth(vc))
+        {
+            return VM_STATEMENT_FAILED;
+        }
+    }
+    vc->cont_idx = ptr_to_idx(vc, p);
+    emit_byte(vc, VM_OP_FOR);
+    emit_name(vc, vn);
+    emit_u16(vc, vc->cont_idx);
+    vc->depth -= 2;
+    *pp = p;
+    return VM_STATEMENT_OK;
+}
+
+static uint8_t compile_if(VM_COMPILER* vc, const unsigned char** pp)
+{
+    const unsigned char* p = *pp;
+    if(!compile_expression(vc, &p))
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    unsigned char op_bitmap = 0;
+    unsigned char c;
+    while((p = basic_parsing_skipws(p)), (c=*p),
+            c>=BASIC_KEYWORD_RANGE_BEGIN_COMPARISON_OPERATORS &&
+            c<= BASIC_KEYWORD_RANGE_END_COMPARISON_OPERATORS)
+    {
+        op_bitmap |= 1 << (c - BASIC_KEYWORD_RANGE_BEGIN_COMPARISON_OPERATORS);
+        p++;
+    }
+    if(!op_bitmap || !compile_expression(vc, &p))
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    p = basic_parsing_skipws(p);
+    if(*p != BASIC_KEYWORD_THEN)
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    p++;
+    /* A false condition skips to the next line, whose code offset
+     * is not known yet. Link the operand into the chain to patch */
+    emit_byte(vc, VM_OP_IF);
+    emit_byte(vc, op_bitmap);
+    unsigned link = vc->pos;
+    emit_u16(vc, vc->if_chain);
+    vc->if_chain = link;
+    vc->depth -= 2;
+
+    /* THEN followed by a line number is a GOTO */
+    const unsigned char* q = p;
+    unsigned pos;
+    BASIC_PARSING_RESULT pr = compile_jump_target(vc, &q, &pos);
+    if(pr == BASIC_ERROR_OK)
+    {
+        emit_byte(vc, VM_OP_GOTO);
+        emit_u16(vc, pos);
+        return VM_STATEMENT_LINE_END;
+    }
+    else if(pr != BASIC_PARSING_NOT_FOUND)
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    if(*p == BASIC_TOKEN_JUMP_CACHE)
+    {
+        p += PROG_STORAGE_JUMP_CACHE_SIZE;
+    }
+    *pp = p;
+    return VM_STATEMENT_IF;
+}
+
+/* Statements that take no parameters */
+static uint8_t compile_simple(VM_COMPILER* vc, const unsigned char* p, unsigned char op)
+{
+    unsigned char c = *p;
+    if(c && c != ':')
+    {
+        return VM_STATEMENT_FAILED;
+    }
+    emit_byte(vc, op);
+    return VM_STATEMENT_OK;
+}
+
+static uint8_t compile_statement(VM_COMPILER* vc, const unsigned char** pp)
+{
+    const unsigned char* p = *pp;
+    unsigned char c = *p;
+    vc->depth = 0;
+    vc->cont_idx = VM_NO_CONTINUATION;
+    if(c >= BASIC_KEYWORD_RANGE_BEGIN && c != BASIC_TOKEN_VARREF)
+    {
+        p++;
+    }
+    else
+    {
+        c = BASIC_KEYWORD_LET;
+    }
+    p = basic_parsing_skipws(p);
+    uint8_t result = VM_STATEMENT_FAILED;
+    unsigned pos;
+    var_name_packed vn;
+    switch(c)
+    {
+    case BASIC_KEYWORD_LET:
+        result = compile_assignment(vc, &p, &vn, false) ? VM_STATEMENT_OK : VM_STATEMENT_FAILED;
+        break;
+    case BASIC_KEYWORD_FOR:
+        result = compile_for(vc, &p);
+        break;
+    case BASIC_KEYWORD_NEXT:
+        if(basic_parsing_varname(&p, &vn) == BASIC_ERROR_OK)
+        {
+            emit_byte(vc, VM_OP_NEXT);
+            emit_name(vc, vn);
+            result = VM_STATEMENT_OK;
+        }
+        break;
+    case BASIC_KEYWORD_IF:
+        result = compile_if(vc, &p);
+        break;
+    case BASIC_KEYWORD_GOTO:
+        if(compile_jump_target(vc, &p, &pos) == BASIC_ERROR_OK)
+        {
+            emit_byte(vc, VM_OP_GOTO);
+            emit_u16(vc, pos);
+            result = VM_STATEMENT_LINE_END;
+        }
+        break;
+    case BASIC_KEYWORD_GOSUB:
+        if(compile_jump_target(vc, &p, &pos) == BASIC_ERROR_OK)
+        {
+            vc->cont_idx = ptr_to_idx(vc, p);
+            emit_byte(vc, VM_OP_GOSUB);
+            emit_u16(vc, pos);
+            emit_u16(vc, vc->cont_idx);
+            result = VM_STATEMENT_OK;
+        }
+        break;
+    case BASIC_KEYWORD_RETURN:
+        result = compile_simple(vc, p, VM_OP_RETURN);
+        break;
+    case BASIC_KEYWORD_END:
+        result = compile_simple(vc, p, VM_OP_END);
+        break;
+    case BASIC_KEYWORD_STOP:
+        result = compile_simple(vc, p, VM_OP_STOP);
+        break;
+    case BASIC_KEYWORD_CLEAR:
+        result = compile_simple(vc, p, VM_OP_CLEAR);
+        break;
+    case BASIC_KEYWORD_REM:
+        result = VM_STATEMENT_LINE_END;
+        break;
+    case BASIC_KEYWORD_DATA:
+        p = basic_parsing_skip_to_end_statement(p);
+        result = VM_STATEMENT_OK;
+        break;
+    default:
+        /* Everything else is interpreted */
+        break;
+    }
+    *pp = p;
+    return result;
+}
+
+/* Compile the statements of a line, mirroring the statement loop of the interpreter */
+static void compile_line(VM_COMPILER* vc, const unsigned char* p)
+{
+    bool first = true;
+    while(*p)
+    {
+        unsigned save_pos = vc->pos;
+        unsigned save_if_chain = vc->if_chain;
+        const unsigned char* statement = p;
+        if(!first)
+        {
+            /* The first statement is begun by the line */
+            emit_byte(vc, VM_OP_STMT);
+        }
+        first = false;
+        uint8_t result = compile_statement(vc, &p);
+        if(result == VM_STATEMENT_OK && *p && *p != ':')
+        {
+            /* A statement separator is expected here */
+            result = VM_STATEMENT_FAILED;
+        }
+        if(result == VM_STATEMENT_FAILED)
+        {
+            /* Let the interpreter run the rest of the line, including any errors */
+            vc->pos = save_pos;
+            vc->if_chain = save_if_chain;
+            emit_byte(vc, VM_OP_HANDOFF);
+            emit_u16(vc, ptr_to_idx(vc, statement));
+            return;
+        }
+        if(vc->cont_idx != VM_NO_CONTINUATION)
+        {
+            add_continuation(vc, vc->cont_idx);
+        }
+        if(result == VM_STATEMENT_LINE_END)
+        {
+            return;
+        }
+        if(*p)
+        {
+            if(result != VM_STATEMENT_IF)
+            {
+                p++; /* Skip the ':' separator */
+            }
+            p = basic_parsing_skipws(p);
+        }
+    }
+}
+
+bool basic_vm_compile(BASIC_VM* vm, const BASIC_MEM_MGR* prog)
+{
+    if(vm->compiled)
+    {
+        return true;
+    }
+    if(!vm->base)
+    {
+        return false;
+    }
+    unsigned char* const base = vm->base;
+    const unsigned char* const start = prog_storage_get_line_parse_ptr(prog, prog_storage_find_line(prog, 0).idx);
+
+    /* Fill in the line numbers of the line table */
+    unsigned line = 0;
+    unsigned n = 0;
+    const unsigned char* p = start;
+    while(p = prog_storage_advance_line(prog, p, &line), line != UINT_MAX)
+    {
+        if((n+1)*VM_LINE_ENTRY_SIZE > vm->size)
+        {
+            return false;
+        }
+        put_u16(base + n*VM_LINE_ENTRY_SIZE, line);
+        n++;
+        p += strlen((const char*)p);
+    }
+    vm->line_count = n;
+    vm->code_idx = n*VM_LINE_ENTRY_SIZE;
+    vm->cont_idx = vm->size;
+
+    /* Compile the lines one after another, so that each line falls through to the next one */
+    VM_COMPILER vc =
+    {
+        .vm = vm,
+        .prog = prog,
+        .pos = vm->code_idx,
+        .overflow = false,
+        .integer_names = false
+    };
+    line = 0;
+    n = 0;
+    p = start;
+    while(p = prog_storage_advance_line(prog, p, &line), line != UINT_MAX)
+    {
+        put_u16(base + n*VM_LINE_ENTRY_SIZE + 2, vc.pos);
+        emit_byte(&vc, VM_OP_LINE);
+        emit_u16(&vc, line);
+        vc.if_chain = 0;
+        compile_line(&vc, p);
+        /* Patch the IF statements of the line to skip to the next one */
+        while(vc.if_chain && !vc.overflow)
+        {
+            unsigned link = vc.if_chain;
+            vc.if_chain = get_u16(base + link);
+            put_u16(base + link, vc.pos);
+        }
+        n++;
+        p += strlen((const char*)p);
+    }
+    emit_byte(&vc, VM_OP_END_PROGRAM);
+    vm->integer_names = vc.integer_names;
+    vm->compiled = !vc.overflow;
+    return vm->compiled;
+}
+
+/*-------- Virtual machine ---------*/
+
+/* Continue in the interpreter behind a statement that was run by the interpreter,
+ * as it would do itself after returning to that statement */
+static enum BASIC_ERROR_ID resume_interpreter(BASIC_MAIN_STATE* bs, unsigned parse_idx, bool* handoff)
+{
+    const unsigned char* p = prog_storage_idx_to_ptr(&bs->prog, parse_idx);
+    unsigned char c = *p;
+    if(c)
+    {
+        if(c != ':')
+        {
+            /* Statement separator is expected here */
+            return BASIC_ERROR_SYNTAX;
+        }
+        p = basic_parsing_skipws(p + 1);
+    }
+    bs->parse_ptr = p;
+    *handoff = true;
+    return BASIC_ERROR_OK;
+}
+
+/* The run loop is instantiated for numbers only and for typed values */
+#ifdef __GNUC__
+#define VM_INSTANTIATED inline __attribute__((always_inline))
+#else
+#define VM_INSTANTIATED inline
+#endif
+
+/* The variable name at pc. Without typed values, DEFINT has declared no letters */
+static inline var_name_packed code_name(const BASIC_MEM_MGR* prog, const unsigned char* pc, bool typed)
+{
+    return typed ? variable_storage_scalar_name(prog, get_u16(pc)) : get_u16(pc);
+}
+
+/* Run the code at pc, which is in the buffer at base. The code of a cached expression
+ * runs without the interpreter state (bs is NULL), and only its RESULT opcode
+ * stores to *result. Unless typed is set, all values are numbers, and their type
+ * is neither checked nor stored on the stack */
+static VM_INSTANTIATED enum BASIC_ERROR_ID execute_values(BASIC_MAIN_STATE* bs, BASIC_MEM_MGR* prog,
+        unsigned char* base, unsigned char* pc, bool* handoff, BASIC_VALUE* result, const bool typed)
+{
+    basic_number_flags_t* const flags = &prog->number_flags;
+    BASIC_VALUE stack[BASIC_VM_STACK_DEPTH];
+    BASIC_VALUE* sp = stack;
+    VARIABLE_VALUE* ref = NULL;
+    unsigned char ref_type = VARIABLE_TYPE_NUMBER;
+    enum BASIC_ERROR_ID eid;
+
+    while(true)
+    {
+        switch(*pc++)
+        {
+        case VM_OP_LINE:
+            bs->current_line = get_u16(pc);
+            pc += 2;
+            /* Fall through */
+        case VM_OP_STMT:
+            if(basic_callback_check_break_key())
+            {
+                return BASIC_ERROR_STOP;
+            }
+            break;
+        case VM_OP_HANDOFF:
+            bs->parse_ptr = prog_storage_idx_to_ptr(prog, get_u16(pc));
+            *handoff = true;
+            return BASIC_ERROR_OK;
+        case VM_OP_END_PROGRAM:
+            bs->current_line = UINT_MAX;
+            return BASIC_ERROR_OK;
+        case VM_OP_CONST:
+            memcpy(&sp->u.f, pc, sizeof(basic_number_t));
+            if(typed)
+            {
+                sp->integer = false;
+            }
+            sp++;
+            pc += sizeof(basic_number_t);
+            break;
+        case VM_OP_INT_CONST:
+            if(typed)
+            {
+                int32_t i;
+                memcpy(&i, pc + sizeof(basic_number_t), sizeof(i));
+                *sp++ = basic_value_int_literal(i);
+            }
+            else
+            {
+                memcpy(&sp->u.f, pc, sizeof(basic_number_t));
+                sp++;
+            }
+            pc += sizeof(basic_number_t) + sizeof(int32_t);
+            break;
+        case VM_OP_VAR:
+        {
+            unsigned cache = get_u16(pc + 2);
+            var_name_packed vn = code_name(prog, pc, typed);
+            VARIABLE_VALUE* pval = variable_storage_lookup_var_cached(prog, vn, &cache);
+            put_u16(pc + 2, cache);
+            if(typed && var_name_is_integer(vn))
+            {
+                *sp++ = basic_value_int(pval ? pval->i : 0);
+            }
+            else
+            {
+                /* All variables read as zero until initialized otherwise */
+                sp->u.f = pval ? pval->f : 0;
+                if(typed)
+                {
+                    sp->integer = false;
+                }
+                sp++;
+            }
+            pc += 4;
+            break;
+        }
+        case VM_OP_ARRAY:
+        case VM_OP_REF_ARRAY:
+        {
+            unsigned ndims = pc[2];
+            unsigned subscripts[VARIABLE_ARRAY_MAX_DIMS];
+            sp -= ndims;
+            for(unsigned d = 0; d < ndims; d++)
+            {
+                if(typed ? !basic_value_to_index(sp[d], VARIABLE_ARRAY_MAX_SUBSCRIPT, &subscripts[d]) :
+                        !basic_number_to_index(sp[d].u.f, VARIABLE_ARRAY_MAX_SUBSCRIPT, &subscripts[d]))
+                {
+                    return BASIC_ERROR_PARAMETER;
+                }
+            }
+            VARIABLE_VALUE* pval;
+            unsigned char type;
+            eid = variable_storage_create_array_var(prog, get_u16(pc), &pval, &type, subscripts, ndims, false);
+            if(eid != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            if(pc[-1] == VM_OP_ARRAY)
+            {
+                if(typed)
+                {
+                    *sp++ = variable_storage_value(pval, type);
+                }
+                else
+                {
+                    /* Without typed arrays, all elements are numbers */
+                    (sp++)->u.f = pval->f;
+                }
+            }
+            else
+            {
+                ref = pval;
+                ref_type = type;
+            }
+            pc += 3;
+            break;
+        }
+        case VM_OP_FUNCTION:
+            if(!typed)
+            {
+                sp[-1].integer = false;
+            }
+            sp[-1] = basic_parsing_function(flags, sp[-1], *pc++);
+            if(!sp[-1].integer && basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+#if BASIC_CONFIG_MAT
+        case VM_OP_REDUCE:
+        {
+            unsigned nargs = pc[5];
+            const var_name_packed names[2] = {get_u16(pc + 1), get_u16(pc + 3)};
+            basic_number_t reduced;
+            sp -= nargs;
+            for(unsigned i = 0; i < nargs && !typed; i++)
+            {
+                sp[i].integer = false;
+            }
+            eid = basic_matrix_reduce(prog, pc[0], names, sp, nargs, &reduced);
+            if(eid != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            *sp++ = basic_value_number(reduced);
+            pc += 6;
+            break;
+        }
+#endif
+        case VM_OP_NEGATE:
+            if(typed)
+            {
+                sp[-1] = basic_value_neg(flags, sp[-1]);
+                if(sp[-1].integer)
+                {
+                    break;
+                }
+            }
+            else
+            {
+                sp[-1].u.f = basic_number_neg(flags, sp[-1].u.f);
+            }
+            if(basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+        case VM_OP_ADD:
+            sp--;
+            /* Numbers are computed in place, which is faster than copying the values */
+            if(!typed || !(sp[-1].integer | sp[0].integer))
+            {
+                sp[-1].u.f = basic_number_add(flags, sp[-1].u.f, sp[0].u.f);
+            }
+            else
+            {
+                sp[-1] = basic_value_add(flags, sp[-1], sp[0]);
+                if(sp[-1].integer)
+                {
+                    break;
+                }
+            }
+            if(basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+        case VM_OP_SUBTRACT:
+            sp--;
+            if(!typed || !(sp[-1].integer | sp[0].integer))
+            {
+                sp[-1].u.f = basic_number_sub(flags, sp[-1].u.f, sp[0].u.f);
+            }
+            else
+            {
+                sp[-1] = basic_value_sub(flags, sp[-1], sp[0]);
+                if(sp[-1].integer)
+                {
+                    break;
+                }
+            }
+            if(basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+        case VM_OP_MULTIPLY:
+            sp--;
+            if(!typed || !(sp[-1].integer | sp[0].integer))
+            {
+                sp[-1].u.f = basic_number_mul(flags, sp[-1].u.f, sp[0].u.f);
+            }
+            else
+            {
+                sp[-1] = basic_value_mul(flags, sp[-1], sp[0]);
+                if(sp[-1].integer)
+                {
+                    break;
+                }
+            }
+            if(basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+        case VM_OP_DIVIDE:
+            sp--;
+            if(!typed || !(sp[-1].integer | sp[0].integer))
+            {
+                sp[-1].u.f = basic_number_div(flags, sp[-1].u.f, sp[0].u.f);
+            }
+            else
+            {
+                sp[-1] = basic_value_div(flags, sp[-1], sp[0]);
+                if(sp[-1].integer)
+                {
+                    break;
+                }
+            }
+            if(basic_number_failed(flags))
+            {
+                return basic_number_error(flags);
+            }
+            break;
+        case VM_OP_REF_VAR:
+        {
+            unsigned cache = get_u16(pc + 2);
+            var_name_packed vn = code_name(prog, pc, typed);
+            ref = variable_storage_create_var_cached(prog, vn, &cache);
+            if(!ref)
+            {
+                return BASIC_ERROR_OUT_OF_MEMORY;
+            }
+            ref_type = typed ? var_name_type(vn) : VARIABLE_TYPE_NUMBER;
+            put_u16(pc + 2, cache);
+            pc += 4;
+            break;
+        }
+        case VM_OP_STORE:
+            sp--;
+            if(!typed || (ref_type == VARIABLE_TYPE_NUMBER && !sp->integer))
+            {
+                ref->f = sp->u.f;
+                break;
+            }
+            eid = variable_storage_assign(ref, ref_type, *sp);
+            if(eid != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            break;
+        case VM_OP_IF:
+        {
+            sp -= 2;
+            unsigned char cmp_bitmap;
+            if(!typed || !(sp[0].integer | sp[1].integer))
+            {
+                basic_number_t lhs = sp[0].u.f;
+                basic_number_t rhs = sp[1].u.f;
+                cmp_bitmap =
+                        (lhs >  rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, GREATER) |
+                        (lhs == rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, EQUALS) |
+                        (lhs <  rhs) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, LESS);
+            }
+            else
+            {
+                unsigned relation = basic_value_compare(sp[0], sp[1]);
+                cmp_bitmap =
+                        ((relation & BASIC_VALUE_GREATER) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, GREATER) |
+                        ((relation & BASIC_VALUE_EQUAL) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, EQUALS) |
+                        ((relation & BASIC_VALUE_LESS) != 0) << KEYWORD_RANGE_OFFSET(COMPARISON_OPERATORS, LESS);
+            }
+            if(pc[0] & cmp_bitmap)
+            {
+                pc += 3;
+            }
+            else
+            {
+                /* Skip to the next line */
+                pc = base + get_u16(pc + 1);
+            }
+            break;
+        }
+        case VM_OP_GOTO:
+            pc = base + get_u16(base + get_u16(pc)*VM_LINE_ENTRY_SIZE + 2);
+            break;
+        case VM_OP_GOSUB:
+        {
+            FGS_ENTRY_GOSUB eg =
+            {
+                .line = bs->current_line,
+                .parse_idx = get_u16(pc + 2)
+            };
+            if(!fgstack_push_gosub(prog, &eg))
+            {
+                return BASIC_ERROR_OUT_OF_MEMORY;
+            }
+            pc = base + get_u16(base + get_u16(pc)*VM_LINE_ENTRY_SIZE + 2);
+            break;
+        }
+        case VM_OP_RETURN:
+        {
+            FGS_ENTRY_GOSUB ge;
+            if(!fgstack_pop_gosub(prog, &ge))
+            {
+                return BASIC_ERROR_RETURN_WITHOUT_GOSUB;
+            }
+            bs->current_line = ge.line;
+            unsigned code_off;
+            if(!find_continuation(&bs->vm, ge.parse_idx, &code_off))
+            {
+                /* The GOSUB was run by the interpreter */
+                return resume_interpreter(bs, ge.parse_idx, handoff);
+            }
+            pc = base + code_off;
+            break;
+        }
+        case VM_OP_FOR_DISCARD:
+            if(fgstack_find_for(prog, code_name(prog, pc, typed)))
+            {
+                fgstack_pop_for(prog);
+            }
+            pc += 2;
+            break;
+        case VM_OP_FOR:
+        {
+            FGS_ENTRY_FOR fe;
+            BASIC_VALUE step = *--sp;
+            BASIC_VALUE to_val = *--sp;
+            if(!typed)
+            {
+                step.integer = to_val.integer = false;
+            }
+            fe.vn = code_name(prog, pc, typed);
+            fe.parse_idx = get_u16(pc + 2);
+            fe.line = bs->current_line;
+            VARIABLE_VALUE* pval = variable_storage_create_var(prog, fe.vn);
+            if(!pval)
+            {
+                return BASIC_ERROR_OUT_OF_MEMORY;
+            }
+            fe.var_idx = (const unsigned char*)pval - prog->base;
+            eid = fgstack_for_setup(&fe, pval, to_val, step);
+            if(eid != BASIC_ERROR_OK)
+            {
+                return eid;
+            }
+            if(!fgstack_push_for(prog, &fe))
+            {
+                return BASIC_ERROR_OUT_OF_MEMORY;
+            }
+            pc += 4;
+            break;
+        }
+        case VM_OP_NEXT:
+        {
+            FGS_ENTRY_FOR* fe = fgstack_find_for(prog, code_name(prog, pc, typed));
+            if(!fe)
+            {
+                return BASIC_ERROR_NEXT_WITHOUT_FOR;
+            }
+            pc += 2;
+            VARIABLE_VALUE* pval = (VARIABLE_VALUE*)(prog->base + fe->var_idx);
+            if(fgstack_for_next(fe, pval, flags))
+            {
+                if(basic_number_failed(flags))
+                {
+                    /* The interpreter does not check the increment */
+                    basic_number_clear_errors(flags);
+                }
+                bs->current_line = fe->line;
+                unsigned code_off;
+                if(!find_continuation(&bs->vm, fe->parse_idx, &code_off))
+                {
+                    /* The FOR was run by the interpreter */
+                    return resume_interpreter(bs, fe->parse_idx, handoff);
+                }
+                pc = base + code_off;
+            }
+            else
+            {
+                fgstack_pop_for(prog);
+            }
+            break;
+        }
+        case VM_OP_END:
+            return BASIC_ERROR_OK;
+        case VM_OP_STOP:
+            return BASIC_ERROR_STOP;
+        case VM_OP_CLEAR:
+            variable_storage_clear(prog);
+            fgstack_clear(prog);
+            break;
+        case VM_OP_RESULT:
+            *result = sp[-1];
+            if(!typed)
+            {
+                result->integer = false;
+            }
+            return BASIC_ERROR_OK;
+        default:
+            /* Defensive programming - this should never happen */
+            return BASIC_ERROR_INTERNAL;
+        }
+    }
+}
+
+/* Values are typed only when integer variables or typed arrays may be used.
+ * DEFINT and DIM are run by the interpreter, so the types do not change in between */
+static enum BASIC_ERROR_ID execute(BASIC_MAIN_STATE* bs, BASIC_MEM_MGR* prog, unsigned char* base,
+        unsigned char* pc, bool* handoff, BASIC_VALUE* result, bool integer_names)
+{
+    if(integer_names || prog->int_letters || prog->typed_arrays)
+    {
+        return execute_values(bs, prog, base, pc, handoff, result, true);
+    }
+    return execute_values(bs, prog, base, pc, handoff, result, false);
+}
+
+enum BASIC_ERROR_ID basic_vm_run(BASIC_MAIN_STATE* bs, bool* handoff)
+{
+    BASIC_VM* const vm = &bs->vm;
+    unsigned pos;
+
+    *handoff = false;
+    if(!find_line_pos(vm, bs->current_line, &pos))
+    {
+        /* Defensive programming - all lines are compiled */
+        *handoff = true;
+        return BASIC_ERROR_OK;
+    }
+    bs->error_in_data = false;
+    /* Arithmetic errors are detected by testing the error flags after each operation */
+    basic_number_clear_errors(&bs->prog.number_flags);
+    return execute(bs, &bs->prog, vm->base, vm->base + get_u16(vm->base + pos*VM_LINE_ENTRY_SIZE + 2), handoff, NULL,
+            vm->integer_names);
+}
+
+/*-------- Expression cache ---------*/
+
+#define VM_CACHE_ENTRY_SIZE 4
+
+void basic_vm_expr_cache_initialize(BASIC_EXPR_CACHE* c, void* buf, unsigned size)
+{
+    /* Code offsets are 16-bit */
+    c->size = size > UINT16_MAX ? UINT16_MAX : size;
+    /* The table takes up to a quarter of the buffer, which leaves about 16 bytes of code
+     * for each expression when the table is filled */
+    c->slots = 1;
+    while(c->slots * 2 * 4 * VM_CACHE_ENTRY_SIZE <= c->size)
+    {
+        c->slots *= 2;
+    }
+    c->base = c->size >= 64 ? buf : NULL;
+    c->count = 0;
+    basic_expr_cache_invalidate(c);
+}
+
+/* Linear probing in the hash table. Returns false and the free entry for the key
+ * if the key is not found */
+static bool find_cache_entry(const BASIC_EXPR_CACHE* c, unsigned key, unsigned* ppos)
+{
+    unsigned pos = key & (c->slots - 1);
+    unsigned k;
+    while((k = get_u16(c->base + pos*VM_CACHE_ENTRY_SIZE)) != key)
+    {
+        if(!k)
+        {
+            break;
+        }
+        pos = (pos + 1) & (c->slots - 1);
+    }
+    *ppos = pos;
+    return k != 0;
+}
+
+/* Compile an expression after the code in the cache. Returns the code offset,
+ * or 0 if it is left to the expression engine */
+static unsigned compile_cached(BASIC_EXPR_CACHE* c, const BASIC_MEM_MGR* prog, const unsigned char* p)
+{
+    /* The code is emitted as if the cache were a program buffer without a continuation table */
+    BASIC_VM area =
+    {
+        .base = c->base,
+        .size = c->size,
+        .cont_idx = c->size
+    };
+    VM_COMPILER vc =
+    {
+        .vm = &area,
+        .prog = prog,
+        .pos = c->code_idx + 2,
+        .overflow = false,
+        .integer_names = false
+    };
+    const unsigned char* const start = p;
+    if(!compile_expression(&vc, &p))
+    {
+        return 0;
+    }
+    emit_byte(&vc, VM_OP_RESULT);
+    if(vc.overflow)
+    {
+        /* The cache is full */
+        return 0;
+    }
+    unsigned code = c->code_idx;
+    put_u16(c->base + code, p - start);
+    c->code_idx = vc.pos;
+    c->integer_names |= vc.integer_names;
+    return code;
+}
+
+bool basic_vm_cached_expression(BASIC_MEM_MGR* mem, const unsigned char** parse_ptr,
+        BASIC_VALUE* out, enum BASIC_ERROR_ID* eid)
+{
+    BASIC_EXPR_CACHE* const c = &mem->expr_cache;
+    const unsigned char* const p = *parse_ptr;
+    if(!c->base || !prog_storage_is_program_ptr(mem, p))
+    {
+        return false;
+    }
+    if(!c->code_idx)
+    {
+        memset(c->base, 0, c->slots*VM_CACHE_ENTRY_SIZE);
+        c->count = 0;
+        c->code_idx = c->slots*VM_CACHE_ENTRY_SIZE;
+        c->integer_names = false;
+    }
+    unsigned key = prog_storage_ptr_to_idx(mem, p);
+    unsigned pos;
+    unsigned code;
+    if(find_cache_entry(c, key, &pos))
+    {
+        code = get_u16(c->base + pos*VM_CACHE_ENTRY_SIZE + 2);
+    }
+    else
+    {
+        /* A quarter of the table stays free, so that the probe sequences are short */
+        if(c->count == c->slots - c->slots/4)
+        {
+            return false;
+        }
+        /* An expression that is not compiled is remembered as well, so that it is compiled only once */
+        code = compile_cached(c, mem, p);
+        put_u16(c->base + pos*VM_CACHE_ENTRY_SIZE, key);
+        put_u16(c->base + pos*VM_CACHE_ENTRY_SIZE + 2, code);
+        c->count++;
+    }
+    if(!code)
+    {
+        return false;
+    }
+    /* The code tests the arithmetic error flags after each operation. Clearing them
+     * is slower than testing them on some hosts */
+    if(basic_number_failed(&mem->number_flags))
+    {
+        basic_number_clear_errors(&mem->number_flags);
+    }
+    bool handoff;
+    *eid = execute(NULL, mem, c->base, c->base + code + 2, &handoff, out, c->integer_names);
+    if(*eid == BASIC_ERROR_OK)
+    {
+        *parse_ptr = p + get_u16(c->base + code);
+    }
+    return true;
+}
+
+#endif /* BASIC_CONFIG_VM */
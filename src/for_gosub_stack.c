@@ -33,55 +33,78 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include "for_gosub_stack.h"
 #include <string.h>
-#include <stddef.h>
 #include <stdlib.h>
 
-enum FGS_ENTRY_TAGS
-{
-    FGS_TAG_FOR = 0,
-    FGS_TAG_GOSUB
-};
+#include <stdint.h>
+
+/* Frames are aligned, and their sizes are multiples of the alignment,
+ * so that all frames above the first one are aligned without padding */
+#define FGS_FRAME_ALIGN 4
+#define FGS_FRAME_SIZE(T) ((sizeof(T) + FGS_FRAME_ALIGN - 1) & ~(unsigned)(FGS_FRAME_ALIGN - 1))
 
 void fgstack_initialize(BASIC_MEM_MGR* s, void* base, unsigned size)
 {
     s->base = base;
     s->free_idx = 0;
-    s->max_idx = size;
-    s->stktop_idx = size;
+    s->max_idx = s->data_idx = s->ram_top_idx = basic_mem_top(base, size);
+    s->data_index_valid = false;
+    s->stktop_idx = s->max_idx;
+    s->gosub_depth = 0;
+    s->number_flags = 0;
 }
 
 void fgstack_clear(BASIC_MEM_MGR* s)
 {
     s->stktop_idx = s->max_idx;
+    s->gosub_depth = 0;
 }
 
-static bool fgstack_push(BASIC_MEM_MGR* s, const void* in, uint8_t tag, unsigned size)
+static void* push_frame(BASIC_MEM_MGR* s, unsigned size)
 {
-    if(s->stktop_idx - s->free_idx < size + 1)
+    basic_mem_idx_t top = s->stktop_idx - ((uintptr_t)(s->base + s->stktop_idx) & (FGS_FRAME_ALIGN - 1));
+    if(top < s->free_idx || top - s->free_idx < size)
     {
         /* Not enough free stack space */
-        return false;
+        return NULL;
     }
-    s->stktop_idx -= size + 1;
-    s->base[s->stktop_idx] = tag;
-    memcpy(s->base + s->stktop_idx + 1, in, size);
-
-    return true;
+    s->stktop_idx = top - size;
+    return s->base + s->stktop_idx;
 }
 
 bool fgstack_push_gosub(BASIC_MEM_MGR* s, const FGS_ENTRY_GOSUB* in)
 {
-    return fgstack_push(s, in, FGS_TAG_GOSUB, sizeof(FGS_ENTRY_GOSUB));
+    FGS_ENTRY_GOSUB* ge = push_frame(s, FGS_FRAME_SIZE(FGS_ENTRY_GOSUB));
+    if(!ge)
+    {
+        return false;
+    }
+    *ge = *in;
+    /* Link the frame to the enclosing GOSUB frame */
+    ge->link = s->gosub_depth;
+    s->gosub_depth = s->max_idx - s->stktop_idx;
+    return true;
 }
 
 bool fgstack_push_for(BASIC_MEM_MGR* s, const FGS_ENTRY_FOR* in)
 {
-    return fgstack_push(s, in, FGS_TAG_FOR, sizeof(FGS_ENTRY_FOR));
+    FGS_ENTRY_FOR* fe = push_frame(s, FGS_FRAME_SIZE(FGS_ENTRY_FOR));
+    if(!fe)
+    {
+        return false;
+    }
+    *fe = *in;
+    return true;
+}
+
+void fgstack_pop_for(BASIC_MEM_MGR* s)
+{
+    s->stktop_idx += FGS_FRAME_SIZE(FGS_ENTRY_FOR);
 }
 
 bool fgstack_push_expression(BASIC_MEM_MGR* s, const void* in, unsigned size)
 {
-    /* Expression entries are pushed without tags to save space */
+    /* Expression entries are pushed without alignment to save space.
+     * They are popped before any frame is pushed or looked up */
     if(s->stktop_idx - s->free_idx < size)
     {
         /* Not enough free stack space */
@@ -106,69 +129,115 @@ void fgstack_pop_expression(BASIC_MEM_MGR* s, void* out, unsigned size)
 
 bool fgstack_pop_gosub(BASIC_MEM_MGR* s, FGS_ENTRY_GOSUB* out)
 {
-    basic_mem_idx_t idx = s->stktop_idx;
-    while(idx < s->max_idx - sizeof(FGS_ENTRY_GOSUB))
+    if(!s->gosub_depth)
+    {
+        /* No GOSUB frame. Leave the stack untouched and return error */
+        return false;
+    }
+    basic_mem_idx_t idx = s->max_idx - s->gosub_depth;
+    const FGS_ENTRY_GOSUB* ge = (const FGS_ENTRY_GOSUB*)(s->base + idx);
+    *out = *ge;
+    s->gosub_depth = ge->link;
+    /* Pop it together with all FOR frames of the subroutine */
+    s->stktop_idx = idx + FGS_FRAME_SIZE(FGS_ENTRY_GOSUB);
+    return true;
+}
+
+FGS_ENTRY_FOR* fgstack_find_for(BASIC_MEM_MGR* s, var_name_packed vn)
+{
+    /* Only FOR frames lie above the innermost GOSUB frame, or above the bottom
+     * of the stack. Scan them until the one with the given variable name is found */
+    basic_mem_idx_t end = s->gosub_depth ? s->max_idx - s->gosub_depth :
+            s->max_idx - ((uintptr_t)(s->base + s->max_idx) & (FGS_FRAME_ALIGN - 1));
+    for(basic_mem_idx_t idx = s->stktop_idx; idx < end; idx += FGS_FRAME_SIZE(FGS_ENTRY_FOR))
     {
-        /* Check entry type */
-        if(s->base[idx] == FGS_TAG_GOSUB)
+        FGS_ENTRY_FOR* fe = (FGS_ENTRY_FOR*)(s->base + idx);
+        if(fe->vn == vn)
         {
-            /* Found a GOSUB entry - return it and pop it from the stack */
-            memcpy(out, s->base + idx + 1, sizeof(FGS_ENTRY_GOSUB));
-            idx += sizeof(FGS_ENTRY_GOSUB) + 1;
+            /* Found the desired variable entry. Pop all entries scanned before it */
             s->stktop_idx = idx;
-            return true;
+            return fe;
         }
-        else if(s->base[idx] == FGS_TAG_FOR && idx < s->max_idx - sizeof(FGS_ENTRY_FOR))
-        {
-            /* Found a FOR entry - discard it. Break all FOR loops of the subroutine */
-            idx += sizeof(FGS_ENTRY_FOR) + 1;
-        }
-        else
+    }
+    return NULL;
+}
+
+/* The limit or the step of a loop on an integer variable. They are limited, so that
+ * the counter does not overflow when it is incremented by the step */
+static bool loop_int(BASIC_VALUE v, int32_t* out)
+{
+    int32_t i;
+    if(!basic_value_to_int(v, &i) || i <= -0x40000000 || i >= 0x40000000)
+    {
+        return false;
+    }
+    *out = i;
+    return true;
+}
+
+enum BASIC_ERROR_ID fgstack_for_setup(FGS_ENTRY_FOR* fe, const VARIABLE_VALUE* var, BASIC_VALUE to_val, BASIC_VALUE step)
+{
+    if(var_name_is_integer(fe->vn))
+    {
+        if(!loop_int(to_val, &fe->u.i.to_val) || !loop_int(step, &fe->u.i.step))
         {
-            /* Unknown entry type or insufficient size.
-             * TODO: return an internal error status */
-            return false;
+            return BASIC_ERROR_OVERFLOW;
         }
+        fe->direction = fe->u.i.step > 0 ? 1 : fe->u.i.step < 0 ? -1 : 0;
+        fe->integer = true;
+        fe->u.i.count = var->i;
+        memcpy(&fe->u.i.var_bits, var, sizeof(fe->u.i.var_bits));
+        return BASIC_ERROR_OK;
     }
-    /* No suitable GOSUB entry found. Leave the stack untouched and return error */
-    return false;
+    basic_number_t to_num;
+    basic_number_t step_num;
+    if(!basic_value_to_number_checked(to_val, &to_num) || !basic_value_to_number_checked(step, &step_num))
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    fe->direction = step_num > 0 ? 1 : step_num < 0 ? -1 : 0;
+    fe->integer = basic_number_to_int(var->f, &fe->u.i.count) &&
+            basic_number_to_int(to_num, &fe->u.i.to_val) &&
+            basic_number_to_int(step_num, &fe->u.i.step);
+    if(fe->integer)
+    {
+        memcpy(&fe->u.i.var_bits, var, sizeof(fe->u.i.var_bits));
+    }
+    else
+    {
+        fe->u.f.to_val = to_num;
+        fe->u.f.step = step_num;
+    }
+    return BASIC_ERROR_OK;
 }
 
-bool fgstack_lookup_for(BASIC_MEM_MGR* s, FGS_ENTRY_FOR* out, var_name_packed vn)
+bool fgstack_for_next_slow(FGS_ENTRY_FOR* fe, VARIABLE_VALUE* var, basic_number_flags_t* flags)
 {
-    /* Scan FOR entries up the stack until the one with the given variable
-     * name is found. If found, returns its contents and pops all scanned entries
-     * including the given one. True is returned.
-     * If not found or if a GOSUB entry is encountered, returns false without
-     * touching the stack */
-    basic_mem_idx_t idx = s->stktop_idx;
-    while(idx < s->max_idx - sizeof(FGS_ENTRY_FOR))
+    if(fe->integer)
     {
-        /* Check entry type */
-        if(s->base[idx] == FGS_TAG_FOR)
+        /* The loop body has changed the variable. Keep counting from its new value
+         * if it is integral, otherwise continue as a non-integral loop */
+        if(var_name_is_integer(fe->vn))
         {
-            /* Found a FOR entry - check variable name */
-            var_name_packed vn_cmp;
-            memcpy(&vn_cmp, s->base + idx + 1 + offsetof(FGS_ENTRY_FOR, vn), sizeof(var_name_packed));
-            if(vn == vn_cmp)
-            {
-                /* Found the desired variable entry - return its contents to the caller */
-                memcpy(out, (FGS_ENTRY_FOR*)(s->base + idx + 1), sizeof(FGS_ENTRY_FOR));
-                s->stktop_idx = idx + sizeof(FGS_ENTRY_FOR) + 1; /* Pop all scanned entries including the found one */
-                return true;
-            }
-            else
-            {
-                /* Wrong variable - keep scanning */
-            }
-            idx += sizeof(FGS_ENTRY_FOR) + 1;
+            fe->u.i.count = var->i;
+            memcpy(&fe->u.i.var_bits, var, sizeof(fe->u.i.var_bits));
+            return fgstack_for_next(fe, var, flags);
         }
-        else
+        if(basic_number_to_int(var->f, &fe->u.i.count))
         {
-            /* A GOSUB entry */
-            return false;
+            memcpy(&fe->u.i.var_bits, var, sizeof(fe->u.i.var_bits));
+            return fgstack_for_next(fe, var, flags);
         }
+        basic_number_t to_val = basic_number_from_int(flags, fe->u.i.to_val);
+        basic_number_t step = basic_number_from_int(flags, fe->u.i.step);
+        fe->u.f.to_val = to_val;
+        fe->u.f.step = step;
+        fe->integer = false;
+    }
+    if(fe->direction > 0 ? var->f < fe->u.f.to_val : fe->direction < 0 && var->f > fe->u.f.to_val)
+    {
+        var->f = basic_number_add(flags, var->f, fe->u.f.step);
+        return true;
     }
-    /* Stack is empty or filled by less than a FOR entry */
     return false;
 }
@@ -46,9 +46,10 @@ const char* keyword_text_table[] =
 };
 
 /* In-place line tokenizer */
-void keywords_tokenize_line(char* s)
+bool keywords_tokenize_line(char* s)
 {
     char* so = s; /* Begin writing to where we are reading. The line could only get shorter */
+    bool valid = true;
     unsigned char c;
     while((c = *s))
     {
@@ -80,6 +81,11 @@ void keywords_tokenize_line(char* s)
                     break;
                 }
             }
+            if(c >= BASIC_TOKEN_RANGE_BEGIN)
+            {
+                /* The parser would take it for an internal token */
+                valid = false;
+            }
             *so = c;
             so++;
             s++;
@@ -96,4 +102,5 @@ void keywords_tokenize_line(char* s)
     }
     /* Null-terminate the output */
     *so = '\0';
+    return valid;
 }
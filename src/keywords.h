@@ -33,6 +33,8 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #pragma once
 
+#include <stdbool.h>
+
 #define KEYWORDS_INSTANTIATE(X, XFIRST, XALT, XMARK) \
     XFIRST(END) \
     XMARK(END, RANGE_BEGIN) \
@@ -82,8 +84,33 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
     X(SQR) \
     X(RND) \
     X(SIN) \
-    XMARK(SIN, RANGE_END_FUNCTIONS) \
-    XMARK(SIN, RANGE_END)
+    X(SUM) \
+    XMARK(SUM, RANGE_BEGIN_REDUCTIONS) \
+    X(MIN) \
+    X(MAX) \
+    X(MEAN) \
+    X(DOT) \
+    XMARK(DOT, RANGE_END_REDUCTIONS) \
+    XMARK(DOT, RANGE_END_FUNCTIONS) \
+    X(SAVE) \
+    XMARK(SAVE, RANGE_BEGIN_GENERAL_EXT) \
+    X(LOAD) \
+    X(MAT) \
+    X(DEFINT) \
+    XMARK(DEFINT, RANGE_END_GENERAL_EXT) \
+    X(ZER) \
+    XMARK(ZER, RANGE_BEGIN_MATRIX) \
+    X(CON) \
+    X(IDN) \
+    X(TRN) \
+    XMARK(TRN, RANGE_END_MATRIX) \
+    X(AS) \
+    X(BYTE) \
+    XMARK(BYTE, RANGE_BEGIN_ARRAY_TYPES) \
+    X(SHORT) \
+    X(LONG) \
+    XMARK(LONG, RANGE_END_ARRAY_TYPES) \
+    XMARK(LONG, RANGE_END)
 
 #define DEFINE_KEYWORD_ID(ID) BASIC_KEYWORD_##ID,
 #define DEFINE_KEYWORD_ID_ALT(ID, ALTTEXT) BASIC_KEYWORD_##ID,
@@ -102,8 +129,20 @@ enum BASIC_KEYWORD_ID
 
 #define KEYWORD_RANGE_OFFSET(RANGE, ID) (BASIC_KEYWORD_##ID - BASIC_KEYWORD_RANGE_BEGIN_##RANGE)
 
-/* In-place line tokenizer */
-void keywords_tokenize_line(char* s);
+/* Internal tokens are never produced by the tokenizer. They are inserted
+ * into stored program lines by the program storage and are invisible in LIST */
+enum BASIC_INTERNAL_TOKEN_ID
+{
+    BASIC_TOKEN_INT_LITERAL = 0xFC, /* Followed by 5 bytes of a pre-parsed integer and the number text */
+    BASIC_TOKEN_VARREF = 0xFD, /* Followed by 2 bytes of a cached variable position and the variable name */
+    BASIC_TOKEN_LITERAL = 0xFE, /* Followed by 5 bytes of a pre-parsed number and the number text */
+    BASIC_TOKEN_JUMP_CACHE = 0xFF /* Followed by 3 bytes of a resolved jump target index */
+};
+#define BASIC_TOKEN_RANGE_BEGIN BASIC_TOKEN_INT_LITERAL
+
+/* In-place line tokenizer. Returns false if the line has bytes of the internal tokens
+ * outside strings and remarks, which is a syntax error */
+bool keywords_tokenize_line(char* s);
 
 
 extern const char* keyword_text_table[];
@@ -33,7 +33,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 
 #include "program_storage.h"
 #include "keywords.h"
+#include "basic_parsing.h"
+#include "variable_storage.h"
 #include <string.h>
+#include <limits.h>
 #include "basic_stdio.h"
 
 void prog_storage_clear(BASIC_MEM_MGR* prog)
@@ -45,37 +48,154 @@ void prog_storage_clear(BASIC_MEM_MGR* prog)
                      it pretends to be the end marker of the previous line */
     pb[1] = '\0'; /* 2-byte sentinel as a program-end marker */
     pb[2] = '\0';
-    prog->free_idx = prog->array_idx = prog->vars_idx = 3; /* The sentinels on both sides count */
+    /* The sentinels on both sides count. The line index and the variables are empty */
+    prog->vars_idx = prog->index_idx = 3;
+    variable_storage_clear(prog);
+    prog->jump_cache_dirty = false;
+#if BASIC_CONFIG_VM
+    basic_expr_cache_invalidate(&prog->expr_cache);
+#endif
+    /* Detach the program in ROM, if any */
+    prog->rom = NULL;
+    prog->rom_index_idx = prog->rom_size = 0;
 }
 
 void prog_storage_initialize(BASIC_MEM_MGR* prog, void* base, unsigned max_size)
 {
     unsigned char* pb = (unsigned char*)base;
     prog->base = pb;
-    prog->max_idx = max_size;
-    prog->stktop_idx = max_size;
+    prog->max_idx = prog->data_idx = prog->ram_top_idx = basic_mem_top(base, max_size);
+    prog->data_index_valid = false;
+    prog->number_flags = 0;
+#if BASIC_CONFIG_VM
+    prog->expr_cache.base = NULL;
+#endif
+    prog->stktop_idx = prog->max_idx;
+    prog->gosub_depth = 0;
     prog_storage_clear(prog);
 }
 
 
-FIND_LINE_RESULT prog_storage_find_line(const BASIC_MEM_MGR* prog, unsigned line)
+static inline unsigned get_u16(const unsigned char* p)
+{
+    return p[0] | p[1] << 8;
+}
+
+static inline void put_u16(unsigned char* p, unsigned v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static inline unsigned index_size(const BASIC_MEM_MGR* prog)
+{
+    /* Number of lines in the program = number of line index entries */
+    return (prog->vars_idx - prog->index_idx) / 2;
+}
+
+/* Binary search in the line index of a program area (in RAM or in ROM).
+ * Returns the position of the first index entry whose line number is greater
+ * than or equal to the given one, or the number of index entries if there is no such line */
+static unsigned find_area_index_pos(const unsigned char* area, unsigned index_idx, unsigned n, unsigned line)
+{
+    const unsigned char* pidx = area + index_idx;
+    unsigned lo = 0;
+    unsigned hi = n;
+    while(lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        unsigned line_no = get_u16(area + get_u16(pidx + mid*2) + 2);
+        if(line_no < line)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static unsigned find_index_pos(const BASIC_MEM_MGR* prog, unsigned line)
+{
+    return find_area_index_pos(prog->base, prog->index_idx, index_size(prog), line);
+}
+
+static FIND_LINE_RESULT index_pos_to_result(const BASIC_MEM_MGR* prog, unsigned pos, unsigned line)
 {
     const unsigned char* cpb = prog->base;
     FIND_LINE_RESULT r;
-    r.idx = 1; /* Skip over the sentinel at program start */
-    r.found = false;
+    if(pos < index_size(prog))
+    {
+        r.idx = get_u16(cpb + prog->index_idx + pos*2);
+        r.found = get_u16(cpb + r.idx + 2) == line;
+    }
+    else
+    {
+        /* Past the last line - point at the program-end marker */
+        r.idx = prog->index_idx - 2;
+        r.found = false;
+    }
+    return r;
+}
+
+/* Line number of a line record, or LINE_NUMBER_END for the program-end marker */
+#define LINE_NUMBER_END 0x10000u
+static inline unsigned record_line(const unsigned char* p)
+{
+    return get_u16(p) ? get_u16(p+2) : LINE_NUMBER_END;
+}
 
-    while(cpb[r.idx] || cpb[r.idx+1])
+/* Offset of the first line in a program area with the number greater than or equal
+ * to the given one, or of the program-end marker of the area */
+static unsigned area_find_line(const unsigned char* area, unsigned index_idx, unsigned area_size, unsigned line)
+{
+    unsigned n = (area_size - index_idx) / 2;
+    unsigned pos = find_area_index_pos(area, index_idx, n, line);
+    return pos < n ? get_u16(area + index_idx + pos*2) : index_idx - 2;
+}
+
+/* Merge the lines of the program in ROM with the RAM overlay, starting from the given
+ * line records in both areas. RAM lines override ROM lines with the same number,
+ * and empty RAM lines delete them. Returns the index of the first remaining line,
+ * or of the program-end marker in RAM */
+static unsigned merge_lines(const BASIC_MEM_MGR* prog, unsigned rom_idx, unsigned ram_idx)
+{
+    const unsigned char* rom = prog->rom;
+    const unsigned char* cpb = prog->base;
+    while(true)
     {
-        unsigned nxt_idx = cpb[r.idx] | cpb[r.idx+1] << 8;
-        unsigned line_no = cpb[r.idx+2] | cpb[r.idx+3] << 8;
-        if(line_no >= line)
+        unsigned rom_line = record_line(rom + rom_idx);
+        unsigned ram_line = record_line(cpb + ram_idx);
+        if(rom_line < ram_line)
+        {
+            return rom_idx;
+        }
+        if(ram_line == LINE_NUMBER_END || get_u16(cpb + ram_idx) > 5)
+        {
+            return prog->rom_size + ram_idx;
+        }
+        /* An empty line in RAM hides the line in ROM */
+        if(rom_line == ram_line)
         {
-            r.found = line_no == line;
-            return r;
+            rom_idx += get_u16(rom + rom_idx);
         }
-        r.idx = nxt_idx;
+        ram_idx += get_u16(cpb + ram_idx);
     }
+}
+
+FIND_LINE_RESULT prog_storage_find_line(const BASIC_MEM_MGR* prog, unsigned line)
+{
+    if(!prog->rom)
+    {
+        return index_pos_to_result(prog, find_index_pos(prog, line), line);
+    }
+    FIND_LINE_RESULT r;
+    r.idx = merge_lines(prog,
+            area_find_line(prog->rom, prog->rom_index_idx, prog->rom_size, line),
+            area_find_line(prog->base, prog->index_idx, prog->vars_idx, line));
+    r.found = record_line(prog_storage_idx_to_ptr(prog, r.idx)) == line;
     return r;
 }
 
@@ -84,11 +204,28 @@ const unsigned char* prog_storage_get_line_parse_ptr(const BASIC_MEM_MGR* prog,
     /* Back up 1 byte to pretend that we are just finishing execution
      * of the previous line, where a zero line-end marker is found.
      * For the first line of the program, the sentinel zero byte is here. */
-    return prog->base + line_idx - 1;
+    return prog_storage_idx_to_ptr(prog, line_idx) - 1;
 }
 
 const unsigned char* prog_storage_advance_line(const BASIC_MEM_MGR* prog, const unsigned char* parse_ptr, unsigned* pline)
 {
+    if(prog->rom)
+    {
+        /* The line that physically follows in the same area competes with the lines
+         * of the other area that follow the current line number */
+        unsigned idx = prog_storage_ptr_to_idx(prog, parse_ptr + 1);
+        unsigned next_line = *pline + 1;
+        if(idx < prog->rom_size)
+        {
+            idx = merge_lines(prog, idx, area_find_line(prog->base, prog->index_idx, prog->vars_idx, next_line));
+        }
+        else
+        {
+            idx = merge_lines(prog, area_find_line(prog->rom, prog->rom_index_idx, prog->rom_size, next_line),
+                    idx - prog->rom_size);
+        }
+        parse_ptr = prog_storage_get_line_parse_ptr(prog, idx);
+    }
     /* parse_ptr is now standing either on the sentinel byte at the start of the program,
      * or at the end of a line. We need to get to the next line if it exists
      */
@@ -106,46 +243,417 @@ const unsigned char* prog_storage_advance_line(const BASIC_MEM_MGR* prog, const
     return parse_ptr;
 }
 
-static void rebuild_list(BASIC_MEM_MGR* prog)
+enum LINE_SCAN_STATE
 {
-    unsigned char* cpb = prog->base;
+    LINE_SCAN_CODE = 0,
+    LINE_SCAN_STRING,
+    LINE_SCAN_REMARK
+};
+
+/* Track whether a character of a stored line is code, or belongs to a string literal
+ * or a remark, where tokens must not be interpreted */
+static inline uint8_t line_scan_update(uint8_t state, unsigned char c)
+{
+    switch(state)
+    {
+    case LINE_SCAN_CODE:
+        if(c == '\"')
+        {
+            return LINE_SCAN_STRING;
+        }
+        return c == BASIC_KEYWORD_REM ? LINE_SCAN_REMARK : LINE_SCAN_CODE;
+    case LINE_SCAN_STRING:
+        return c == '\"' ? LINE_SCAN_CODE : LINE_SCAN_STRING;
+    default:
+        return state;
+    }
+}
+
+static inline bool is_jump_cache(const unsigned char* p)
+{
+    /* Check the payload bytes as well. The short-circuit evaluation
+     * never reads past a null terminator */
+    return p[0] == BASIC_TOKEN_JUMP_CACHE && (p[1] & 0x80) && (p[2] & 0x80) && (p[3] & 0x80);
+}
+
+static inline unsigned get_jump_cache(const unsigned char* p)
+{
+    return (p[1] & 0x7f) | (p[2] & 0x7f) << 7 | (p[3] & 0x7f) << 14;
+}
+
+static void put_jump_cache(unsigned char* p, unsigned line_idx)
+{
+    /* 7 bits per byte with the high bit set, so that the slot never contains a null byte */
+    p[0] = BASIC_TOKEN_JUMP_CACHE;
+    p[1] = 0x80 | (line_idx & 0x7f);
+    p[2] = 0x80 | ((line_idx >> 7) & 0x7f);
+    p[3] = 0x80 | ((line_idx >> 14) & 0x7f);
+}
+
+/* Size of a literal token with its value, but without its text */
+static inline unsigned literal_token_size(unsigned char token)
+{
+    return token == BASIC_TOKEN_INT_LITERAL ? PROG_STORAGE_INT_LITERAL_SIZE : PROG_STORAGE_LITERAL_SIZE;
+}
+
+static inline unsigned literal_size(const unsigned char* p)
+{
+    return literal_token_size(p[0]);
+}
 
-    unsigned idx = 1; /* Skip over the sentinel byte at the beginning */
+static inline bool is_literal(const unsigned char* p)
+{
+    if(p[0] != BASIC_TOKEN_LITERAL && p[0] != BASIC_TOKEN_INT_LITERAL)
+    {
+        return false;
+    }
+    unsigned size = literal_size(p);
+    for(unsigned i = 1; i < size; i++)
+    {
+        if(!(p[i] & 0x80))
+        {
+            return false;
+        }
+    }
+    /* The length of the text is never zero */
+    return (p[size - 1] & 0x70) != 0;
+}
+
+static void put_literal(unsigned char* p, unsigned char token, basic_number_bits_t bits, unsigned text_len)
+{
+    unsigned size = literal_token_size(token);
+    p[0] = token;
+    for(unsigned i = 1; i < size - 1; i++)
+    {
+        p[i] = 0x80 | (bits & 0x7f);
+        bits >>= 7;
+    }
+    p[size - 1] = 0x80 | text_len << 4 | (bits & 0x0f);
+}
 
+static inline bool is_varref(const unsigned char* p)
+{
+    return p[0] == BASIC_TOKEN_VARREF && (p[1] & 0x80) && (p[2] & 0x80) &&
+            ((p[3] >= 'A' && p[3] <= 'Z') || (p[3] >= 'a' && p[3] <= 'z'));
+}
+
+static void put_varref(unsigned char* p, unsigned cache)
+{
+    p[0] = BASIC_TOKEN_VARREF;
+    p[1] = 0x80 | (cache & 0x7f);
+    p[2] = 0x80 | ((cache >> 7) & 0x7f);
+}
+
+/* Size of the internal token at p in a code part of a line, or 0 if there is none.
+ * The text of a literal or a variable name is included */
+static inline unsigned internal_token_size(const unsigned char* p)
+{
+    if(is_varref(p))
+    {
+        return PROG_STORAGE_VARREF_SIZE + (p[4] >= '0' && p[4] <= '9' ? 2 : 1);
+    }
+    if(is_jump_cache(p))
+    {
+        return PROG_STORAGE_JUMP_CACHE_SIZE;
+    }
+    if(is_literal(p))
+    {
+        unsigned size = literal_size(p);
+        return size + ((p[size - 1] >> 4) & 0x07);
+    }
+    return 0;
+}
+
+/* Reset all jump cache slots in the program to the unresolved state */
+static void reset_jump_caches(BASIC_MEM_MGR* prog)
+{
+    unsigned char* cpb = prog->base;
+    unsigned idx = 1;
     while(cpb[idx] || cpb[idx+1])
     {
-        /* There is some non-null next pointer. It may be invalid,
-         * but it means that the end of program has not yet been reached */
+        unsigned char* p = cpb + idx + 4;
+        uint8_t state = LINE_SCAN_CODE;
+        while(*p)
+        {
+            unsigned n = state == LINE_SCAN_CODE ? internal_token_size(p) : 0;
+            if(n)
+            {
+                if(is_jump_cache(p))
+                {
+                    put_jump_cache(p, 0);
+                }
+                p += n;
+            }
+            else
+            {
+                state = line_scan_update(state, *p);
+                p++;
+            }
+        }
+        idx += get_u16(cpb + idx);
+    }
+    prog->jump_cache_dirty = false;
+}
+
+unsigned prog_storage_read_jump_cache(BASIC_MEM_MGR* prog, const unsigned char* slot)
+{
+    if(prog->jump_cache_dirty)
+    {
+        /* The program has been edited since the slots were filled in.
+         * Invalidate all of them at once */
+        reset_jump_caches(prog);
+        return 0;
+    }
+    if(prog_storage_is_rom_ptr(prog, slot) && prog->vars_idx != prog->index_idx)
+    {
+        /* Jump targets resolved in ROM are only valid while the overlay is empty */
+        return 0;
+    }
+    return get_jump_cache(slot);
+}
 
-        /* Skip over "next index" and "line number" fields, and scan the line until
-         * its null terminator */
-        unsigned len = strlen((const char*)cpb+idx+4);
-        /* Now we know the line length. Set the next-line pointer in it */
-        unsigned nxt_idx = idx + 4 + len + 1;
-        cpb[idx] = nxt_idx & 0xff;
-        cpb[idx+1] = nxt_idx >> 8;
-        idx = nxt_idx;
+void prog_storage_write_jump_cache(BASIC_MEM_MGR* prog, const unsigned char* slot, unsigned line_idx)
+{
+    if(!prog_storage_is_rom_ptr(prog, slot))
+    {
+        put_jump_cache(prog->base + (slot - prog->base), line_idx);
     }
 }
 
-bool prog_storage_store_line(BASIC_MEM_MGR* prog, unsigned line, const char* content)
+void prog_storage_write_varref(BASIC_MEM_MGR* prog, const unsigned char* p, unsigned cache)
+{
+    if(!prog_storage_is_rom_ptr(prog, p) && cache < 1u << 14)
+    {
+        put_varref(prog->base + (p - prog->base), cache);
+    }
+}
+
+/* A number literal is an expression term, and may follow these tokens.
+ * Line numbers after GOTO, RUN, etc. are parsed as integers and never follow them */
+static bool literal_may_follow(unsigned char c)
+{
+    return (c >= BASIC_KEYWORD_RANGE_BEGIN_OPERATORS && c <= BASIC_KEYWORD_RANGE_END_COMPARISON_OPERATORS) ||
+            c == '(' || c == ',' || c == ';' || c == BASIC_KEYWORD_TAB || c == BASIC_KEYWORD_TO ||
+            c == BASIC_KEYWORD_STEP || c == BASIC_KEYWORD_IF || c == BASIC_KEYWORD_PRINT ||
+            c == BASIC_KEYWORD_DATA;
+}
+
+/* Skip over the text of a number literal that cannot be pre-parsed */
+static const unsigned char* skip_literal_text(const unsigned char* p)
+{
+    unsigned char c;
+    while((c = *p), (c >= '0' && c <= '9') || c == '.' || c == ' ' || c == 'E' || c == 'e' ||
+            c == BASIC_KEYWORD_PLUS || c == BASIC_KEYWORD_MINUS)
+    {
+        p++;
+    }
+    return p;
+}
+
+static inline bool is_alnum(unsigned char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+#if BASIC_CONFIG_VARREFS
+/* Get the length of the variable name at p, or 0 if it is not to be marked.
+ * Only names that the parser reads the same way without the token are marked */
+static unsigned varref_name_length(const unsigned char* p)
+{
+    if(p[1] >= '0' && p[1] <= '9')
+    {
+        return is_alnum(p[2]) ? 0 : 2;
+    }
+    if(is_alnum(p[1]))
+    {
+        return 0;
+    }
+    /* The parser allows blanks between the letter and the digit */
+    const unsigned char* q = p + 1;
+    while(*q == ' ')
+    {
+        q++;
+    }
+    return *q >= '0' && *q <= '9' ? 0 : 1;
+}
+#endif
+
+/* Copy a tokenized line into the program storage, inserting empty jump cache slots
+ * after the GOTO, GOSUB, and THEN keywords that are followed by a line number,
+ * literal tokens in front of number literals in expressions, and variable
+ * reference tokens in front of variable names if BASIC_CONFIG_VARREFS is set.
+ * The internal tokens of the input are only kept if it is annotated already,
+ * which is the case for lines copied from a validated image.
+ * Returns the resulting length. If out is null, only the length is computed */
+static unsigned annotate_line(unsigned char* out, const unsigned char* in, bool annotated)
+{
+    unsigned len = 0;
+    uint8_t state = LINE_SCAN_CODE;
+    unsigned char prev = 0; /* The last non-blank code character */
+    unsigned char c;
+    while((c = *in))
+    {
+        if(state == LINE_SCAN_CODE)
+        {
+            unsigned n = annotated ? internal_token_size(in) : 0;
+            if(n)
+            {
+                if(out)
+                {
+                    memcpy(out + len, in, n);
+                    if(is_jump_cache(in))
+                    {
+                        /* The target is resolved again in the new program */
+                        put_jump_cache(out + len, 0);
+                    }
+                }
+                len += n;
+                prev = is_literal(in) ? '0' : is_varref(in) ? 'A' : prev;
+                in += n;
+                continue;
+            }
+#if BASIC_CONFIG_VARREFS
+            if(((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z')) && !is_alnum(prev) && prev != '.' &&
+                    (n = varref_name_length(in)))
+            {
+                if(out)
+                {
+                    put_varref(out + len, 0);
+                    memcpy(out + len + PROG_STORAGE_VARREF_SIZE, in, n);
+                }
+                len += PROG_STORAGE_VARREF_SIZE + n;
+                prev = 'A';
+                in += n;
+                continue;
+            }
+#endif
+            if(((c >= '0' && c <= '9') || c == '.') && literal_may_follow(prev))
+            {
+                const unsigned char* p = in;
+                BASIC_VALUE val;
+                if(basic_parsing_literal(&p, false, &val) == BASIC_ERROR_OK)
+                {
+                    /* The parser skips trailing blanks */
+                    while(p[-1] == ' ')
+                    {
+                        p--;
+                    }
+                    n = p - in;
+                    if(n <= PROG_STORAGE_LITERAL_MAX_TEXT)
+                    {
+                        unsigned char token = val.integer ? BASIC_TOKEN_INT_LITERAL : BASIC_TOKEN_LITERAL;
+                        basic_number_bits_t bits = (uint32_t)val.u.i;
+                        if(!val.integer)
+                        {
+                            memcpy(&bits, &val.u.f, sizeof(bits));
+                        }
+                        if(out)
+                        {
+                            put_literal(out + len, token, bits, n);
+                        }
+                        len += literal_token_size(token);
+                    }
+                }
+                else
+                {
+                    /* Leave it for the parser to report the error */
+                    p = skip_literal_text(in);
+                    n = p - in;
+                }
+                if(out)
+                {
+                    memcpy(out + len, in, n);
+                }
+                len += n;
+                prev = '0';
+                in = p;
+                continue;
+            }
+        }
+        if(out)
+        {
+            out[len] = c;
+        }
+        len++;
+        in++;
+        if(state == LINE_SCAN_CODE &&
+                (c == BASIC_KEYWORD_GOTO || c == BASIC_KEYWORD_GOSUB || c == BASIC_KEYWORD_THEN))
+        {
+            const unsigned char* p = in;
+            while(*p == ' ')
+            {
+                p++;
+            }
+            if(*p >= '0' && *p <= '9')
+            {
+                if(out)
+                {
+                    put_jump_cache(out + len, 0);
+                }
+                len += PROG_STORAGE_JUMP_CACHE_SIZE;
+            }
+        }
+        if(state == LINE_SCAN_CODE && c != ' ')
+        {
+            prev = c;
+        }
+        state = line_scan_update(state, c);
+    }
+    return len;
+}
+
+static void move_vars(BASIC_MEM_MGR* prog, int delta)
+{
+    prog->vars_idx += delta;
+    prog->free_idx += delta;
+}
+
+/* Add delta to line index entries starting from the given position */
+static void adjust_index(BASIC_MEM_MGR* prog, unsigned pos, int delta)
+{
+    unsigned char* pidx = prog->base + prog->index_idx;
+    unsigned n = index_size(prog);
+    for(unsigned i = pos; i < n; i++)
+    {
+        put_u16(pidx + i*2, get_u16(pidx + i*2) + delta);
+    }
+}
+
+static bool store_line(BASIC_MEM_MGR* prog, unsigned line, const char* content, bool annotated)
 {
     unsigned char* pb = prog->base;
-    FIND_LINE_RESULT fl = prog_storage_find_line(prog, line);
+    /* Deleting a line of the program in ROM stores an empty line in the overlay */
+    bool in_rom = prog->rom &&
+            record_line(prog->rom + area_find_line(prog->rom, prog->rom_index_idx, prog->rom_size, line)) == line;
+    unsigned pos = find_index_pos(prog, line);
+    FIND_LINE_RESULT fl = index_pos_to_result(prog, pos, line);
+#if BASIC_CONFIG_VM
+    /* Compiled expressions are found by their position in the program */
+    basic_expr_cache_invalidate(&prog->expr_cache);
+#endif
     if(fl.found)
     {
-        /* Remove an existing line first */
-        unsigned nxt_idx = pb[fl.idx] | pb[fl.idx+1] << 8;
+        /* Remove an existing line first, together with its line index entry */
+        unsigned rsize = get_u16(pb + fl.idx);
+        unsigned nxt_idx = fl.idx + rsize;
         memmove(pb+fl.idx, pb+nxt_idx, prog->vars_idx-nxt_idx);
-        prog->vars_idx -= nxt_idx - fl.idx;
-        prog->array_idx -= nxt_idx - fl.idx;
-        prog->free_idx -= nxt_idx - fl.idx;
+        prog->index_idx -= rsize;
+        move_vars(prog, -(int)rsize);
+        unsigned char* pidx = pb + prog->index_idx;
+        memmove(pidx + pos*2, pidx + pos*2 + 2, prog->vars_idx - prog->index_idx - pos*2 - 2);
+        move_vars(prog, -2);
+        adjust_index(prog, pos, -(int)rsize);
+    }
+    if(fl.found || pos < index_size(prog) || prog->rom)
+    {
+        /* Lines have moved or hidden lines in ROM, which invalidates resolved jump targets */
+        prog->jump_cache_dirty = true;
     }
-    unsigned len = strlen(content);
-    if(len)
+    unsigned len = annotate_line(0, (const unsigned char*)content, annotated);
+    if(len || in_rom)
     {
-        /* Only insert if the new line is nonempty */
-        if(!basic_mem_check_space(prog, len + 5))
+        /* Only insert if the new line is nonempty, or hides a line in ROM */
+        if(!basic_mem_check_space(prog, len + 5 + 2) || prog->rom_size + prog->index_idx + len + 5 > UINT16_MAX)
         {
             /* Out of memory!
              * TODO: do not delete the old line if the new one
@@ -154,23 +662,372 @@ bool prog_storage_store_line(BASIC_MEM_MGR* prog, unsigned line, const char* con
         }
 
         memmove(pb+fl.idx+len+5, pb+fl.idx, prog->vars_idx-fl.idx);
-        pb[fl.idx] = 0xff; /* Put something nonzero here to not confuse for program end marker */
+        put_u16(pb + fl.idx, len+5); /* The link to the next line is relative, so that no other links change */
         pb[fl.idx+2] = line & 0xff;
         pb[fl.idx+3] = line >> 8;
-        memcpy(pb+fl.idx+4, content, len+1); /* Also copy the null terminator */
-        prog->vars_idx += len+5;
-        prog->array_idx += len+5;
-        prog->free_idx += len+5;
+        annotate_line(pb+fl.idx+4, (const unsigned char*)content, annotated);
+        pb[fl.idx+4+len] = '\0';
+        prog->index_idx += len+5;
+        move_vars(prog, len+5);
+        /* Insert a line index entry, shifting the entries of the following lines */
+        adjust_index(prog, pos, len+5);
+        unsigned char* pidx = pb + prog->index_idx;
+        memmove(pidx + pos*2 + 2, pidx + pos*2, prog->vars_idx - prog->index_idx - pos*2);
+        put_u16(pidx + pos*2, fl.idx);
+        move_vars(prog, 2);
+    }
+    return true;
+}
+
+bool prog_storage_store_line(BASIC_MEM_MGR* prog, unsigned line, const char* content)
+{
+    return store_line(prog, line, content, false);
+}
+
+/* Fletcher-16 checksum */
+static unsigned image_checksum(const unsigned char* p, unsigned size)
+{
+    unsigned s1 = 0;
+    unsigned s2 = 0;
+    while(size--)
+    {
+        s1 = (s1 + *p++) % 255;
+        s2 = (s2 + s1) % 255;
+    }
+    return s2 << 8 | s1;
+}
+
+unsigned prog_storage_image_header(BASIC_MEM_MGR* prog, unsigned char* header)
+{
+    if(prog->jump_cache_dirty)
+    {
+        /* Do not save stale jump targets */
+        reset_jump_caches(prog);
+    }
+    const unsigned char* cpb = prog->base;
+    header[0] = 'u';
+    header[1] = 'C';
+    header[2] = 'B';
+    header[3] = PROG_STORAGE_IMAGE_VERSION;
+    header[4] = BASIC_KEYWORD_RANGE_END - BASIC_KEYWORD_RANGE_BEGIN + 1;
+    header[5] = BASIC_CONFIG_NUMBER;
+    put_u16(header + 6, prog->index_idx);
+    put_u16(header + 8, prog->vars_idx);
+    put_u16(header + 10, image_checksum(cpb, prog->vars_idx));
+    return prog->vars_idx;
+}
+
+/* Check that the code of a line in an image has no token bytes other than
+ * well-formed internal tokens, that these end within the line, and that
+ * every resolved jump target is the start of a line */
+static bool validate_line_tokens(const unsigned char* area, unsigned index_idx, unsigned area_size,
+        const unsigned char* p, const unsigned char* end)
+{
+    uint8_t state = LINE_SCAN_CODE;
+    while(p < end)
+    {
+        unsigned n = state == LINE_SCAN_CODE ? internal_token_size(p) : 0;
+        if(n)
+        {
+            if(n > (unsigned)(end - p))
+            {
+                return false;
+            }
+            if(is_jump_cache(p))
+            {
+                unsigned target = get_jump_cache(p);
+                if(target && (target >= index_idx - 2 ||
+                        area_find_line(area, index_idx, area_size, get_u16(area + target + 2)) != target))
+                {
+                    return false;
+                }
+            }
+            p += n;
+        }
+        else if(state == LINE_SCAN_CODE && *p >= BASIC_TOKEN_RANGE_BEGIN)
+        {
+            return false;
+        }
+        else
+        {
+            state = line_scan_update(state, *p);
+            p++;
+        }
     }
-    rebuild_list(prog);
     return true;
 }
 
+/* Validate an image and get the end of the program lines in it */
+static enum BASIC_ERROR_ID validate_image(const void* image, unsigned size, unsigned* pindex_idx)
+{
+    const unsigned char* header = (const unsigned char*)image;
+    const unsigned char* area = header + PROG_STORAGE_IMAGE_HEADER_SIZE;
+    if(size < PROG_STORAGE_IMAGE_HEADER_SIZE ||
+            header[0] != 'u' || header[1] != 'C' || header[2] != 'B' ||
+            (header[3] != 1 && header[3] != PROG_STORAGE_IMAGE_VERSION) ||
+            header[4] != BASIC_KEYWORD_RANGE_END - BASIC_KEYWORD_RANGE_BEGIN + 1 ||
+            header[5] != BASIC_CONFIG_NUMBER)
+    {
+        /* Not an image, or an image made by an incompatible interpreter version.
+         * Version 1 images only lack the optional literal and variable tokens, while
+         * versions 2 and 3 hold integral literals as numbers */
+        return BASIC_ERROR_BAD_IMAGE;
+    }
+    unsigned index_idx = get_u16(header + 6);
+    unsigned area_size = get_u16(header + 8);
+    if(area_size != size - PROG_STORAGE_IMAGE_HEADER_SIZE ||
+            index_idx < 3 || index_idx > area_size || (area_size - index_idx) % 2 ||
+            get_u16(header + 10) != image_checksum(area, area_size))
+    {
+        return BASIC_ERROR_BAD_IMAGE;
+    }
+    /* Walk the line links to make sure that they end at the program-end marker,
+     * that the lines are in the order of their numbers and contain no null bytes,
+     * and that the line index lists exactly these lines */
+    unsigned n = (area_size - index_idx) / 2;
+    unsigned idx = 1;
+    unsigned lines = 0;
+    unsigned prev_line = 0;
+    unsigned link;
+    if(area[0])
+    {
+        return BASIC_ERROR_BAD_IMAGE;
+    }
+    while((link = get_u16(area + idx)))
+    {
+        unsigned line = get_u16(area + idx + 2);
+        if(link < 5 || idx + link > index_idx - 2 || area[idx + link - 1] ||
+                memchr(area + idx + 4, 0, link - 5) ||
+                (lines && line <= prev_line) ||
+                lines == n || get_u16(area + index_idx + lines*2) != idx)
+        {
+            return BASIC_ERROR_BAD_IMAGE;
+        }
+        prev_line = line;
+        idx += link;
+        lines++;
+    }
+    if(idx != index_idx - 2 || lines != n)
+    {
+        return BASIC_ERROR_BAD_IMAGE;
+    }
+    /* The jump targets are used without a lookup, so they must be checked
+     * now that the line index is known to be valid */
+    for(idx = 1; (link = get_u16(area + idx)); idx += link)
+    {
+        if(!validate_line_tokens(area, index_idx, area_size, area + idx + 4, area + idx + link - 1))
+        {
+            return BASIC_ERROR_BAD_IMAGE;
+        }
+    }
+    *pindex_idx = index_idx;
+    return BASIC_ERROR_OK;
+}
+
+enum BASIC_ERROR_ID prog_storage_load_image(BASIC_MEM_MGR* prog, const void* image, unsigned size)
+{
+    unsigned index_idx;
+    enum BASIC_ERROR_ID eid = validate_image(image, size, &index_idx);
+    if(eid != BASIC_ERROR_OK)
+    {
+        return eid;
+    }
+    unsigned area_size = size - PROG_STORAGE_IMAGE_HEADER_SIZE;
+    if(area_size > prog->stktop_idx)
+    {
+        return BASIC_ERROR_OUT_OF_MEMORY;
+    }
+
+    /* The image is a verbatim copy of the program area, including the resolved jump targets */
+    prog_storage_clear(prog);
+    memcpy(prog->base, (const unsigned char*)image + PROG_STORAGE_IMAGE_HEADER_SIZE, area_size);
+    prog->index_idx = index_idx;
+    prog->free_idx = prog->vars_idx = area_size;
+    return BASIC_ERROR_OK;
+}
+
+enum BASIC_ERROR_ID prog_storage_attach_image(BASIC_MEM_MGR* prog, const void* image, unsigned size)
+{
+    unsigned index_idx;
+    enum BASIC_ERROR_ID eid = validate_image(image, size, &index_idx);
+    if(eid != BASIC_ERROR_OK)
+    {
+        return eid;
+    }
+    /* Start with an empty overlay */
+    prog_storage_clear(prog);
+    prog->rom = (const unsigned char*)image + PROG_STORAGE_IMAGE_HEADER_SIZE;
+    prog->rom_index_idx = index_idx;
+    prog->rom_size = size - PROG_STORAGE_IMAGE_HEADER_SIZE;
+    return BASIC_ERROR_OK;
+}
+
+bool prog_storage_detach_rom(BASIC_MEM_MGR* prog)
+{
+    if(!prog->rom)
+    {
+        return true;
+    }
+    /* The variables are dropped with the overlay. Drop them first,
+     * so that the arrays are out of the way */
+    variable_storage_clear(prog);
+    /* Compute the size of the merged program */
+    unsigned size = 3;
+    unsigned line = 0;
+    const unsigned char* p = prog_storage_get_line_parse_ptr(prog, prog_storage_find_line(prog, 0).idx);
+    while(p = prog_storage_advance_line(prog, p, &line), line != UINT_MAX)
+    {
+        size += get_u16(p - 4) + 2;
+        p += strlen((const char*)p);
+    }
+    unsigned overlay_size = prog->vars_idx;
+    if(size > UINT16_MAX || size + overlay_size > prog->stktop_idx)
+    {
+        return false;
+    }
+
+    /* Move the overlay to the top of the free memory, out of the way,
+     * and append the merged lines to an empty program in RAM */
+    BASIC_MEM_MGR src = *prog;
+    src.base = prog->base + prog->stktop_idx - overlay_size;
+    memmove(src.base, prog->base, overlay_size);
+    prog->stktop_idx -= overlay_size;
+    prog_storage_clear(prog);
+    line = 0;
+    p = prog_storage_get_line_parse_ptr(&src, prog_storage_find_line(&src, 0).idx);
+    while(p = prog_storage_advance_line(&src, p, &line), line != UINT_MAX)
+    {
+        store_line(prog, line, (const char*)p, true);
+        p += strlen((const char*)p);
+    }
+    prog->stktop_idx += overlay_size;
+    return true;
+}
+
+/* Find the DATA statements in the program in the same way as READ does,
+ * and store their positions into the index, if it is not null. Returns their number */
+static unsigned scan_data(const BASIC_MEM_MGR* prog, unsigned char* index)
+{
+    unsigned count = 0;
+    unsigned line;
+    const unsigned char* p = prog_storage_get_line_parse_ptr(prog, prog_storage_find_line(prog, 0).idx);
+    while((p = prog_storage_advance_line(prog, p, &line)), line != UINT_MAX)
+    {
+        while(*p)
+        {
+            p = basic_parsing_skipws(p);
+            if(*p == BASIC_KEYWORD_DATA)
+            {
+                if(index)
+                {
+                    unsigned char* entry = index + count * PROG_STORAGE_DATA_ENTRY_SIZE;
+                    put_u16(entry, prog_storage_ptr_to_idx(prog, basic_parsing_skipws(p + 1)));
+                    put_u16(entry + 2, line);
+                }
+                count++;
+            }
+            p = basic_parsing_skip_to_end_statement(p);
+            if(*p == ':')
+            {
+                p++;
+            }
+        }
+    }
+    return count;
+}
+
+bool prog_storage_build_data_index(BASIC_MEM_MGR* prog)
+{
+    if(prog->data_index_valid)
+    {
+        return true;
+    }
+    if(prog->stktop_idx != prog->data_idx)
+    {
+        /* The FOR/GOSUB stack and the arrays must be empty */
+        return false;
+    }
+    unsigned size = scan_data(prog, NULL) * PROG_STORAGE_DATA_ENTRY_SIZE;
+    if(!basic_mem_check_space(prog, size))
+    {
+        /* READ will search for DATA statements */
+        return false;
+    }
+    prog->max_idx -= size;
+    prog->stktop_idx = prog->data_idx = prog->max_idx;
+    scan_data(prog, prog->base + prog->data_idx);
+    prog->data_index_valid = true;
+    return true;
+}
+
+void prog_storage_release_data_index(BASIC_MEM_MGR* prog)
+{
+    unsigned size = prog->ram_top_idx - prog->data_idx;
+    if(size)
+    {
+        /* Move the FOR/GOSUB stack and the arrays up to RAMtop */
+        unsigned char* pb = prog->base;
+        memmove(pb + prog->stktop_idx + size, pb + prog->stktop_idx, prog->data_idx - prog->stktop_idx);
+        prog->stktop_idx += size;
+        prog->max_idx += size;
+        prog->data_idx = prog->ram_top_idx;
+    }
+    prog->data_index_valid = false;
+}
+
+const unsigned char* prog_storage_get_data(const BASIC_MEM_MGR* prog, unsigned entry, unsigned* pline)
+{
+    const unsigned char* p = prog->base + prog->data_idx + entry * PROG_STORAGE_DATA_ENTRY_SIZE;
+    *pline = get_u16(p + 2);
+    return prog_storage_idx_to_ptr(prog, get_u16(p));
+}
+
+unsigned prog_storage_find_data(const BASIC_MEM_MGR* prog, unsigned line)
+{
+    /* Binary search for the first DATA statement in this line or after it */
+    const unsigned char* index = prog->base + prog->data_idx;
+    unsigned lo = 0;
+    unsigned hi = prog_storage_data_count(prog);
+    while(lo < hi)
+    {
+        unsigned mid = (lo + hi) / 2;
+        if(get_u16(index + mid * PROG_STORAGE_DATA_ENTRY_SIZE + 2) < line)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
 static void print_tokenized_line(const unsigned char* s)
 {
+    uint8_t state = LINE_SCAN_CODE;
     while(*s)
     {
         unsigned char c = *s;
+        if(state == LINE_SCAN_CODE && is_jump_cache(s))
+        {
+            /* Jump cache slots are invisible */
+            s += PROG_STORAGE_JUMP_CACHE_SIZE;
+            continue;
+        }
+        if(state == LINE_SCAN_CODE && is_literal(s))
+        {
+            /* So are the pre-parsed values of literals, whose text follows */
+            s += literal_size(s);
+            continue;
+        }
+        if(state == LINE_SCAN_CODE && is_varref(s))
+        {
+            /* And the variable reference tokens in front of the names */
+            s += PROG_STORAGE_VARREF_SIZE;
+            continue;
+        }
+        state = line_scan_update(state, c);
         if(c >= BASIC_KEYWORD_RANGE_BEGIN && c <= BASIC_KEYWORD_RANGE_END)
         {
             basic_printf("%s", keyword_text_table[c-BASIC_KEYWORD_RANGE_BEGIN]);
@@ -186,20 +1043,18 @@ static void print_tokenized_line(const unsigned char* s)
 
 void prog_storage_list(const BASIC_MEM_MGR* prog, unsigned first_line)
 {
-    const unsigned char* const cpb = prog->base;
-    unsigned idx;
+    unsigned line = first_line;
+    const unsigned char* p = prog_storage_get_line_parse_ptr(prog, prog_storage_find_line(prog, first_line).idx);
+    while(true)
     {
-        FIND_LINE_RESULT fl = prog_storage_find_line(prog, first_line);
-        idx = fl.idx;
-    }
-    unsigned nxt_idx;
-    while((nxt_idx = cpb[idx] | cpb[idx+1] << 8))
-    {
-        unsigned line_num = cpb[idx+2] | cpb[idx+3] << 8;
-        basic_printf("%u ", line_num);
+        p = prog_storage_advance_line(prog, p, &line);
+        if(line == UINT_MAX)
+        {
+            break;
+        }
+        basic_printf("%u ", line);
         /* Print the line, de-tokenizing tokens */
-        print_tokenized_line(cpb+idx+4);
-        idx = nxt_idx;
+        print_tokenized_line(p);
+        p += strlen((const char*)p);
     }
-
 }
@@ -35,41 +35,136 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.  */
 #include <string.h>
 #include <stddef.h>
 
+/* With aligned values, the entries are padded after the name */
+#if !BASIC_CONFIG_ALIGNED_VALUES
 #pragma pack(push,1)
+#endif
 typedef struct VARIABLE_ENTRY_
 {
     var_name_packed name;
     VARIABLE_VALUE value;
 } VARIABLE_ENTRY;
+#if !BASIC_CONFIG_ALIGNED_VALUES
+#pragma pack(pop)
+#endif
 
+#pragma pack(push,1)
 typedef struct ARRAY_VARIABLE_HEADER_
 {
     var_name_packed name;
-    uint16_t block_size; // Array block size, in bytes, excluding header
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+    uint16_t reserved; // Keeps the header size a multiple of 4
+#endif
+    basic_array_size_t block_size; // Array block size, in bytes, excluding header. The low 2 bits hold the element type
 } ARRAY_VARIABLE_HEADER;
+
+/* Multi-dimensional arrays are flagged in the stored name, and their block begins
+ * with the strides of the leading dimensions, in elements. The elements follow in row-major
+ * order. The last dimension has a stride of 1, and a zero second stride marks a 2-D array */
+typedef struct ARRAY_STRIDES_
+{
+    basic_array_size_t stride[VARIABLE_ARRAY_MAX_DIMS-1];
+} ARRAY_STRIDES;
 #pragma pack(pop)
 
+#define ARRAY_MULTI_DIM 0x8000
+/* Blocks are padded to a multiple of 4 bytes. The last byte of a padded block
+ * holds the number of padding bytes, so that the elements are counted exactly */
+#define ARRAY_PADDED 0x0080
+#define ARRAY_NAME_FLAGS (ARRAY_MULTI_DIM | ARRAY_PADDED)
+#define ARRAY_TYPE_MASK 3u
+
+static inline unsigned array_block_size(const ARRAY_VARIABLE_HEADER* avh)
+{
+    return avh->block_size & ~ARRAY_TYPE_MASK;
+}
+
+/* Size of the strides and the elements of an array block, without padding */
+static inline unsigned array_data_size(const ARRAY_VARIABLE_HEADER* avh)
+{
+    unsigned size = array_block_size(avh);
+    if(avh->name & ARRAY_PADDED)
+    {
+        size -= ((const unsigned char*)(avh + 1))[size - 1];
+    }
+    return size;
+}
+
+/* Wide enough for a subscript times a stride */
+#if BASIC_CONFIG_ARRAY_INDEX_BITS == 32
+typedef uint64_t array_product_t;
+#else
+typedef uint32_t array_product_t;
+#endif
+
 
 void variable_storage_clear(BASIC_MEM_MGR* s)
 {
-    s->free_idx = s->array_idx = s->vars_idx;
+    s->free_idx = s->vars_idx;
+    s->int_letters = 0;
+    s->typed_arrays = false;
+#if BASIC_CONFIG_VAR_SLOTS
+    memset(s->var_slots, 0, sizeof(s->var_slots));
+#endif
+    /* Drop the arrays, moving the FOR/GOSUB stack back up */
+    unsigned size = s->data_idx - s->max_idx;
+    if(size)
+    {
+        memmove(s->base + s->stktop_idx + size, s->base + s->stktop_idx, s->max_idx - s->stktop_idx);
+        s->stktop_idx += size;
+        s->max_idx = s->data_idx;
+    }
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+    memset(s->array_desc, 0, sizeof(s->array_desc));
+    s->array_desc_full = false;
+#endif
 }
 
+#if BASIC_CONFIG_VAR_SLOTS
+static inline unsigned var_slot(var_name_packed var)
+{
+    /* 11 slots for each letter: without a digit, and with digits 0 to 9.
+     * Integer variables follow all of them */
+    unsigned c = var >> 8 ? var >> 8 : var & ~VAR_NAME_INTEGER;
+    unsigned slot = var_name_letter_index(c) * 11;
+    if(var_name_is_integer(var))
+    {
+        slot += 52 * 11;
+    }
+    return var >> 8 ? slot + (var & 0x7F) - '0' + 1 : slot;
+}
+#endif
+
 void variable_storage_initialize(BASIC_MEM_MGR* s, unsigned char* base, unsigned size)
 {
     /* Initialize an empty variable storage */
     s->base = base;
-    s->vars_idx = 0;
-    s->max_idx = size;
-    s->stktop_idx = size;
+    s->index_idx = s->vars_idx = 0;
+    s->rom = NULL;
+    s->rom_index_idx = s->rom_size = 0;
+    s->max_idx = s->data_idx = basic_mem_top(base, size);
+    s->stktop_idx = s->max_idx;
+    s->gosub_depth = 0;
+    s->number_flags = 0;
     variable_storage_clear(s);
 }
 
+/* Position of the first scalar variable entry. Entry positions are kept relative to it,
+ * and they stay valid as long as the variables are not cleared */
+static inline basic_mem_idx_t vars_start(const BASIC_MEM_MGR* s)
+{
+    return s->vars_idx + (-(uintptr_t)(s->base + s->vars_idx) & (BASIC_MEM_VALUE_ALIGN - 1));
+}
+
 static VARIABLE_VALUE* lookup_var(BASIC_MEM_MGR* s, var_name_packed var)
 {
     unsigned char* const pb = s->base;
-    unsigned idx = s->vars_idx;
-    while(idx < s->array_idx)
+#if BASIC_CONFIG_VAR_SLOTS
+    unsigned end = s->var_slots[var_slot(var)];
+    return end ? (VARIABLE_VALUE*)(pb + vars_start(s) + end - sizeof(VARIABLE_VALUE)) : 0;
+#else
+    unsigned idx = vars_start(s);
+    while(idx < s->free_idx)
     {
         var_name_packed v0 = pb[idx] | pb[idx+1] << 8;
         if(var == v0)
@@ -79,65 +174,244 @@ static VARIABLE_VALUE* lookup_var(BASIC_MEM_MGR* s, var_name_packed var)
         idx += sizeof(VARIABLE_ENTRY);
     }
     return 0; /* Not found! */
+#endif
+}
+
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+static inline unsigned array_desc_hash(var_name_packed var)
+{
+    return (var ^ (var >> 8) * 3) & (BASIC_CONFIG_ARRAY_DESCRIPTORS - 1);
 }
+#endif
 
-enum BASIC_ERROR_ID variable_storage_create_array_var(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_VALUE** ppv, unsigned subscript, bool dim)
+/* Find the header of the array with the given name, or return 0 if there is none */
+static basic_mem_idx_t find_array(BASIC_MEM_MGR* s, var_name_packed var)
 {
     unsigned char* const pb = s->base;
-    unsigned idx = s->array_idx;
-    while(idx + sizeof(ARRAY_VARIABLE_HEADER) <= s->free_idx)
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+    unsigned h = array_desc_hash(var);
+    for(unsigned i = 0; i < BASIC_CONFIG_ARRAY_DESCRIPTORS; i++)
+    {
+        const BASIC_MEM_ARRAY_DESC* d = &s->array_desc[(h + i) & (BASIC_CONFIG_ARRAY_DESCRIPTORS - 1)];
+        if(d->name == var)
+        {
+            return s->data_idx - d->offset;
+        }
+        if(!d->name)
+        {
+            break;
+        }
+    }
+    if(!s->array_desc_full)
+    {
+        return 0;
+    }
+#endif
+    /* Walk the array headers */
+    unsigned idx = s->max_idx;
+    while(idx < s->data_idx)
     {
         const ARRAY_VARIABLE_HEADER* avh = (const ARRAY_VARIABLE_HEADER*)&pb[idx];
-        if(avh->name == var)
+        if((avh->name & ~ARRAY_NAME_FLAGS) == var)
         {
-            /* Check if we are trying to re-dimension an array */
-            if(dim)
-            {
-                return BASIC_ERROR_REDIMENSION;
-            }
-            /* Check subscript bounds */
-            if(subscript * sizeof(VARIABLE_VALUE) >= avh->block_size)
+            return idx;
+        }
+        idx += sizeof(ARRAY_VARIABLE_HEADER) + array_block_size(avh);
+    }
+    return 0;
+}
+
+/* Locate an element of the array at idx, checking the subscripts against each dimension */
+static enum BASIC_ERROR_ID array_element(BASIC_MEM_MGR* s, unsigned idx, VARIABLE_VALUE** ppv, unsigned char* type, const unsigned* subscripts, unsigned ndims)
+{
+    unsigned char* pd = s->base + idx + sizeof(ARRAY_VARIABLE_HEADER);
+    const ARRAY_VARIABLE_HEADER* avh = (const ARRAY_VARIABLE_HEADER*)(s->base + idx);
+    unsigned bound = array_data_size(avh);
+    unsigned offset = 0;
+    *type = avh->block_size & ARRAY_TYPE_MASK;
+    unsigned size = variable_type_size(*type);
+    if(avh->name & ARRAY_MULTI_DIM)
+    {
+        const ARRAY_STRIDES* as = (const ARRAY_STRIDES*)pd;
+        pd += sizeof(ARRAY_STRIDES);
+        bound = (bound - sizeof(ARRAY_STRIDES)) / size;
+        unsigned dims = as->stride[VARIABLE_ARRAY_MAX_DIMS-2] ? VARIABLE_ARRAY_MAX_DIMS : 2;
+        if(ndims != dims)
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        /* Each leading subscript must select a row within the bound of its dimension */
+        for(unsigned d = 0; d < dims - 1; d++)
+        {
+            array_product_t row = (array_product_t)subscripts[d] * as->stride[d];
+            if(row >= bound)
             {
                 return BASIC_ERROR_SUBSCRIPT;
             }
-            *ppv = (VARIABLE_VALUE*)(pb+idx+sizeof(ARRAY_VARIABLE_HEADER)) + subscript;
-            return BASIC_ERROR_OK;
+            offset += row;
+            bound = as->stride[d];
         }
-        idx += sizeof(ARRAY_VARIABLE_HEADER) + avh->block_size;
     }
-    /* Array variable not found - create one */
-    unsigned new_block_size;
-    if(dim)
+    else
     {
-        new_block_size = subscript;
+        if(ndims != 1)
+        {
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        bound /= size;
     }
-    else if(subscript > 10)
+    if(subscripts[ndims-1] >= bound)
     {
-        /* For default dimensioning by the first array reference, check
-         * that the subscript is within the default bounds */
         return BASIC_ERROR_SUBSCRIPT;
     }
-    else
+    *ppv = variable_element((VARIABLE_VALUE*)pd, *type, offset + subscripts[ndims-1]);
+    return BASIC_ERROR_OK;
+}
+
+enum BASIC_ERROR_ID variable_storage_create_array_var(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_VALUE** ppv, unsigned char* type, const unsigned* subscripts, unsigned ndims, bool dim)
+{
+    unsigned char* const pb = s->base;
+    unsigned idx = find_array(s, var);
+    if(idx)
+    {
+        /* Check if we are trying to re-dimension an array */
+        if(dim)
+        {
+            return BASIC_ERROR_REDIMENSION;
+        }
+        return array_element(s, idx, ppv, type, subscripts, ndims);
+    }
+    /* Array variable not found - create one. Add the 0th element to each dimension */
+    if(!dim)
     {
-        /* Default array size */
-        new_block_size = 10;
+        *type = VARIABLE_TYPE_NUMBER;
     }
-    /* Add the 0th element and account for element size */
-    new_block_size = (new_block_size+1)*sizeof(VARIABLE_VALUE);
+    unsigned elem_size = variable_type_size(*type);
+    unsigned extent[VARIABLE_ARRAY_MAX_DIMS];
+    unsigned count = 1;
+    for(unsigned d = 0; d < ndims; d++)
+    {
+        if(dim)
+        {
+            extent[d] = subscripts[d] + 1;
+        }
+        else if(subscripts[d] > 10)
+        {
+            /* For default dimensioning by the first array reference, check
+             * that the subscript is within the default bounds */
+            return BASIC_ERROR_SUBSCRIPT;
+        }
+        else
+        {
+            /* Default array size */
+            extent[d] = 11;
+        }
+        /* The array size must fit its header field, and the size arithmetic must not overflow */
+        if(count > (BASIC_ARRAY_SIZE_MAX - sizeof(ARRAY_VARIABLE_HEADER) - sizeof(ARRAY_STRIDES) - 3) /
+                elem_size / extent[d])
+        {
+            return BASIC_ERROR_OUT_OF_MEMORY;
+        }
+        count *= extent[d];
+    }
+    /* Account for element size, and the strides of a multi-dimensional array */
+    unsigned data_size = count*elem_size;
+    if(ndims > 1)
+    {
+        data_size += sizeof(ARRAY_STRIDES);
+    }
+    unsigned new_block_size = (data_size + 3) & ~3u;
     /* Check for OOMEM */
-    if(!basic_mem_check_space(s, new_block_size + sizeof(ARRAY_VARIABLE_HEADER)))
+    unsigned size = new_block_size + sizeof(ARRAY_VARIABLE_HEADER);
+    if(!basic_mem_check_space(s, size))
     {
         return BASIC_ERROR_OUT_OF_MEMORY;
     }
+    /* Move the FOR/GOSUB stack down, and place the new array under the existing ones.
+     * Stack sizes and the block size are multiples of 4, which keeps the stack frames aligned */
+    memmove(pb + s->stktop_idx - size, pb + s->stktop_idx, s->max_idx - s->stktop_idx);
+    s->stktop_idx -= size;
+    s->max_idx -= size;
     /* Initialize the new array variable */
-    ARRAY_VARIABLE_HEADER* avh = (ARRAY_VARIABLE_HEADER*)(pb+s->free_idx);
-    VARIABLE_VALUE* pae = (VARIABLE_VALUE*)(pb+s->free_idx+sizeof(ARRAY_VARIABLE_HEADER));
+    ARRAY_VARIABLE_HEADER* avh = (ARRAY_VARIABLE_HEADER*)(pb+s->max_idx);
+    unsigned char* pd = pb+s->max_idx+sizeof(ARRAY_VARIABLE_HEADER);
     avh->name = var;
-    avh->block_size = new_block_size;
-    memset(pae, 0, new_block_size); /* Initialize all array elements to zeros */
-    s->free_idx += new_block_size+sizeof(ARRAY_VARIABLE_HEADER); /* Mark that it is now allocated */
-    *ppv = pae + subscript; /* For DIM, the return value will point to 1 past the last element and will never be used */
-    return BASIC_ERROR_OK;
+    avh->block_size = new_block_size | *type;
+    s->typed_arrays |= *type != VARIABLE_TYPE_NUMBER;
+    memset(pd, 0, new_block_size); /* Initialize all array elements to zeros */
+    if(new_block_size != data_size)
+    {
+        pd[new_block_size - 1] = new_block_size - data_size;
+        avh->name |= ARRAY_PADDED;
+    }
+    if(ndims > 1)
+    {
+        /* Strides of the leading dimensions; an unused last stride remains zero */
+        ARRAY_STRIDES* as = (ARRAY_STRIDES*)pd;
+        unsigned stride = 1;
+        for(unsigned d = ndims - 1; d > 0; d--)
+        {
+            stride *= extent[d];
+            as->stride[d-1] = stride;
+        }
+        avh->name |= ARRAY_MULTI_DIM;
+    }
+#if BASIC_CONFIG_ARRAY_DESCRIPTORS
+    /* Add a descriptor, if there is a free one */
+    s->array_desc_full = true;
+    unsigned h = array_desc_hash(var);
+    for(unsigned i = 0; i < BASIC_CONFIG_ARRAY_DESCRIPTORS; i++)
+    {
+        BASIC_MEM_ARRAY_DESC* d = &s->array_desc[(h + i) & (BASIC_CONFIG_ARRAY_DESCRIPTORS - 1)];
+        if(!d->name)
+        {
+            d->name = var;
+            d->offset = s->data_idx - s->max_idx;
+            s->array_desc_full = false;
+            break;
+        }
+    }
+#endif
+    if(dim)
+    {
+        /* The return value is never used for DIM */
+        *ppv = (VARIABLE_VALUE*)pd;
+        return BASIC_ERROR_OK;
+    }
+    return array_element(s, s->max_idx, ppv, type, subscripts, ndims);
+}
+
+bool variable_storage_get_array(BASIC_MEM_MGR* s, var_name_packed var, VARIABLE_ARRAY* out)
+{
+    unsigned idx = find_array(s, var);
+    if(!idx)
+    {
+        return false;
+    }
+    unsigned char* pd = s->base + idx + sizeof(ARRAY_VARIABLE_HEADER);
+    const ARRAY_VARIABLE_HEADER* avh = (const ARRAY_VARIABLE_HEADER*)(s->base + idx);
+    out->type = avh->block_size & ARRAY_TYPE_MASK;
+    if(avh->name & ARRAY_MULTI_DIM)
+    {
+        const ARRAY_STRIDES* as = (const ARRAY_STRIDES*)pd;
+        pd += sizeof(ARRAY_STRIDES);
+        out->ndims = as->stride[VARIABLE_ARRAY_MAX_DIMS-2] ? VARIABLE_ARRAY_MAX_DIMS : 2;
+        /* Each extent is the ratio of the strides on both sides of its dimension */
+        unsigned outer = (array_data_size(avh) - sizeof(ARRAY_STRIDES)) / variable_type_size(out->type);
+        for(unsigned d = 0; d < out->ndims - 1; d++)
+        {
+            out->extent[d] = outer / as->stride[d];
+            outer = as->stride[d];
+        }
+        out->extent[out->ndims-1] = outer;
+    }
+    else
+    {
+        out->ndims = 1;
+        out->extent[0] = array_data_size(avh) / variable_type_size(out->type);
+    }
+    out->data = (VARIABLE_VALUE*)pd;
+    return true;
 }
 
 VARIABLE_VALUE* variable_storage_create_var(BASIC_MEM_MGR* s, var_name_packed var)
@@ -147,36 +421,108 @@ VARIABLE_VALUE* variable_storage_create_var(BASIC_MEM_MGR* s, var_name_packed va
     {
         return retval;
     }
-    /* Not found. Allocate a new variable, moving the array block upwards if it is nonempty */
-    if(!basic_mem_check_space(s, sizeof(VARIABLE_ENTRY)))
+    /* Not found. Allocate a new variable at the end of the scalar variables */
+    unsigned start = vars_start(s);
+    unsigned idx = s->free_idx < start ? start : s->free_idx;
+    if(!basic_mem_check_space(s, idx - s->free_idx + sizeof(VARIABLE_ENTRY)))
     {
         /* OOMEM - cannot create the variable */
         return 0;
     }
     unsigned char* const pb = s->base;
-    if(s->array_idx != s->free_idx)
-    {
-        memmove(pb+s->array_idx+sizeof(VARIABLE_ENTRY), pb+s->array_idx, s->free_idx-s->array_idx);
-    }
-    retval = (VARIABLE_VALUE*)(pb+s->array_idx+offsetof(VARIABLE_ENTRY, value));
+    retval = (VARIABLE_VALUE*)(pb+idx+offsetof(VARIABLE_ENTRY, value));
     /* Store the variable name and initialize its value to zero */
-    memcpy(pb+s->array_idx, &var, sizeof(var_name_packed));
+    memcpy(pb+idx, &var, sizeof(var_name_packed));
     memset(retval, 0, sizeof(VARIABLE_VALUE));
-    s->array_idx += sizeof(VARIABLE_ENTRY);
-    s->free_idx += sizeof(VARIABLE_ENTRY);
+    s->free_idx = idx + sizeof(VARIABLE_ENTRY);
+#if BASIC_CONFIG_VAR_SLOTS
+    s->var_slots[var_slot(var)] = s->free_idx - start;
+#endif
+    return retval;
+}
+
+/* Number of the variable entry of a value, counting from the first one */
+static unsigned entry_number(const BASIC_MEM_MGR* s, const VARIABLE_VALUE* pval)
+{
+    return ((const unsigned char*)pval - s->base - offsetof(VARIABLE_ENTRY, value) - vars_start(s)) / sizeof(VARIABLE_ENTRY);
+}
+
+/* The cache holds the number of the variable entry. Entries have a fixed size
+ * and never move until the variables are cleared, so the cache always points
+ * to the beginning of an entry, and checking the name there is enough to validate it */
+VARIABLE_VALUE* variable_storage_lookup_var_cached(BASIC_MEM_MGR* s, var_name_packed var, unsigned* cache)
+{
+    unsigned char* const pb = s->base;
+    unsigned idx = vars_start(s) + *cache * sizeof(VARIABLE_ENTRY);
+    if(idx + sizeof(VARIABLE_ENTRY) <= s->free_idx && (var_name_packed)(pb[idx] | pb[idx+1] << 8) == var)
+    {
+        return (VARIABLE_VALUE*)(pb+idx+offsetof(VARIABLE_ENTRY, value));
+    }
+    VARIABLE_VALUE* retval = lookup_var(s, var);
+    if(retval)
+    {
+        *cache = entry_number(s, retval);
+    }
+    return retval;
+}
+
+VARIABLE_VALUE* variable_storage_create_var_cached(BASIC_MEM_MGR* s, var_name_packed var, unsigned* cache)
+{
+    VARIABLE_VALUE* retval = variable_storage_lookup_var_cached(s, var, cache);
+    if(!retval)
+    {
+        retval = variable_storage_create_var(s, var);
+        if(retval)
+        {
+            *cache = entry_number(s, retval);
+        }
+    }
     return retval;
 }
 
-float variable_storage_read_var(BASIC_MEM_MGR* s, var_name_packed var)
+BASIC_VALUE variable_storage_read_var(BASIC_MEM_MGR* s, var_name_packed var)
 {
     VARIABLE_VALUE* pval = lookup_var(s, var);
     if(pval)
     {
-        return pval->f;
+        return variable_storage_value(pval, var_name_type(var));
     }
     else
     {
         /* All variables read as zero until initialized otherwise */
-        return 0.0f;
+        return var_name_is_integer(var) ? basic_value_int(0) : basic_value_number(0);
     }
 }
+
+enum BASIC_ERROR_ID variable_storage_assign_int(VARIABLE_VALUE* v, unsigned char type, BASIC_VALUE val)
+{
+    int32_t i;
+    if(!basic_value_to_int(val, &i))
+    {
+        return BASIC_ERROR_OVERFLOW;
+    }
+    switch(type)
+    {
+    case VARIABLE_TYPE_INT8:
+        if(i < INT8_MIN || i > INT8_MAX)
+        {
+            return BASIC_ERROR_OVERFLOW;
+        }
+        *(int8_t*)v = (int8_t)i;
+        break;
+    case VARIABLE_TYPE_INT16:
+        if(i < INT16_MIN || i > INT16_MAX)
+        {
+            return BASIC_ERROR_OVERFLOW;
+        }
+    {
+        int16_t i16 = (int16_t)i;
+        memcpy(v, &i16, sizeof(i16));
+        break;
+    }
+    default:
+        v->i = i;
+        break;
+    }
+    return BASIC_ERROR_OK;
+}